@@ -0,0 +1,120 @@
+/* Small glyph batch benchmark.
+
+   Renders the printable ASCII glyphs of a font at small pixel sizes, one
+   stbtt_MakeGlyphBitmap call at a time and with stbtt_MakeGlyphBitmapBatch,
+   into an atlas-like buffer, and reports the time per glyph and the largest
+   difference between the two.
+
+   usage: bench_batch font.ttf */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STB_TRUETYPE_IMPLEMENTATION
+#define STBTT_STATIC
+#include "stb_truetype.h"
+
+#define NUM_GLYPHS  (127-33)
+#define CELL        64
+#define STRIDE      (NUM_GLYPHS*CELL)
+
+static double now(void)
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static unsigned char *load_file(const char *filename)
+{
+   FILE *f = fopen(filename, "rb");
+   unsigned char *data;
+   long size;
+   if (!f) return NULL;
+   fseek(f, 0, SEEK_END);
+   size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   data = malloc(size);
+   if (fread(data, 1, size, f) != (size_t) size) {
+      free(data);
+      data = NULL;
+   }
+   fclose(f);
+   return data;
+}
+
+/* Best of five runs of at least 0.1s each, in microseconds per glyph. */
+static double time_render(const stbtt_fontinfo *info, stbtt_batch_glyph *glyphs, float scale, int batch)
+{
+   double best = 1e30;
+   int run, i;
+   for (run=0; run < 5; ++run) {
+      double start = now(), elapsed;
+      long count = 0;
+      do {
+         if (batch)
+            stbtt_MakeGlyphBitmapBatch(info, glyphs, NUM_GLYPHS, STRIDE, scale, scale);
+         else
+            for (i=0; i < NUM_GLYPHS; ++i)
+               stbtt_MakeGlyphBitmap(info, glyphs[i].output, glyphs[i].w, glyphs[i].h, STRIDE, scale, scale, glyphs[i].glyph);
+         count += NUM_GLYPHS;
+      } while ((elapsed = now() - start) < 0.1);
+      if (elapsed / count < best)
+         best = elapsed / count;
+   }
+   return best * 1e6;
+}
+
+int main(int argc, char **argv)
+{
+   static const float sizes[] = { 8, 12, 16, 24, 32 };
+   static stbtt_batch_glyph glyphs[NUM_GLYPHS];
+   stbtt_fontinfo info;
+   unsigned char *data, *a, *b;
+   int s, i;
+
+   if (argc < 2) {
+      fprintf(stderr, "usage: %s font.ttf\n", argv[0]);
+      return 1;
+   }
+   data = load_file(argv[1]);
+   if (!data || !stbtt_InitFont(&info, data, stbtt_GetFontOffsetForIndex(data, 0))) {
+      fprintf(stderr, "%s: cannot load font\n", argv[1]);
+      return 1;
+   }
+   a = calloc(STRIDE, CELL);
+   b = calloc(STRIDE, CELL);
+
+   printf("%6s %14s %14s %8s %10s\n", "px", "single us/gl", "batch us/gl", "speedup", "max diff");
+   for (s=0; s < (int) (sizeof(sizes)/sizeof(sizes[0])); ++s) {
+      float scale = stbtt_ScaleForPixelHeight(&info, sizes[s]);
+      double t1, tb;
+      int max_diff = 0;
+      for (i=0; i < NUM_GLYPHS; ++i) {
+         int x0, y0, x1, y1;
+         glyphs[i].glyph = stbtt_FindGlyphIndex(&info, 33+i);
+         stbtt_GetGlyphBitmapBox(&info, glyphs[i].glyph, scale, scale, &x0, &y0, &x1, &y1);
+         glyphs[i].output = a + i*CELL;
+         glyphs[i].w = x1-x0 < CELL ? x1-x0 : CELL;
+         glyphs[i].h = y1-y0 < CELL ? y1-y0 : CELL;
+      }
+      t1 = time_render(&info, glyphs, scale, 0);
+      tb = time_render(&info, glyphs, scale, 1);
+
+      memset(a, 0, STRIDE*CELL);
+      for (i=0; i < NUM_GLYPHS; ++i)
+         stbtt_MakeGlyphBitmap(&info, glyphs[i].output, glyphs[i].w, glyphs[i].h, STRIDE, scale, scale, glyphs[i].glyph);
+      for (i=0; i < NUM_GLYPHS; ++i)
+         glyphs[i].output = b + i*CELL;
+      memset(b, 0, STRIDE*CELL);
+      stbtt_MakeGlyphBitmapBatch(&info, glyphs, NUM_GLYPHS, STRIDE, scale, scale);
+      for (i=0; i < STRIDE*CELL; ++i)
+         if (abs(a[i] - b[i]) > max_diff)
+            max_diff = abs(a[i] - b[i]);
+
+      printf("%6g %14.2f %14.2f %7.2fx %10d\n", sizes[s], t1, tb, t1 / tb, max_diff);
+   }
+   return 0;
+}
@@ -0,0 +1,118 @@
+/* Rasterizer benchmark: the default float rasterizer (version 2) against
+   the fixed-point one (version 3).
+
+   Renders the printable ASCII glyphs of a font at a range of pixel sizes
+   with both, and reports the time per glyph and the largest difference
+   between their outputs.
+
+   usage: bench_raster font.ttf */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STB_TRUETYPE_IMPLEMENTATION
+#define STBTT_STATIC
+#include "stb_truetype.h"
+
+void render_v3(const stbtt_fontinfo *info, unsigned char *output, int w, int h, float scale, int glyph);
+
+static void render_v2(const stbtt_fontinfo *info, unsigned char *output, int w, int h, float scale, int glyph)
+{
+   stbtt_MakeGlyphBitmap(info, output, w, h, w, scale, scale, glyph);
+}
+
+typedef void render_func(const stbtt_fontinfo *, unsigned char *, int, int, float, int);
+
+static double now(void)
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static unsigned char *load_file(const char *filename)
+{
+   FILE *f = fopen(filename, "rb");
+   unsigned char *data;
+   long size;
+   if (!f) return NULL;
+   fseek(f, 0, SEEK_END);
+   size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   data = malloc(size);
+   if (fread(data, 1, size, f) != (size_t) size) {
+      free(data);
+      data = NULL;
+   }
+   fclose(f);
+   return data;
+}
+
+/* Best of five runs of at least 0.1s each, in microseconds per glyph. */
+static double time_render(render_func *render, const stbtt_fontinfo *info, float scale, unsigned char *buffer)
+{
+   double best = 1e30;
+   int run;
+   for (run=0; run < 5; ++run) {
+      double start = now(), elapsed;
+      long glyphs = 0;
+      do {
+         int c;
+         for (c=33; c < 127; ++c) {
+            int g = stbtt_FindGlyphIndex(info, c), x0, y0, x1, y1;
+            stbtt_GetGlyphBitmapBox(info, g, scale, scale, &x0, &y0, &x1, &y1);
+            render(info, buffer, x1-x0, y1-y0, scale, g);
+            ++glyphs;
+         }
+      } while ((elapsed = now() - start) < 0.1);
+      if (elapsed / glyphs < best)
+         best = elapsed / glyphs;
+   }
+   return best * 1e6;
+}
+
+int main(int argc, char **argv)
+{
+   static const float sizes[] = { 8, 12, 16, 24, 48, 96, 200, 400 };
+   stbtt_fontinfo info;
+   unsigned char *data, *a, *b;
+   int s;
+
+   if (argc < 2) {
+      fprintf(stderr, "usage: %s font.ttf\n", argv[0]);
+      return 1;
+   }
+   data = load_file(argv[1]);
+   if (!data || !stbtt_InitFont(&info, data, stbtt_GetFontOffsetForIndex(data, 0))) {
+      fprintf(stderr, "%s: cannot load font\n", argv[1]);
+      return 1;
+   }
+   a = malloc(1024*1024);
+   b = malloc(1024*1024);
+
+   printf("%6s %12s %12s %8s %10s %10s\n", "px", "v2 us/glyph", "v3 us/glyph", "speedup", "max diff", "pixels off");
+   for (s=0; s < (int) (sizeof(sizes)/sizeof(sizes[0])); ++s) {
+      float scale = stbtt_ScaleForPixelHeight(&info, sizes[s]);
+      double t2 = time_render(render_v2, &info, scale, a);
+      double t3 = time_render(render_v3, &info, scale, a);
+      long pixels = 0, off = 0;
+      int c, max_diff = 0;
+      for (c=33; c < 127; ++c) {
+         int g = stbtt_FindGlyphIndex(&info, c), x0, y0, x1, y1, i;
+         stbtt_GetGlyphBitmapBox(&info, g, scale, scale, &x0, &y0, &x1, &y1);
+         render_v2(&info, a, x1-x0, y1-y0, scale, g);
+         render_v3(&info, b, x1-x0, y1-y0, scale, g);
+         for (i=0; i < (x1-x0)*(y1-y0); ++i) {
+            int d = abs(a[i] - b[i]);
+            if (d > max_diff) max_diff = d;
+            if (d) ++off;
+         }
+         pixels += (x1-x0)*(y1-y0);
+      }
+      printf("%6g %12.2f %12.2f %7.2fx %10d %9.3f%%\n", sizes[s], t2, t3, t2 / t3,
+             max_diff, 100.0 * off / pixels);
+   }
+   return 0;
+}
@@ -0,0 +1,143 @@
+/* Edge sort microbenchmark.
+
+   Builds the edge lists the rasterizer sorts for every glyph of a font at a
+   range of pixel sizes, groups them by edge count, and times the quicksort
+   against the bucket sort on each group. The crossover is where
+   STBTT__BUCKET_SORT_MIN should sit.
+
+   usage: bench_sort font.ttf */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STB_TRUETYPE_IMPLEMENTATION
+#define STBTT_STATIC
+#include "stb_truetype.h"
+
+typedef struct
+{
+   stbtt__edge *edges;
+   int n;
+} edge_list;
+
+#define NUM_GROUPS 8
+static const int group_min[NUM_GROUPS] = { 8, 16, 32, 64, 128, 256, 512, 1024 };
+
+static edge_list lists[NUM_GROUPS][4096];
+static int num_lists[NUM_GROUPS];
+
+static double now(void)
+{
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static unsigned char *load_file(const char *filename)
+{
+   FILE *f = fopen(filename, "rb");
+   unsigned char *data;
+   long size;
+   if (!f) return NULL;
+   fseek(f, 0, SEEK_END);
+   size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   data = malloc(size);
+   if (fread(data, 1, size, f) != (size_t) size) {
+      free(data);
+      data = NULL;
+   }
+   fclose(f);
+   return data;
+}
+
+/* The edges stbtt_Rasterize builds, at flatness 0.35px. */
+static void collect_edges(const stbtt_fontinfo *info, int glyph, float scale)
+{
+   stbtt_vertex *vertices;
+   stbtt__edge *e;
+   float mtx[6];
+   int num_verts, n, group;
+
+   stbtt__scale_transform(mtx, scale, scale, 0, 0, 1);
+   num_verts = stbtt_GetGlyphShape(info, glyph, &vertices);
+   if (num_verts == 0) return;
+   e = stbtt__build_edges(vertices, num_verts, 0.35f, mtx, &n, NULL);
+   stbtt_FreeShape(info, vertices);
+   if (!e) return;
+
+   for (group = NUM_GROUPS-1; group >= 0 && n < group_min[group]; --group)
+      ;
+   if (group < 0 || num_lists[group] == 4096) {
+      free(e);
+      return;
+   }
+   lists[group][num_lists[group]].edges = e;
+   lists[group][num_lists[group]].n = n;
+   ++num_lists[group];
+}
+
+static double time_group(int group, int bucket, stbtt__edge *work)
+{
+   double start = now(), elapsed;
+   long edges = 0;
+   int rep, i;
+   for (rep=0; (elapsed = now() - start) < 0.25; ++rep) {
+      for (i=0; i < num_lists[group]; ++i) {
+         edge_list *l = &lists[group][i];
+         memcpy(work, l->edges, l->n * sizeof(*work));
+         if (!bucket || !stbtt__sort_edges_bucket(work, l->n, NULL)) {
+            stbtt__sort_edges_quicksort(work, l->n);
+            stbtt__sort_edges_ins_sort(work, l->n);
+         }
+         edges += l->n;
+      }
+   }
+   return elapsed / edges * 1e9;
+}
+
+int main(int argc, char **argv)
+{
+   static const float sizes[] = { 12, 24, 48, 96, 200, 400, 800 };
+   stbtt_fontinfo info;
+   unsigned char *data;
+   stbtt__edge *work;
+   int s, g, group, max_n = 0;
+
+   if (argc < 2) {
+      fprintf(stderr, "usage: %s font.ttf\n", argv[0]);
+      return 1;
+   }
+   data = load_file(argv[1]);
+   if (!data || !stbtt_InitFont(&info, data, stbtt_GetFontOffsetForIndex(data, 0))) {
+      fprintf(stderr, "%s: cannot load font\n", argv[1]);
+      return 1;
+   }
+
+   for (s=0; s < (int) (sizeof(sizes)/sizeof(sizes[0])); ++s) {
+      float scale = stbtt_ScaleForPixelHeight(&info, sizes[s]);
+      for (g=0; g < info.numGlyphs; ++g)
+         collect_edges(&info, g, scale);
+   }
+
+   for (group=0; group < NUM_GROUPS; ++group)
+      for (g=0; g < num_lists[group]; ++g)
+         if (lists[group][g].n > max_n)
+            max_n = lists[group][g].n;
+   work = malloc(sizeof(*work) * (max_n+1));
+
+   printf("%-12s %8s %14s %14s\n", "edges", "lists", "quick ns/edge", "bucket ns/edge");
+   for (group=0; group < NUM_GROUPS; ++group) {
+      char range[32];
+      if (num_lists[group] == 0) continue;
+      if (group+1 < NUM_GROUPS)
+         snprintf(range, sizeof(range), "%d-%d", group_min[group], group_min[group+1]-1);
+      else
+         snprintf(range, sizeof(range), "%d+", group_min[group]);
+      printf("%-12s %8d %14.2f %14.2f\n", range, num_lists[group],
+             time_group(group, 0, work), time_group(group, 1, work));
+   }
+   return 0;
+}
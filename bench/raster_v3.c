@@ -0,0 +1,12 @@
+/* The fixed-point rasterizer, built on its own so that bench_raster can run
+   it next to the default one. */
+
+#define STB_TRUETYPE_IMPLEMENTATION
+#define STBTT_STATIC
+#define STBTT_RASTERIZER_VERSION 3
+#include "stb_truetype.h"
+
+void render_v3(const stbtt_fontinfo *info, unsigned char *output, int w, int h, float scale, int glyph)
+{
+   stbtt_MakeGlyphBitmap(info, output, w, h, w, scale, scale, glyph);
+}
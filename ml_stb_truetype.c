@@ -2,12 +2,19 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
 #include <caml/mlvalues.h>
 #include <caml/fail.h>
 #include <caml/memory.h>
 #include <caml/alloc.h>
 #include <caml/bigarray.h>
 #include <caml/custom.h>
+#include <caml/threads.h>
 
 /* Define Data_abstract_val if necessary.
  * It was introduced in OCaml 4.05.0 */
@@ -15,6 +22,215 @@
 #define Data_abstract_val Op_val
 #endif
 
+/* Rasterization stubs copy their OCaml arguments to C before doing any work:
+ * font data and target buffers are bigarrays, whose storage never moves, so
+ * the runtime lock can be released while stb_truetype is running.
+ * Releasing is not free; only do it for jobs touching at least that many
+ * pixels. */
+#define ML_STBTT_RELEASE_AREA 4096
+
+static int ml_release_runtime(long area)
+{
+  if (area < ML_STBTT_RELEASE_AREA)
+    return 0;
+  caml_release_runtime_system();
+  return 1;
+}
+
+static void ml_acquire_runtime(int released)
+{
+  if (released)
+    caml_acquire_runtime_system();
+}
+
+/* Scratch memory, one context per thread (hence per domain).
+ * Stubs use it for their temporary arrays; it is also passed to stb_truetype
+ * as allocation userdata, see the arena below.  Buffers grow on demand and are
+ * kept for the next call, they are released when the thread terminates. */
+typedef struct {
+  void *data;
+  size_t size;
+
+  /* Arena serving stb_truetype allocations */
+  char *arena;
+  size_t arena_size;
+  size_t top;       /* first free byte of the arena */
+  size_t last;      /* offset of the last block, ML_ARENA_NONE if empty */
+  size_t demand;    /* bytes in use, including blocks that did not fit */
+  size_t peak;      /* high-water mark of demand */
+
+  int stripe;       /* reader counters of the shared caches, see below */
+} ml_scratch;
+
+static pthread_key_t ml_scratch_key;
+static pthread_once_t ml_scratch_once = PTHREAD_ONCE_INIT;
+static atomic_int ml_scratch_count = 0;
+
+#define ML_ARENA_NONE ((size_t)-1)
+
+static void ml_scratch_release(void *p)
+{
+  ml_scratch *s = p;
+  free(s->data);
+  free(s->arena);
+  free(s);
+}
+
+static void ml_scratch_init(void)
+{
+  pthread_key_create(&ml_scratch_key, ml_scratch_release);
+}
+
+static ml_scratch *ml_scratch_get(void)
+{
+  ml_scratch *s;
+  pthread_once(&ml_scratch_once, ml_scratch_init);
+  s = pthread_getspecific(ml_scratch_key);
+  if (s == NULL)
+  {
+    s = calloc(1, sizeof(ml_scratch));
+    if (s == NULL || pthread_setspecific(ml_scratch_key, s) != 0)
+    {
+      free(s);
+      caml_raise_out_of_memory();
+    }
+    s->last = ML_ARENA_NONE;
+    s->stripe = atomic_fetch_add(&ml_scratch_count, 1);
+  }
+  return s;
+}
+
+/* Get a buffer of at least [size] bytes, NULL if out of memory.
+ * Previous contents are lost. */
+static void *ml_scratch_try_reserve(ml_scratch *s, size_t size)
+{
+  if (size > s->size)
+  {
+    free(s->data);
+    s->size = 0;
+    s->data = malloc(size);
+    if (s->data == NULL)
+      return NULL;
+    s->size = size;
+  }
+  return s->data;
+}
+
+/* Same, raising Out_of_memory */
+static void *ml_scratch_reserve(ml_scratch *s, size_t size)
+{
+  void *data = ml_scratch_try_reserve(s, size);
+  if (data == NULL)
+    caml_raise_out_of_memory();
+  return data;
+}
+
+/* The arena is a stack of blocks.  Freeing a block marks it dead, and dead
+ * blocks are popped as soon as they reach the top of the stack.
+ * Rendering a glyph frees everything it allocated, so the arena is empty
+ * again between two glyphs whatever the order of the frees.
+ * Blocks that do not fit come from malloc; the arena is resized to the
+ * high-water mark the next time it is empty, after which rendering does not
+ * touch the system allocator anymore.  The arena stays below ML_ARENA_MAX:
+ * a single huge glyph does not pin its memory in every thread that rendered
+ * one, larger renders keep using malloc. */
+typedef struct {
+  size_t prev;      /* offset of the previous block */
+  size_t size;      /* payload size, 0 once freed */
+} ml_arena_block;
+
+#define ML_ARENA_ALIGN(x) (((x) + 15) & ~(size_t)15)
+#define ML_ARENA_HEADER ML_ARENA_ALIGN(sizeof(ml_arena_block))
+
+#define ML_ARENA_MAX ((size_t)1 << 20)
+
+static void ml_arena_resize(ml_scratch *s)
+{
+  char *arena;
+  size_t size = s->peak < ML_ARENA_MAX ? s->peak : ML_ARENA_MAX;
+  if (s->last != ML_ARENA_NONE || s->demand != 0 || size <= s->arena_size)
+    return;
+  arena = malloc(size);
+  if (arena == NULL)
+    return;
+  free(s->arena);
+  s->arena = arena;
+  s->arena_size = size;
+}
+
+static void *ml_arena_alloc(ml_scratch *s, size_t size)
+{
+  ml_arena_block *b;
+  size_t total;
+
+  if (s == NULL)
+    return malloc(size);
+
+  total = ML_ARENA_HEADER + ML_ARENA_ALIGN(size);
+  s->demand += total;
+  if (s->demand > s->peak)
+    s->peak = s->demand;
+
+  if (s->top + total <= s->arena_size)
+  {
+    b = (ml_arena_block *)(s->arena + s->top);
+    b->prev = s->last;
+    b->size = total;
+    s->last = s->top;
+    s->top += total;
+  }
+  else
+  {
+    b = malloc(total);
+    if (b == NULL)
+    {
+      s->demand -= total;
+      return NULL;
+    }
+    b->prev = ML_ARENA_NONE;
+    b->size = total;
+  }
+
+  return (char *)b + ML_ARENA_HEADER;
+}
+
+static void ml_arena_free(ml_scratch *s, void *p)
+{
+  ml_arena_block *b;
+
+  if (s == NULL)
+  {
+    free(p);
+    return;
+  }
+  if (p == NULL)
+    return;
+
+  b = (ml_arena_block *)((char *)p - ML_ARENA_HEADER);
+  s->demand -= b->size;
+
+  if ((char *)b < s->arena || (char *)b >= s->arena + s->arena_size)
+    free(b);
+  else
+  {
+    b->size = 0;
+    while (s->last != ML_ARENA_NONE)
+    {
+      b = (ml_arena_block *)(s->arena + s->last);
+      if (b->size != 0)
+        break;
+      s->top = s->last;
+      s->last = b->prev;
+    }
+  }
+
+  if (s->last == ML_ARENA_NONE)
+    ml_arena_resize(s);
+}
+
+#define STBTT_malloc(x,u) ml_arena_alloc((ml_scratch *)(u), (x))
+#define STBTT_free(x,u)   ml_arena_free((ml_scratch *)(u), (x))
+
 #define STB_RECT_PACK_IMPLEMENTATION
 #include "stb_rect_pack.h"
 #define STB_TRUETYPE_IMPLEMENTATION
@@ -49,7 +265,10 @@ value ml_stbtt_InitFont(value ba, value voffset)
   size_t wosize = 1 + (sizeof(stbtt_fontinfo) + sizeof(value) - 1) / sizeof(value);
   fontinfo = caml_alloc(wosize, Abstract_tag);
   int result = stbtt_InitFont(ml_fontinfo_data(fontinfo), data, index);
-  static intnat ids = 0;
+  /* Stubs set their own allocator userdata, see ml_scratch */
+  ml_fontinfo_data(fontinfo)->userdata = NULL;
+  /* Fonts can be opened concurrently from different domains */
+  static atomic_intptr_t ids = 0;
 
   if (result == 0)
     ret = Val_unit;
@@ -57,7 +276,7 @@ value ml_stbtt_InitFont(value ba, value voffset)
   {
     pack = caml_alloc(3, Object_tag);
     Store_field(pack, 0, fontinfo);
-    Store_field(pack, 1, Val_long(ids++));
+    Store_field(pack, 1, Val_long(atomic_fetch_add(&ids, 1)));
     Store_field(pack, 2, ba);
 
     ret = caml_alloc(1, 0);
@@ -137,6 +356,11 @@ value ml_stbtt_GetGlyphKernAdvance(value fontinfo, value glyph1, value glyph2)
   return Val_long(stbtt_GetGlyphKernAdvance(Fontinfo_val(fontinfo), Long_val(glyph1), Long_val(glyph2)));
 }
 
+value ml_stbtt_GetFontMonospaceAdvance(value fontinfo)
+{
+  return Val_long(stbtt_GetFontMonospaceAdvance(Fontinfo_val(fontinfo)));
+}
+
 static value box(int x0, int y0, int x1, int y1)
 {
   CAMLparam0();
@@ -172,13 +396,24 @@ value ml_stbtt_GetGlyphBox(value fontinfo, value glyph)
 }
 
 // Bitmap packer
-#define Pack_context_val(x) (Data_custom_val(Field((x), 0)))
+
+/* The packer state lives outside of the OCaml heap, so that fonts can be
+ * packed without the runtime lock.  Packing mutates the rect packer and the
+ * atlas, the lock makes packs into the same context run one at a time. */
+typedef struct {
+  pthread_mutex_t lock;
+  stbtt_pack_context spc;
+} ml_pack_context;
+
+#define Ml_pack_context_val(x) (*(ml_pack_context **)Data_custom_val(Field((x), 0)))
+#define Pack_context_val(x) (&Ml_pack_context_val(x)->spc)
 
 static void pack_context_finalize(value v)
 {
-  CAMLparam1(v);
-  stbtt_PackEnd(Data_custom_val(v));
-  CAMLreturn0;
+  ml_pack_context *p = *(ml_pack_context **)Data_custom_val(v);
+  stbtt_PackEnd(&p->spc);
+  pthread_mutex_destroy(&p->lock);
+  free(p);
 }
 
 static struct custom_operations pack_context_custom_ops = {
@@ -198,14 +433,24 @@ value ml_stbtt_PackBegin(value buffer, value w, value h, value s, value p)
   unsigned char *data = Caml_ba_data_val(buffer);
   int width = Long_val(w), height = Long_val(h), stride = Long_val(s),
       padding = Long_val(p);
+  ml_pack_context *ctx = malloc(sizeof(ml_pack_context));
 
-  pack_context = caml_alloc_custom(&pack_context_custom_ops, sizeof(stbtt_pack_context), 0, 1);
-  int result = stbtt_PackBegin(Data_custom_val(pack_context), data, width, height, stride, padding, NULL);
+  if (ctx == NULL)
+    caml_raise_out_of_memory();
+
+  int result = stbtt_PackBegin(&ctx->spc, data, width, height, stride, padding, NULL);
 
   if (result == 0)
+  {
+    free(ctx);
     ret = Val_unit;
+  }
   else
   {
+    pthread_mutex_init(&ctx->lock, NULL);
+    pack_context = caml_alloc_custom(&pack_context_custom_ops, sizeof(ml_pack_context *), 0, 1);
+    *(ml_pack_context **)Data_custom_val(pack_context) = ctx;
+
     pack = caml_alloc(2, 0);
     Store_field(pack, 0, pack_context);
     Store_field(pack, 1, buffer);
@@ -219,7 +464,15 @@ value ml_stbtt_PackBegin(value buffer, value w, value h, value s, value p)
 
 value ml_stbtt_PackSetOversampling(value ctx, value h, value v)
 {
-  stbtt_PackSetOversampling(Pack_context_val(ctx), Long_val(h), Long_val(v));
+  ml_pack_context *p = Ml_pack_context_val(ctx);
+  int h_oversample = Long_val(h), v_oversample = Long_val(v);
+
+  /* Wait for a pack in progress without holding the runtime */
+  caml_release_runtime_system();
+  pthread_mutex_lock(&p->lock);
+  stbtt_PackSetOversampling(&p->spc, h_oversample, v_oversample);
+  pthread_mutex_unlock(&p->lock);
+  caml_acquire_runtime_system();
   return Val_unit;
 }
 
@@ -346,11 +599,11 @@ static value packed_chars_alloc(int count, stbtt_pack_range* range)
 }
 
 static int ml_stbtt_PackFontRanges(stbtt_pack_context *spc,
-    stbtt_fontinfo *info, stbtt_pack_range *ranges, int num_ranges)
+    stbtt_fontinfo *info, stbtt_pack_range *ranges, int num_ranges,
+    stbrp_rect *rects)
 {
    int i,j,n, return_value = 1;
    //stbrp_context *context = (stbrp_context *) spc->pack_info;
-   stbrp_rect    *rects;
 
    // flag all characters as NOT packed
    for (i=0; i < num_ranges; ++i)
@@ -360,51 +613,73 @@ static int ml_stbtt_PackFontRanges(stbtt_pack_context *spc,
          ranges[i].chardata_for_range[j].x1 =
          ranges[i].chardata_for_range[j].y1 = 0;
 
-   n = 0;
-   for (i=0; i < num_ranges; ++i)
-      n += ranges[i].num_chars;
-
-   rects = (stbrp_rect *) STBTT_malloc(sizeof(*rects) * n, spc->user_allocator_context);
-   if (rects == NULL)
-      return 0;
-
    n = stbtt_PackFontRangesGatherRects(spc, info, ranges, num_ranges, rects);
 
    stbtt_PackFontRangesPackRects(spc, rects, n);
 
    return_value = stbtt_PackFontRangesRenderIntoRects(spc, info, ranges, num_ranges, rects);
 
-   STBTT_free(rects, spc->user_allocator_context);
    return return_value;
 }
 
 value ml_stbtt_pack_font_ranges(value pack_context, value font_info, value font_ranges)
 {
   CAMLparam3(pack_context, font_info, font_ranges);
-  CAMLlocal3(font_range, packed_ranges, ret);
+  CAMLlocal4(font_range, packed_chars, packed_ranges, ret);
 
-  int num_ranges = Wosize_val(font_ranges), i;
+  int num_ranges = Wosize_val(font_ranges), num_chars = 0, i;
   stbtt_pack_range *ranges = alloca(sizeof (stbtt_pack_range) * num_ranges);
+  ml_pack_context *ctx = Ml_pack_context_val(pack_context);
+  stbtt_fontinfo info = *Fontinfo_val(font_info);
+  ml_scratch *scratch = ml_scratch_get();
+  stbtt_packedchar *chars;
+  stbrp_rect *rects;
 
-  packed_ranges = caml_alloc(num_ranges, 0);
   for (i = 0; i < num_ranges; ++i)
   {
     font_range = Field(font_ranges, i);
     // Validate font_range input?
     ranges[i].font_size = font_range_font_size(font_range);
     ranges[i].first_unicode_codepoint_in_range = Long_val(Field(font_range, 1));
+    ranges[i].array_of_unicode_codepoints = NULL;
     ranges[i].num_chars = Long_val(Field(font_range, 2));
-    ranges[i].chardata_for_range = NULL;
+    num_chars += ranges[i].num_chars;
+  }
+
+  /* Packed characters are rendered to scratch memory, then copied to OCaml
+   * strings once the runtime is held again. */
+  chars = ml_scratch_reserve(scratch,
+      (sizeof(stbtt_packedchar) + sizeof(stbrp_rect)) * num_chars);
+  rects = (stbrp_rect *)(chars + num_chars);
+  info.userdata = scratch;
 
-    Store_field(packed_ranges, i, packed_chars_alloc(ranges[i].num_chars, &ranges[i]));
+  for (i = 0, num_chars = 0; i < num_ranges; ++i)
+  {
+    ranges[i].chardata_for_range = chars + num_chars;
+    num_chars += ranges[i].num_chars;
   }
 
-  int result = ml_stbtt_PackFontRanges(Pack_context_val(pack_context), Fontinfo_val(font_info), ranges, num_ranges);
+  /* The lock is taken without the runtime, so that a thread waiting for it
+   * does not hold up the one packing */
+  caml_release_runtime_system();
+  pthread_mutex_lock(&ctx->lock);
+  int result = ml_stbtt_PackFontRanges(&ctx->spc, &info, ranges, num_ranges, rects);
+  pthread_mutex_unlock(&ctx->lock);
+  caml_acquire_runtime_system();
 
   if (result == 0)
     ret = Val_unit;
   else
   {
+    packed_ranges = caml_alloc(num_ranges, 0);
+    for (i = 0; i < num_ranges; ++i)
+    {
+      packed_chars = packed_chars_alloc(ranges[i].num_chars, NULL);
+      memcpy(Packed_chars_val(packed_chars)->chars, ranges[i].chardata_for_range,
+             sizeof(stbtt_packedchar) * ranges[i].num_chars);
+      Store_field(packed_ranges, i, packed_chars);
+    }
+
     ret = caml_alloc(1, 0);
     Store_field(ret, 0, packed_ranges);
   }
@@ -540,19 +815,127 @@ value ml_stbtt_packed_chars_of_string(value str)
   CAMLreturn(ret);
 }
 
-value ml_stbtt_MakeGlyphBitmap(value fontinfo, value buffer, value offset, value gw, value gh, value stride, value scale_x, value scale_y, value glyph)
+/* Row-parallel rendering of huge glyphs.
+ * The edges are built and sorted once, then the bitmap is cut in bands of
+ * ML_STBTT_BAND_ROWS rows that worker threads take in turn, each one starting
+ * its active edge table from the shared edges, which are only read.
+ * Workers do not touch the OCaml runtime, and allocate with malloc as they
+ * have no scratch context. */
+#define ML_STBTT_BAND_ROWS 64
+#define ML_STBTT_BAND_AREA (512 * 512)
+#define ML_STBTT_MAX_THREADS 64
+
+static atomic_int ml_render_threads = 1;
+
+value ml_stbtt_set_render_threads(value n)
 {
-  stbtt_MakeGlyphBitmap(
-        Fontinfo_val(fontinfo),
-        Caml_ba_data_val(buffer) + Long_val(offset),
-        Long_val(gw), Long_val(gh),
-        Long_val(stride),
-        Double_val(scale_x), Double_val(scale_y),
-        Long_val(glyph)
-      );
+  int threads = Long_val(n);
+  if (threads < 1) threads = 1;
+  if (threads > ML_STBTT_MAX_THREADS) threads = ML_STBTT_MAX_THREADS;
+  atomic_store(&ml_render_threads, threads);
   return Val_unit;
 }
 
+#if STBTT_RASTERIZER_VERSION == 2 && !defined(STBTT_RASTERIZE_CURVES)
+typedef struct {
+  stbtt__bitmap bitmap;
+  stbtt__edge *edges;
+  int num_edges, off_x, off_y;
+  atomic_int next;  /* next band to render */
+} ml_bands;
+
+static void *ml_bands_run(void *p)
+{
+  ml_bands *b = p;
+  int row0;
+  while ((row0 = atomic_fetch_add(&b->next, 1) * ML_STBTT_BAND_ROWS) < b->bitmap.h)
+  {
+    int row1 = row0 + ML_STBTT_BAND_ROWS;
+    if (row1 > b->bitmap.h) row1 = b->bitmap.h;
+    stbtt__rasterize_sorted_edges_band(&b->bitmap, b->edges, b->num_edges,
+                                       b->off_x, b->off_y, row0, row1, NULL, NULL);
+  }
+  return NULL;
+}
+#endif
+
+/* Same as stbtt_MakeGlyphBitmapSubpixel, rendering large bitmaps in bands on
+ * up to [ml_render_threads] threads, the calling one included. */
+static void ml_make_glyph_bitmap(stbtt_fontinfo *info, unsigned char *output, int w, int h, int stride,
+                                 float sx, float sy, float dx, float dy, int glyph)
+{
+#if STBTT_RASTERIZER_VERSION == 2 && !defined(STBTT_RASTERIZE_CURVES)
+  int threads = atomic_load(&ml_render_threads);
+  int bands = (h + ML_STBTT_BAND_ROWS - 1) / ML_STBTT_BAND_ROWS;
+  if (threads > bands) threads = bands;
+
+  if (threads > 1 && (long)w * h >= ML_STBTT_BAND_AREA)
+  {
+    pthread_t workers[ML_STBTT_MAX_THREADS];
+    stbtt_vertex *vertices;
+    int num_verts = stbtt_GetGlyphShape(info, glyph, &vertices);
+    float mtx[6];
+    ml_bands b;
+    int i;
+
+    /* Rectilinear shapes get the exact fill of stbtt_Rasterize, which the
+     * bands do not do */
+    if (stbtt__shape_is_rectilinear(vertices, num_verts))
+    {
+      STBTT_free(vertices, info->userdata);
+      stbtt_MakeGlyphBitmapSubpixel(info, output, w, h, stride, sx, sy, dx, dy, glyph);
+      return;
+    }
+
+    stbtt_GetGlyphBitmapBoxSubpixel(info, glyph, sx, sy, dx, dy, &b.off_x, &b.off_y, 0, 0);
+    stbtt__scale_transform(mtx, sx, sy, dx, dy, 1);
+    b.edges = stbtt__build_edges(vertices, num_verts, 0.35f, mtx,
+                                 &b.num_edges, info->userdata);
+    STBTT_free(vertices, info->userdata);
+    if (b.edges == NULL)
+      return;
+    stbtt__sort_edges(b.edges, b.num_edges, info->userdata);
+    b.edges[b.num_edges].y0 = (float)(b.off_y + h) + 1;
+    b.bitmap.w = w;
+    b.bitmap.h = h;
+    b.bitmap.stride = stride;
+    b.bitmap.pixels = output;
+    atomic_init(&b.next, 0);
+
+    for (i = 1; i < threads; ++i)
+      if (pthread_create(&workers[i], NULL, ml_bands_run, &b) != 0)
+        break;
+    ml_bands_run(&b);
+    while (--i > 0)
+      pthread_join(workers[i], NULL);
+
+    STBTT_free(b.edges, info->userdata);
+    return;
+  }
+#endif
+  stbtt_MakeGlyphBitmapSubpixel(info, output, w, h, stride, sx, sy, dx, dy, glyph);
+}
+
+value ml_stbtt_MakeGlyphBitmap(value fontinfo, value buffer, value offset, value gw, value gh, value stride, value scale_x, value scale_y, value glyph)
+{
+  CAMLparam5(fontinfo, buffer, offset, gw, gh);
+  CAMLxparam4(stride, scale_x, scale_y, glyph);
+
+  stbtt_fontinfo info = *Fontinfo_val(fontinfo);
+  info.userdata = ml_scratch_get();
+  unsigned char *output = (unsigned char *)Caml_ba_data_val(buffer) + Long_val(offset);
+  int w = Long_val(gw), h = Long_val(gh);
+
+  int s = Long_val(stride), g = Long_val(glyph);
+  float sx = Double_val(scale_x), sy = Double_val(scale_y);
+
+  int released = ml_release_runtime((long)w * h);
+  ml_make_glyph_bitmap(&info, output, w, h, s, sx, sy, 0.0f, 0.0f, g);
+  ml_acquire_runtime(released);
+
+  CAMLreturn(Val_unit);
+}
+
 value ml_stbtt_MakeGlyphBitmap_bc(value *argv, int argn)
 {
   if (argn != 9) abort();
@@ -561,16 +944,24 @@ value ml_stbtt_MakeGlyphBitmap_bc(value *argv, int argn)
 
 value ml_stbtt_MakeGlyphBitmapSubpixel(value fontinfo, value buffer, value offset, value gw, value gh, value stride, value scale_x, value scale_y, value shift_x, value shift_y, value glyph)
 {
-  stbtt_MakeGlyphBitmapSubpixel(
-        Fontinfo_val(fontinfo),
-        Caml_ba_data_val(buffer) + Long_val(offset),
-        Long_val(gw), Long_val(gh),
-        Long_val(stride),
-        Double_val(scale_x), Double_val(scale_y),
-        Double_val(shift_x), Double_val(shift_y),
-        Long_val(glyph)
-      );
-  return Val_unit;
+  CAMLparam5(fontinfo, buffer, offset, gw, gh);
+  CAMLxparam5(stride, scale_x, scale_y, shift_x, shift_y);
+  CAMLxparam1(glyph);
+
+  stbtt_fontinfo info = *Fontinfo_val(fontinfo);
+  info.userdata = ml_scratch_get();
+  unsigned char *output = (unsigned char *)Caml_ba_data_val(buffer) + Long_val(offset);
+  int w = Long_val(gw), h = Long_val(gh);
+
+  int s = Long_val(stride), g = Long_val(glyph);
+  float sx = Double_val(scale_x), sy = Double_val(scale_y);
+  float dx = Double_val(shift_x), dy = Double_val(shift_y);
+
+  int released = ml_release_runtime((long)w * h);
+  ml_make_glyph_bitmap(&info, output, w, h, s, sx, sy, dx, dy, g);
+  ml_acquire_runtime(released);
+
+  CAMLreturn(Val_unit);
 }
 
 value ml_stbtt_MakeGlyphBitmapSubpixel_bc(value *argv, int argn)
@@ -579,6 +970,35 @@ value ml_stbtt_MakeGlyphBitmapSubpixel_bc(value *argv, int argn)
   return ml_stbtt_MakeGlyphBitmapSubpixel(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7], argv[8], argv[9], argv[10]);
 }
 
+value ml_stbtt_MakeGlyphBitmapTile(value fontinfo, value buffer, value offset, value gw, value gh, value stride, value scale_x, value scale_y, value shift_x, value shift_y, value tile_x, value tile_y, value glyph)
+{
+  CAMLparam5(fontinfo, buffer, offset, gw, gh);
+  CAMLxparam5(stride, scale_x, scale_y, shift_x, shift_y);
+  CAMLxparam3(tile_x, tile_y, glyph);
+
+  stbtt_fontinfo info = *Fontinfo_val(fontinfo);
+  info.userdata = ml_scratch_get();
+  unsigned char *output = (unsigned char *)Caml_ba_data_val(buffer) + Long_val(offset);
+  int w = Long_val(gw), h = Long_val(gh);
+
+  int tx = Long_val(tile_x), ty = Long_val(tile_y);
+  int s = Long_val(stride), g = Long_val(glyph);
+  float sx = Double_val(scale_x), sy = Double_val(scale_y);
+  float dx = Double_val(shift_x), dy = Double_val(shift_y);
+
+  int released = ml_release_runtime((long)w * h);
+  stbtt_MakeGlyphBitmapTile(&info, output, tx, ty, w, h, s, sx, sy, dx, dy, g);
+  ml_acquire_runtime(released);
+
+  CAMLreturn(Val_unit);
+}
+
+value ml_stbtt_MakeGlyphBitmapTile_bc(value *argv, int argn)
+{
+  if (argn != 13) abort();
+  return ml_stbtt_MakeGlyphBitmapTile(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7], argv[8], argv[9], argv[10], argv[11], argv[12]);
+}
+
 value ml_stbtt_GetGlyphBitmapBox(value fontinfo, value glyph, value scale_x, value scale_y)
 {
   int x0, y0, x1, y1;
@@ -600,6 +1020,116 @@ value ml_stbtt_GetGlyphBitmapBoxSubpixel_bc(value *argv, int argn)
   return ml_stbtt_GetGlyphBitmapBoxSubpixel(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
 }
 
+static void ml_transform(value v, float m[6])
+{
+  int i;
+  for (i = 0; i < 6; ++i)
+    m[i] = Double_field(v, i);
+}
+
+value ml_stbtt_GetGlyphBitmapBoxTransform(value fontinfo, value glyph, value transform)
+{
+  int x0, y0, x1, y1;
+  float m[6];
+  ml_transform(transform, m);
+  stbtt_GetGlyphBitmapBoxTransform(Fontinfo_val(fontinfo), Long_val(glyph), m, &x0, &y0, &x1, &y1);
+  return box(x0, y0, x1, y1);
+}
+
+value ml_stbtt_MakeGlyphBitmapTransform(value fontinfo, value buffer, value offset, value gw, value gh, value stride, value transform, value glyph)
+{
+  CAMLparam5(fontinfo, buffer, offset, gw, gh);
+  CAMLxparam3(stride, transform, glyph);
+
+  stbtt_fontinfo info = *Fontinfo_val(fontinfo);
+  info.userdata = ml_scratch_get();
+  unsigned char *output = (unsigned char *)Caml_ba_data_val(buffer) + Long_val(offset);
+  int w = Long_val(gw), h = Long_val(gh);
+  float m[6];
+  ml_transform(transform, m);
+
+  int released = ml_release_runtime((long)w * h);
+  stbtt_MakeGlyphBitmapTransform(&info, output, w, h, Long_val(stride), m, Long_val(glyph));
+  ml_acquire_runtime(released);
+
+  CAMLreturn(Val_unit);
+}
+
+value ml_stbtt_MakeGlyphBitmapTransform_bc(value *argv, int argn)
+{
+  if (argn != 8) abort();
+  return ml_stbtt_MakeGlyphBitmapTransform(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7]);
+}
+
+static stbtt_run_glyph *ml_run_glyphs(ml_scratch *s, value run)
+{
+  int i, n = Wosize_val(run);
+  stbtt_run_glyph *glyphs = ml_scratch_reserve(s, sizeof(stbtt_run_glyph) * n);
+  for (i = 0; i < n; ++i)
+  {
+    value g = Field(run, i);
+    glyphs[i].glyph = Long_val(Field(g, 0));
+    glyphs[i].x = Double_val(Field(g, 1));
+    glyphs[i].y = Double_val(Field(g, 2));
+  }
+  return glyphs;
+}
+
+value ml_stbtt_GetRunBitmapBox(value fontinfo, value run, value scale_x, value scale_y)
+{
+  int x0, y0, x1, y1;
+  stbtt_run_glyph *glyphs = ml_run_glyphs(ml_scratch_get(), run);
+  stbtt_GetRunBitmapBox(Fontinfo_val(fontinfo), glyphs, Wosize_val(run), Double_val(scale_x), Double_val(scale_y), &x0, &y0, &x1, &y1);
+  return box(x0, y0, x1, y1);
+}
+
+value ml_stbtt_MakeRunBitmap(value fontinfo, value buffer, value offset, value gw, value gh, value stride, value scale_x, value scale_y, value run)
+{
+  CAMLparam5(fontinfo, buffer, offset, gw, gh);
+  CAMLxparam4(stride, scale_x, scale_y, run);
+
+  stbtt_fontinfo info = *Fontinfo_val(fontinfo);
+  ml_scratch *scratch = ml_scratch_get();
+  stbtt_run_glyph *glyphs = ml_run_glyphs(scratch, run);
+  int num_glyphs = Wosize_val(run);
+  info.userdata = scratch;
+  unsigned char *output = (unsigned char *)Caml_ba_data_val(buffer) + Long_val(offset);
+  int w = Long_val(gw), h = Long_val(gh);
+
+  int s = Long_val(stride);
+  float sx = Double_val(scale_x), sy = Double_val(scale_y);
+
+  int released = ml_release_runtime((long)w * h);
+  stbtt_MakeRunBitmap(&info, output, w, h, s, sx, sy, glyphs, num_glyphs);
+  ml_acquire_runtime(released);
+
+  CAMLreturn(Val_unit);
+}
+
+value ml_stbtt_MakeRunBitmap_bc(value *argv, int argn)
+{
+  if (argn != 9) abort();
+  return ml_stbtt_MakeRunBitmap(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7], argv[8]);
+}
+
+value ml_stbtt_MakeBoxDrawingBitmap(value buffer, value offset, value gw, value gh, value stride, value codepoint)
+{
+  CAMLparam5(buffer, offset, gw, gh, stride);
+  CAMLxparam1(codepoint);
+
+  unsigned char *output = (unsigned char *)Caml_ba_data_val(buffer) + Long_val(offset);
+  int drawn = stbtt_MakeBoxDrawingBitmap(output, Long_val(gw), Long_val(gh),
+                                         Long_val(stride), Long_val(codepoint));
+
+  CAMLreturn(Val_bool(drawn));
+}
+
+value ml_stbtt_MakeBoxDrawingBitmap_bc(value *argv, int argn)
+{
+  if (argn != 6) abort();
+  return ml_stbtt_MakeBoxDrawingBitmap(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
 // Based on Exponential blur, Jani Huhtanen, 2006
 // and [https://github.com/memononen/fontstash](fontstash), Mikko Mononen, 2014
 
@@ -663,14 +1193,20 @@ static void expblur(unsigned char* dst, int w, int h, int stride, float blur)
 
 value ml_stbtt_BlurGlyphBitmap(value buffer, value offset, value gw, value gh, value stride, value blur)
 {
-  expblur(
-        Caml_ba_data_val(buffer) + Long_val(offset),
-        Long_val(gw),
-        Long_val(gh),
-        Long_val(stride),
-        Double_val(blur)
-      );
-  return Val_unit;
+  CAMLparam5(buffer, offset, gw, gh, stride);
+  CAMLxparam1(blur);
+
+  unsigned char *output = (unsigned char *)Caml_ba_data_val(buffer) + Long_val(offset);
+  int w = Long_val(gw), h = Long_val(gh);
+
+  int s = Long_val(stride);
+  float radius = Double_val(blur);
+
+  int released = ml_release_runtime((long)w * h);
+  expblur(output, w, h, s, radius);
+  ml_acquire_runtime(released);
+
+  CAMLreturn(Val_unit);
 }
 
 value ml_stbtt_BlurGlyphBitmap_bc(value *argv, int argn)
@@ -679,54 +1215,2047 @@ value ml_stbtt_BlurGlyphBitmap_bc(value *argv, int argn)
   return ml_stbtt_BlurGlyphBitmap(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
 }
 
-value ml_stbtt_GetGlyphBitmap(value fontinfo, value glyph, value scale_x, value scale_y)
+/* Compositing coverage masks onto 32-bit framebuffers.
+ *
+ * A mask of 8-bit coverage is blended over the target with a solid color
+ * (straight alpha).  The source alpha of a pixel is coverage * color alpha.
+ * Targets are RGBA or BGRA, with straight or premultiplied alpha; alpha is
+ * always the last byte, so BGRA only swaps the color.
+ * Premultiplied targets blend in 16-bit integers, straight ones in floats,
+ * since the result has to be divided by the new alpha.
+ * With a gamma table, colors are blended in linear light (12 bits) instead;
+ * that path is table-bound and stays scalar. */
+
+enum { ML_RGBA, ML_BGRA, ML_RGBA_PREMULTIPLIED, ML_BGRA_PREMULTIPLIED };
+
+#define ML_GAMMA_BITS 12
+#define ML_GAMMA_SIZE (1 << ML_GAMMA_BITS)
+
+typedef struct {
+  unsigned short to_linear[256];
+  unsigned char from_linear[ML_GAMMA_SIZE];
+} ml_gamma;
+
+/* round(x / 255) for x in [0, 255*255] */
+#define ML_DIV255(x) ((((x) + 128) * 257) >> 16)
+
+typedef void ml_composite_func(unsigned char *dst, const unsigned char *cov,
+                               int w, const int color[4]);
+
+static void ml_composite_premul_scalar(unsigned char *dst, const unsigned char *cov,
+                                       int w, const int color[4])
 {
-  CAMLparam4(fontinfo, scale_x, scale_y, glyph);
-  CAMLlocal2(ret, ba);
-  int w, h, xoff, yoff;
-  unsigned char* bitmap =
-    stbtt_GetGlyphBitmap(Fontinfo_val(fontinfo),
-                         Double_val(scale_x),
-                         Double_val(scale_y),
-                         Long_val(glyph),
-                         &w, &h, &xoff, &yoff);
-  long dims[1] = { w * h };
-  ba = caml_ba_alloc(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, bitmap, dims);
-  ret = caml_alloc(5, 0);
-  Store_field(ret, 0, ba);
-  Store_field(ret, 1, Val_int(w));
-  Store_field(ret, 2, Val_int(h));
-  Store_field(ret, 3, Val_int(xoff));
-  Store_field(ret, 4, Val_int(yoff));
-  CAMLreturn(ret);
+  int x, k;
+  for (x = 0; x < w; ++x, dst += 4)
+  {
+    int sa = ML_DIV255(cov[x] * color[3]);
+    if (sa == 0) continue;
+    for (k = 0; k < 4; ++k)
+      dst[k] = ML_DIV255((k == 3 ? 255 : color[k]) * sa + dst[k] * (255 - sa));
+  }
 }
 
-value ml_stbtt_GetGlyphBitmapSubpixel(value fontinfo, value glyph, value scale_x, value scale_y, value shift_x, value shift_y)
+static void ml_composite_straight_scalar(unsigned char *dst, const unsigned char *cov,
+                                         int w, const int color[4])
 {
-  CAMLparam5(fontinfo, scale_x, scale_y, shift_x, shift_y);
-  CAMLlocal2(ret, ba);
-  int w, h, xoff, yoff;
-  unsigned char* bitmap =
-    stbtt_GetGlyphBitmapSubpixel(Fontinfo_val(fontinfo),
-                                 Double_val(scale_x),
-                                 Double_val(scale_y),
-                                 Double_val(shift_x),
-                                 Double_val(shift_y),
-                                 Long_val(glyph),
-                                 &w, &h, &xoff, &yoff);
-  long dims[1] = { w * h };
-  ba = caml_ba_alloc(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, bitmap, dims);
-  ret = caml_alloc(5, 0);
-  Store_field(ret, 0, ba);
-  Store_field(ret, 1, Val_int(w));
-  Store_field(ret, 2, Val_int(h));
-  Store_field(ret, 3, Val_int(xoff));
-  Store_field(ret, 4, Val_int(yoff));
-  CAMLreturn(ret);
+  int x, k;
+  for (x = 0; x < w; ++x, dst += 4)
+  {
+    int sa = ML_DIV255(cov[x] * color[3]);
+    float s, t, oa;
+    if (sa == 0) continue;
+    s = sa * (1.0f / 255.0f);
+    t = dst[3] * (1.0f / 255.0f) * (1.0f - s);
+    oa = s + t;
+    for (k = 0; k < 3; ++k)
+      dst[k] = (int)((color[k] * s + dst[k] * t) / oa + 0.5f);
+    dst[3] = (int)(oa * 255.0f + 0.5f);
+  }
 }
 
-value ml_stbtt_GetGlyphBitmapSubpixel_bc(value *argv, int argn)
+static void ml_composite_gamma(unsigned char *dst, const unsigned char *cov, int w,
+                               const int color[4], const ml_gamma *g, int premultiplied)
 {
-  if (argn != 6) abort();
-  return ml_stbtt_GetGlyphBitmapSubpixel(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+  int x, k, l, lin[3];
+  for (k = 0; k < 3; ++k)
+    lin[k] = g->to_linear[color[k]];
+  for (x = 0; x < w; ++x, dst += 4)
+  {
+    int sa = ML_DIV255(cov[x] * color[3]);
+    float s, t, oa;
+    if (sa == 0) continue;
+    s = sa * (1.0f / 255.0f);
+    t = premultiplied ? 1.0f - s : dst[3] * (1.0f / 255.0f) * (1.0f - s);
+    oa = premultiplied ? 1.0f : s + t;
+    for (k = 0; k < 3; ++k)
+    {
+      l = (int)((lin[k] * s + g->to_linear[dst[k]] * t) / oa + 0.5f);
+      dst[k] = g->from_linear[l < ML_GAMMA_SIZE ? l : ML_GAMMA_SIZE - 1];
+    }
+    dst[3] = ML_DIV255(255 * sa + dst[3] * (255 - sa));
+  }
+}
+
+#ifdef STBTT__SSE2
+/* Four pixels at a time.  Coverage is spread to the four bytes of its pixel,
+ * then widened to 16 bits, two pixels per register. */
+static void ml_composite_premul_sse2(unsigned char *dst, const unsigned char *cov,
+                                     int w, const int color[4])
+{
+  const __m128i zero = _mm_setzero_si128(), c128 = _mm_set1_epi16(128),
+                c255 = _mm_set1_epi16(255), c257 = _mm_set1_epi16(257),
+                alpha = _mm_set1_epi16(color[3]),
+                col = _mm_setr_epi16(color[0], color[1], color[2], 255,
+                                     color[0], color[1], color[2], 255);
+  int x = 0, k;
+  for (; x + 4 <= w; x += 4)
+  {
+    int c;
+    __m128i m, d, r[2];
+    memcpy(&c, cov + x, 4);
+    if (c == 0) continue;
+    m = _mm_cvtsi32_si128(c);
+    m = _mm_unpacklo_epi8(m, m);
+    m = _mm_unpacklo_epi16(m, m);
+    d = _mm_loadu_si128((__m128i *)(dst + 4*x));
+    for (k = 0; k < 2; ++k)
+    {
+      __m128i sa = k ? _mm_unpackhi_epi8(m, zero) : _mm_unpacklo_epi8(m, zero);
+      __m128i dk = k ? _mm_unpackhi_epi8(d, zero) : _mm_unpacklo_epi8(d, zero);
+      sa = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(sa, alpha), c128), c257);
+      r[k] = _mm_add_epi16(_mm_mullo_epi16(col, sa),
+                           _mm_mullo_epi16(dk, _mm_sub_epi16(c255, sa)));
+      r[k] = _mm_mulhi_epu16(_mm_add_epi16(r[k], c128), c257);
+    }
+    _mm_storeu_si128((__m128i *)(dst + 4*x), _mm_packus_epi16(r[0], r[1]));
+  }
+  ml_composite_premul_scalar(dst + 4*x, cov + x, w - x, color);
+}
+
+/* Four pixels at a time, transposed to one register per component. */
+static void ml_composite_straight_sse2(unsigned char *dst, const unsigned char *cov,
+                                       int w, const int color[4])
+{
+  const __m128 inv255 = _mm_set1_ps(1.0f / 255.0f), one = _mm_set1_ps(1.0f),
+               c255 = _mm_set1_ps(255.0f), half = _mm_set1_ps(0.5f),
+               red = _mm_set1_ps(color[0]), green = _mm_set1_ps(color[1]),
+               blue = _mm_set1_ps(color[2]);
+  const __m128i zero = _mm_setzero_si128(), c128 = _mm_set1_epi16(128),
+                c257 = _mm_set1_epi16(257), alpha = _mm_set1_epi16(color[3]);
+  int x = 0;
+  for (; x + 4 <= w; x += 4)
+  {
+    int c;
+    __m128i d, lo, hi, sa, keep;
+    __m128 p0, p1, p2, p3, s, t, oa;
+    memcpy(&c, cov + x, 4);
+    if (c == 0) continue;
+    sa = _mm_unpacklo_epi8(_mm_cvtsi32_si128(c), zero);
+    sa = _mm_mulhi_epu16(_mm_add_epi16(_mm_mullo_epi16(sa, alpha), c128), c257);
+    sa = _mm_unpacklo_epi16(sa, zero);
+    keep = _mm_cmpeq_epi32(sa, zero);
+    d = _mm_loadu_si128((__m128i *)(dst + 4*x));
+    lo = _mm_unpacklo_epi8(d, zero);
+    hi = _mm_unpackhi_epi8(d, zero);
+    p0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+    p1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+    p2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+    p3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+    _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+    s = _mm_mul_ps(_mm_cvtepi32_ps(sa), inv255);
+    t = _mm_mul_ps(_mm_mul_ps(p3, inv255), _mm_sub_ps(one, s));
+    oa = _mm_add_ps(s, t);
+    p0 = _mm_div_ps(_mm_add_ps(_mm_mul_ps(red, s), _mm_mul_ps(p0, t)), oa);
+    p1 = _mm_div_ps(_mm_add_ps(_mm_mul_ps(green, s), _mm_mul_ps(p1, t)), oa);
+    p2 = _mm_div_ps(_mm_add_ps(_mm_mul_ps(blue, s), _mm_mul_ps(p2, t)), oa);
+    p3 = _mm_mul_ps(oa, c255);
+    _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+    lo = _mm_packs_epi32(_mm_cvttps_epi32(_mm_add_ps(p0, half)), _mm_cvttps_epi32(_mm_add_ps(p1, half)));
+    hi = _mm_packs_epi32(_mm_cvttps_epi32(_mm_add_ps(p2, half)), _mm_cvttps_epi32(_mm_add_ps(p3, half)));
+    /* pixels without coverage keep their value */
+    d = _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, _mm_packus_epi16(lo, hi)));
+    _mm_storeu_si128((__m128i *)(dst + 4*x), d);
+  }
+  ml_composite_straight_scalar(dst + 4*x, cov + x, w - x, color);
+}
+#endif
+
+#ifdef STBTT__AVX2
+/* Same as the SSE2 kernel, eight pixels at a time. */
+__attribute__((target("avx2")))
+static void ml_composite_premul_avx2(unsigned char *dst, const unsigned char *cov,
+                                     int w, const int color[4])
+{
+  const __m256i zero = _mm256_setzero_si256(), c128 = _mm256_set1_epi16(128),
+                c255 = _mm256_set1_epi16(255), c257 = _mm256_set1_epi16(257),
+                alpha = _mm256_set1_epi16(color[3]),
+                col = _mm256_setr_epi16(color[0], color[1], color[2], 255,
+                                        color[0], color[1], color[2], 255,
+                                        color[0], color[1], color[2], 255,
+                                        color[0], color[1], color[2], 255),
+                spread = _mm256_setr_epi8(0,0,0,0, 1,1,1,1, 2,2,2,2, 3,3,3,3,
+                                          4,4,4,4, 5,5,5,5, 6,6,6,6, 7,7,7,7);
+  int x = 0, k;
+  for (; x + 8 <= w; x += 8)
+  {
+    long long c;
+    __m256i m, d, r[2];
+    memcpy(&c, cov + x, 8);
+    if (c == 0) continue;
+    /* pixels 0-3 in the low lane, 4-7 in the high one */
+    m = _mm256_set1_epi64x(c);
+    m = _mm256_shuffle_epi8(m, spread);
+    d = _mm256_loadu_si256((__m256i *)(dst + 4*x));
+    for (k = 0; k < 2; ++k)
+    {
+      __m256i sa = k ? _mm256_unpackhi_epi8(m, zero) : _mm256_unpacklo_epi8(m, zero);
+      __m256i dk = k ? _mm256_unpackhi_epi8(d, zero) : _mm256_unpacklo_epi8(d, zero);
+      sa = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(sa, alpha), c128), c257);
+      r[k] = _mm256_add_epi16(_mm256_mullo_epi16(col, sa),
+                              _mm256_mullo_epi16(dk, _mm256_sub_epi16(c255, sa)));
+      r[k] = _mm256_mulhi_epu16(_mm256_add_epi16(r[k], c128), c257);
+    }
+    _mm256_storeu_si256((__m256i *)(dst + 4*x), _mm256_packus_epi16(r[0], r[1]));
+  }
+  ml_composite_premul_scalar(dst + 4*x, cov + x, w - x, color);
+}
+#endif
+
+static ml_composite_func *ml_select_composite(int premultiplied)
+{
+#if defined(STBTT__AVX2)
+  if (premultiplied && __builtin_cpu_supports("avx2"))
+    return ml_composite_premul_avx2;
+#endif
+#if defined(STBTT__SSE2)
+  return premultiplied ? ml_composite_premul_sse2 : ml_composite_straight_sse2;
+#else
+  return premultiplied ? ml_composite_premul_scalar : ml_composite_straight_scalar;
+#endif
+}
+
+static void ml_composite(unsigned char *dst, int dst_stride,
+                         const unsigned char *cov, int cov_stride, int w, int h,
+                         int format, const int rgba[4], const ml_gamma *g)
+{
+  int premultiplied = format == ML_RGBA_PREMULTIPLIED || format == ML_BGRA_PREMULTIPLIED;
+  int bgra = format == ML_BGRA || format == ML_BGRA_PREMULTIPLIED;
+  int color[4] = { rgba[bgra ? 2 : 0], rgba[1], rgba[bgra ? 0 : 2], rgba[3] };
+  ml_composite_func *f = ml_select_composite(premultiplied);
+  int y;
+
+  for (y = 0; y < h; ++y, dst += dst_stride, cov += cov_stride)
+  {
+    if (g)
+      ml_composite_gamma(dst, cov, w, color, g, premultiplied);
+    else
+      f(dst, cov, w, color);
+  }
+}
+
+/* Spans are (y, x0, x1, coverage) quadruples relative to (x, y) of the
+ * target.  Opaque interiors are plain fills; the other spans are blended
+ * from a mask of their constant coverage. */
+static void ml_composite_spans(unsigned char *dst, int dst_stride, int tw, int th,
+                               const int *spans, int n, int x, int y,
+                               int format, const int rgba[4], const ml_gamma *g)
+{
+  int premultiplied = format == ML_RGBA_PREMULTIPLIED || format == ML_BGRA_PREMULTIPLIED;
+  int bgra = format == ML_BGRA || format == ML_BGRA_PREMULTIPLIED;
+  int color[4] = { rgba[bgra ? 2 : 0], rgba[1], rgba[bgra ? 0 : 2], rgba[3] };
+  unsigned char solid[4] = { color[0], color[1], color[2], 255 };
+  ml_composite_func *f = ml_select_composite(premultiplied);
+  unsigned char cov[256];
+  int i, filled = 0, last = -1;
+
+  for (i = 0; i < n; ++i, spans += 4)
+  {
+    int sy = y + spans[0], x0 = x + spans[1], x1 = x + spans[2], c = spans[3];
+    unsigned char *row = dst + (long)sy * dst_stride;
+    if (sy < 0 || sy >= th) continue;
+    if (x0 < 0) x0 = 0;
+    if (x1 > tw) x1 = tw;
+    if (c == 255 && color[3] == 255)
+    {
+      for (; x0 < x1; ++x0)
+        memcpy(row + 4*x0, solid, 4);
+      continue;
+    }
+    while (x0 < x1)
+    {
+      int len = x1 - x0 > (int)sizeof(cov) ? (int)sizeof(cov) : x1 - x0;
+      if (c != last || len > filled)
+      {
+        memset(cov, c, len);
+        last = c;
+        filled = len;
+      }
+      if (g)
+        ml_composite_gamma(row + 4*x0, cov, len, color, g, premultiplied);
+      else if (len < 4)
+        /* most antialiased runs are a pixel or two */
+        (premultiplied ? ml_composite_premul_scalar : ml_composite_straight_scalar)(row + 4*x0, cov, len, color);
+      else
+        f(row + 4*x0, cov, len, color);
+      x0 += len;
+    }
+  }
+}
+
+#define Gamma_val(v) ((ml_gamma *)Data_custom_val(v))
+
+static struct custom_operations gamma_custom_ops = {
+  .identifier  = "stbtt_gamma",
+  .finalize    = custom_finalize_default,
+  .compare     = custom_compare_default,
+  .hash        = custom_hash_default,
+  .serialize   = custom_serialize_default,
+  .deserialize = custom_deserialize_default
+};
+
+value ml_stbtt_gamma(value gamma)
+{
+  CAMLparam1(gamma);
+  CAMLlocal1(ret);
+  double e = Double_val(gamma);
+  ml_gamma *g;
+  int i;
+
+  ret = caml_alloc_custom(&gamma_custom_ops, sizeof(ml_gamma), 0, 1);
+  g = Gamma_val(ret);
+  for (i = 0; i < 256; ++i)
+    g->to_linear[i] = (unsigned short)(pow(i / 255.0, e) * (ML_GAMMA_SIZE - 1) + 0.5);
+  for (i = 0; i < ML_GAMMA_SIZE; ++i)
+    g->from_linear[i] = (unsigned char)(pow(i / (double)(ML_GAMMA_SIZE - 1), 1.0 / e) * 255.0 + 0.5);
+
+  CAMLreturn(ret);
+}
+
+value ml_stbtt_Composite(value gamma, value src, value src_offset, value src_stride, value gw, value gh, value dst, value dst_offset, value dst_stride, value format, value color)
+{
+  CAMLparam5(gamma, src, src_offset, src_stride, gw);
+  CAMLxparam5(gh, dst, dst_offset, dst_stride, format);
+  CAMLxparam1(color);
+
+  const unsigned char *cov = (unsigned char *)Caml_ba_data_val(src) + Long_val(src_offset);
+  unsigned char *output = (unsigned char *)Caml_ba_data_val(dst) + Long_val(dst_offset);
+  int w = Long_val(gw), h = Long_val(gh), i, rgba[4];
+  ml_gamma g, *pg = NULL;
+
+  for (i = 0; i < 4; ++i)
+    rgba[i] = Long_val(Field(color, i));
+  if (Is_block(gamma))
+  {
+    g = *Gamma_val(Field(gamma, 0));
+    pg = &g;
+  }
+
+  int released = ml_release_runtime((long)w * h);
+  ml_composite(output, Long_val(dst_stride), cov, Long_val(src_stride), w, h,
+               Int_val(format), rgba, pg);
+  ml_acquire_runtime(released);
+
+  CAMLreturn(Val_unit);
+}
+
+value ml_stbtt_Composite_bc(value *argv, int argn)
+{
+  if (argn != 11) abort();
+  return ml_stbtt_Composite(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7], argv[8], argv[9], argv[10]);
+}
+
+value ml_stbtt_CompositeSpans(value gamma, value spans, value dst, value tw, value th, value dst_stride, value x, value y, value format, value color)
+{
+  CAMLparam5(gamma, spans, dst, tw, th);
+  CAMLxparam5(dst_stride, x, y, format, color);
+
+  unsigned char *output = (unsigned char *)Caml_ba_data_val(dst);
+  int n = Wosize_val(spans), i, rgba[4];
+  int *s = ml_scratch_reserve(ml_scratch_get(), sizeof(int) * (n + 1));
+  ml_gamma g, *pg = NULL;
+
+  for (i = 0; i < n; ++i)
+    s[i] = Long_val(Field(spans, i));
+  for (i = 0; i < 4; ++i)
+    rgba[i] = Long_val(Field(color, i));
+  if (Is_block(gamma))
+  {
+    g = *Gamma_val(Field(gamma, 0));
+    pg = &g;
+  }
+
+  int released = ml_release_runtime(n * 4L);
+  ml_composite_spans(output, Long_val(dst_stride), Long_val(tw), Long_val(th),
+                     s, n / 4, Long_val(x), Long_val(y),
+                     Int_val(format), rgba, pg);
+  ml_acquire_runtime(released);
+
+  CAMLreturn(Val_unit);
+}
+
+value ml_stbtt_CompositeSpans_bc(value *argv, int argn)
+{
+  if (argn != 10) abort();
+  return ml_stbtt_CompositeSpans(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7], argv[8], argv[9]);
+}
+
+static value glyph_bitmap(value fontinfo, value glyph, value scale_x, value scale_y, float dx, float dy)
+{
+  CAMLparam4(fontinfo, glyph, scale_x, scale_y);
+  CAMLlocal2(ret, ba);
+
+  stbtt_fontinfo info = *Fontinfo_val(fontinfo);
+  info.userdata = ml_scratch_get();
+  int g = Long_val(glyph);
+  float sx = Double_val(scale_x), sy = Double_val(scale_y);
+  int x0, y0, x1, y1, w, h, xoff, yoff;
+
+  unsigned char* bitmap = NULL;
+
+  /* Same as stbtt_GetGlyphBitmapSubpixel, but the bitmap must not come from
+   * the scratch arena */
+  if (sx == 0) sx = sy;
+  if (sy == 0) sy = sx;
+  if (sx == 0)
+    x0 = y0 = x1 = y1 = 0;
+  else
+    stbtt_GetGlyphBitmapBoxSubpixel(&info, g, sx, sy, dx, dy, &x0, &y0, &x1, &y1);
+
+  w = x1 - x0;
+  h = y1 - y0;
+  xoff = x0;
+  yoff = y0;
+
+  if (w > 0 && h > 0)
+  {
+    bitmap = malloc(w * h);
+    if (bitmap == NULL)
+      caml_raise_out_of_memory();
+    int released = ml_release_runtime((long)w * h);
+    ml_make_glyph_bitmap(&info, bitmap, w, h, w, sx, sy, dx, dy, g);
+    ml_acquire_runtime(released);
+  }
+
+  long dims[1] = { w * h };
+  ba = caml_ba_alloc(CAML_BA_UINT8 | CAML_BA_C_LAYOUT | CAML_BA_MANAGED, 1, bitmap, dims);
+  ret = caml_alloc(5, 0);
+  Store_field(ret, 0, ba);
+  Store_field(ret, 1, Val_int(w));
+  Store_field(ret, 2, Val_int(h));
+  Store_field(ret, 3, Val_int(xoff));
+  Store_field(ret, 4, Val_int(yoff));
+  CAMLreturn(ret);
+}
+
+value ml_stbtt_GetGlyphBitmap(value fontinfo, value glyph, value scale_x, value scale_y)
+{
+  return glyph_bitmap(fontinfo, glyph, scale_x, scale_y, 0.0f, 0.0f);
+}
+
+value ml_stbtt_GetGlyphBitmapSubpixel(value fontinfo, value glyph, value scale_x, value scale_y, value shift_x, value shift_y)
+{
+  return glyph_bitmap(fontinfo, glyph, scale_x, scale_y, Double_val(shift_x), Double_val(shift_y));
+}
+
+value ml_stbtt_GetGlyphBitmapSubpixel_bc(value *argv, int argn)
+{
+  if (argn != 6) abort();
+  return ml_stbtt_GetGlyphBitmapSubpixel(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
+value ml_stbtt_GetGlyphBitmapPhases(value fontinfo, value glyph, value scale_x, value scale_y, value shifts)
+{
+  CAMLparam5(fontinfo, glyph, scale_x, scale_y, shifts);
+  CAMLlocal3(ret, bitmap, ba);
+
+  stbtt_fontinfo info = *Fontinfo_val(fontinfo);
+  ml_scratch *scratch = ml_scratch_get();
+  int g = Long_val(glyph), n = Wosize_val(shifts), i, y;
+  int stride = 0, rows = 0;
+  float sx = Double_val(scale_x), sy = Double_val(scale_y);
+  stbtt_glyph_phase *phases;
+  int *origins;
+  unsigned char *pixels;
+
+  info.userdata = scratch;
+  if (sx == 0) sx = sy;
+  if (sy == 0) sy = sx;
+
+  /* The phases are rendered one below the other in scratch memory, with
+   * the stride of the widest one, then copied to bitmaps of their own.
+   * Measure them first, the scratch buffer also holds their description. */
+  for (i = 0; i < n; ++i)
+  {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    if (sx != 0)
+      stbtt_GetGlyphBitmapBoxSubpixel(&info, g, sx, sy,
+                                      Double_val(Field(Field(shifts, i), 0)),
+                                      Double_val(Field(Field(shifts, i), 1)),
+                                      &x0, &y0, &x1, &y1);
+    if (x1 - x0 > stride) stride = x1 - x0;
+    rows += y1 - y0;
+  }
+  phases = ml_scratch_reserve(scratch, (sizeof(stbtt_glyph_phase) + 2 * sizeof(int)) * n
+                                       + (size_t)stride * rows + 1);
+  origins = (int *)(phases + n);
+  pixels = (unsigned char *)(origins + 2 * n);
+  for (i = 0, rows = 0; i < n; ++i)
+  {
+    int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    phases[i].shift_x = Double_val(Field(Field(shifts, i), 0));
+    phases[i].shift_y = Double_val(Field(Field(shifts, i), 1));
+    if (sx != 0)
+      stbtt_GetGlyphBitmapBoxSubpixel(&info, g, sx, sy, phases[i].shift_x, phases[i].shift_y,
+                                      &x0, &y0, &x1, &y1);
+    phases[i].w = x1 - x0;
+    phases[i].h = y1 - y0;
+    phases[i].output = pixels + (size_t)rows * stride;
+    origins[2*i] = x0;
+    origins[2*i+1] = y0;
+    rows += phases[i].h;
+  }
+
+  int released = ml_release_runtime((long)stride * rows);
+  stbtt_MakeGlyphBitmapPhases(&info, phases, n, stride, sx, sy, g);
+  ml_acquire_runtime(released);
+
+  ret = caml_alloc(n, 0);
+  for (i = 0; i < n; ++i)
+  {
+    int w = phases[i].w, h = phases[i].h;
+    long dims[1] = { (long)w * h };
+    ba = caml_ba_alloc(CAML_BA_UINT8 | CAML_BA_C_LAYOUT, 1, NULL, dims);
+    for (y = 0; y < h; ++y)
+      memcpy((unsigned char *)Caml_ba_data_val(ba) + y * w, phases[i].output + (size_t)y * stride, w);
+    bitmap = caml_alloc(5, 0);
+    Store_field(bitmap, 0, ba);
+    Store_field(bitmap, 1, Val_int(w));
+    Store_field(bitmap, 2, Val_int(h));
+    Store_field(bitmap, 3, Val_int(origins[2*i]));
+    Store_field(bitmap, 4, Val_int(origins[2*i+1]));
+    Store_field(ret, i, bitmap);
+  }
+
+  CAMLreturn(ret);
+}
+
+value ml_stbtt_GetGlyphSpans(value fontinfo, value glyph, value scale_x, value scale_y, value shift_x, value shift_y)
+{
+  CAMLparam5(fontinfo, glyph, scale_x, scale_y, shift_x);
+  CAMLxparam1(shift_y);
+  CAMLlocal3(ret, spans, bbox);
+
+  stbtt_fontinfo info = *Fontinfo_val(fontinfo);
+  ml_scratch *scratch = ml_scratch_get();
+  int g = Long_val(glyph);
+  float sx = Double_val(scale_x), sy = Double_val(scale_y);
+  float dx = Double_val(shift_x), dy = Double_val(shift_y);
+  stbtt_span *s, *copy = NULL;
+  int n, w = 0, h = 0, xoff = 0, yoff = 0, i, x0, y0, x1, y1;
+
+  info.userdata = scratch;
+
+  /* Only to decide whether to release the runtime */
+  if (sx != 0 || sy != 0)
+  {
+    stbtt_GetGlyphBitmapBoxSubpixel(&info, g, sx != 0 ? sx : sy, sy != 0 ? sy : sx,
+                                    dx, dy, &x0, &y0, &x1, &y1);
+    w = x1 - x0;
+    h = y1 - y0;
+  }
+
+  int released = ml_release_runtime((long)w * h);
+  s = stbtt_GetGlyphSpans(&info, sx, sy, dx, dy, g, &n, &w, &h, &xoff, &yoff);
+  ml_acquire_runtime(released);
+
+  if (n < 0)
+    caml_raise_out_of_memory();
+
+  /* The spans live in the scratch arena, which must be emptied before
+   * anything can raise */
+  if (n > 0)
+  {
+    copy = ml_scratch_try_reserve(scratch, sizeof(stbtt_span) * n);
+    if (copy != NULL)
+      memcpy(copy, s, sizeof(stbtt_span) * n);
+  }
+  stbtt_FreeSpans(s, scratch);
+  if (n > 0 && copy == NULL)
+    caml_raise_out_of_memory();
+
+  spans = caml_alloc(4 * n, 0);
+  for (i = 0; i < n; ++i)
+  {
+    Store_field(spans, 4*i+0, Val_int(copy[i].y));
+    Store_field(spans, 4*i+1, Val_int(copy[i].x0));
+    Store_field(spans, 4*i+2, Val_int(copy[i].x1));
+    Store_field(spans, 4*i+3, Val_int(copy[i].coverage));
+  }
+
+  bbox = box(xoff, yoff, xoff + w, yoff + h);
+  ret = caml_alloc(2, 0);
+  Store_field(ret, 0, spans);
+  Store_field(ret, 1, bbox);
+  CAMLreturn(ret);
+}
+
+value ml_stbtt_GetGlyphSpans_bc(value *argv, int argn)
+{
+  if (argn != 6) abort();
+  return ml_stbtt_GetGlyphSpans(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+}
+
+/* Terminal grids.
+ *
+ * A grid renders a font in cells of a fixed size: the monospace advance (or
+ * that of '0' for other fonts) by the ascent to descent height.  Each
+ * codepoint is rendered once into a cell-sized coverage mask, cached by the
+ * grid; box drawing and block characters are drawn procedurally so they join
+ * across cells.  Rendering a frame compares every cell with the previous
+ * frame and only redraws the ones that changed, so a frame costs a memcmp per
+ * cell plus the pixels of the changed cells; no glyph is measured or
+ * rasterized once the cache is warm.
+ * The state lives outside of the OCaml heap so that frames can be rendered
+ * without the runtime lock. */
+
+typedef struct {
+  pthread_mutex_t lock;     /* held while rendering, without the runtime */
+  stbtt_fontinfo info;
+  float scale;
+  int cell_w, cell_h, baseline;
+
+  /* Open addressing on codepoints, -1 for empty slots.  Masks are stored
+   * by offset in [masks], ML_GRID_BLANK for cells without ink. */
+  int *keys;
+  size_t *offsets;
+  int capacity, count;
+  unsigned char *masks;
+  size_t masks_size, masks_used;
+} ml_grid;
+
+#define ML_GRID_BLANK ((size_t)-1)
+#define ML_GRID_FAILED ((size_t)-2)  /* out of memory, not cached */
+#define ML_GRID_GRAY (-1)
+
+#define Grid_val(v) (*(ml_grid **)Data_custom_val(Field((v), 0)))
+
+static void ml_grid_free(ml_grid *g)
+{
+  free(g->keys);
+  free(g->offsets);
+  free(g->masks);
+  pthread_mutex_destroy(&g->lock);
+  free(g);
+}
+
+static void grid_finalize(value v)
+{
+  ml_grid_free(*(ml_grid **)Data_custom_val(v));
+}
+
+static struct custom_operations grid_custom_ops = {
+  .identifier  = "stbtt_grid",
+  .finalize    = grid_finalize,
+  .compare     = custom_compare_default,
+  .hash        = custom_hash_default,
+  .serialize   = custom_serialize_default,
+  .deserialize = custom_deserialize_default
+};
+
+static int ml_grid_rehash(ml_grid *g, int capacity)
+{
+  int *keys = malloc(sizeof(int) * capacity);
+  size_t *offsets = malloc(sizeof(size_t) * capacity);
+  int i;
+
+  if (keys == NULL || offsets == NULL)
+  {
+    free(keys);
+    free(offsets);
+    return 0;
+  }
+  for (i = 0; i < capacity; ++i)
+    keys[i] = -1;
+  for (i = 0; i < g->capacity; ++i)
+  {
+    unsigned h;
+    if (g->keys[i] < 0) continue;
+    h = ((unsigned)g->keys[i] * 2654435761u) & (capacity - 1);
+    while (keys[h] >= 0)
+      h = (h + 1) & (capacity - 1);
+    keys[h] = g->keys[i];
+    offsets[h] = g->offsets[i];
+  }
+  free(g->keys);
+  free(g->offsets);
+  g->keys = keys;
+  g->offsets = offsets;
+  g->capacity = capacity;
+  return 1;
+}
+
+/* Render [codepoint] into a new mask; ML_GRID_BLANK if it has no ink or
+ * memory runs out. */
+static size_t ml_grid_render_mask(ml_grid *g, stbtt_fontinfo *info, int codepoint)
+{
+  size_t area = (size_t)g->cell_w * g->cell_h, offset;
+  unsigned char *mask, *bitmap;
+  int i, w = 0, h = 0, xoff, yoff, x, y, ink = 0;
+
+  if (g->masks_used + area > g->masks_size)
+  {
+    size_t size = g->masks_size ? g->masks_size * 2 : area * 128;
+    unsigned char *masks;
+    while (size < g->masks_used + area) size *= 2;
+    masks = realloc(g->masks, size);
+    if (masks == NULL)
+      return ML_GRID_FAILED;
+    g->masks = masks;
+    g->masks_size = size;
+  }
+  offset = g->masks_used;
+  mask = g->masks + offset;
+
+  if (!stbtt_MakeBoxDrawingBitmap(mask, g->cell_w, g->cell_h, g->cell_w, codepoint))
+  {
+    memset(mask, 0, area);
+    bitmap = stbtt_GetGlyphBitmap(info, g->scale, g->scale,
+                                  stbtt_FindGlyphIndex(info, codepoint),
+                                  &w, &h, &xoff, &yoff);
+    if (bitmap == NULL)
+      return w > 0 && h > 0 ? ML_GRID_FAILED : ML_GRID_BLANK;
+    /* The glyph origin is the left end of the baseline; ink outside of the
+     * cell is clipped */
+    yoff += g->baseline;
+    for (y = 0; y < h; ++y)
+    {
+      if (y + yoff < 0 || y + yoff >= g->cell_h) continue;
+      for (x = 0; x < w; ++x)
+        if (x + xoff >= 0 && x + xoff < g->cell_w)
+          mask[(y + yoff) * g->cell_w + x + xoff] = bitmap[y * w + x];
+    }
+    stbtt_FreeBitmap(bitmap, info->userdata);
+  }
+
+  for (i = 0; i < (int)area; ++i)
+    ink |= mask[i];
+  if (!ink)
+    return ML_GRID_BLANK;
+  g->masks_used += area;
+  return offset;
+}
+
+/* The cached mask of a codepoint, NULL for a blank cell.  Returns 0 if it
+ * could not be rendered for lack of memory; nothing is cached then, so the
+ * next frame tries again. */
+static int ml_grid_mask(ml_grid *g, stbtt_fontinfo *info, int codepoint,
+                        const unsigned char **mask)
+{
+  unsigned h;
+  size_t offset;
+
+  *mask = NULL;
+  if (codepoint < 0)
+    return 1;
+  if (2 * (g->count + 1) > g->capacity &&
+      !ml_grid_rehash(g, g->capacity ? 2 * g->capacity : 256))
+    return 0;
+  h = ((unsigned)codepoint * 2654435761u) & (g->capacity - 1);
+  while (g->keys[h] >= 0 && g->keys[h] != codepoint)
+    h = (h + 1) & (g->capacity - 1);
+  if (g->keys[h] < 0)
+  {
+    offset = ml_grid_render_mask(g, info, codepoint);
+    if (offset == ML_GRID_FAILED)
+      return 0;
+    g->keys[h] = codepoint;
+    g->offsets[h] = offset;
+    g->count += 1;
+  }
+  offset = g->offsets[h];
+  if (offset != ML_GRID_BLANK)
+    *mask = g->masks + offset;
+  return 1;
+}
+
+static void ml_grid_draw_gray(ml_grid *g, unsigned char *dst, long stride,
+                              const unsigned char *mask)
+{
+  int y;
+  for (y = 0; y < g->cell_h; ++y, dst += stride)
+  {
+    if (mask)
+      memcpy(dst, mask + y * g->cell_w, g->cell_w);
+    else
+      memset(dst, 0, g->cell_w);
+  }
+}
+
+/* round(x / 255) on the two 16-bit lanes of x, each in [0, 255*255] */
+#define ML_DIV255_LANES(x) \
+  ((((x) + 0x00800080u + ((((x) + 0x00800080u) >> 8) & 0x00ff00ffu)) >> 8) & 0x00ff00ffu)
+
+/* Mix the background pixel [bpx] with the foreground [fpx] by coverage.
+ * Components are mixed in pairs, in the 16-bit lanes of a word, so the byte
+ * order of the format does not matter. */
+static void ml_grid_mix_scalar(uint32_t *px, const unsigned char *cov, int w,
+                               uint32_t fpx, uint32_t bpx)
+{
+  int x;
+  for (x = 0; x < w; ++x)
+  {
+    uint32_t c = cov[x];
+    uint32_t rb = (fpx & 0x00ff00ffu) * c + (bpx & 0x00ff00ffu) * (255 - c);
+    uint32_t ga = ((fpx >> 8) & 0x00ff00ffu) * c + ((bpx >> 8) & 0x00ff00ffu) * (255 - c);
+    px[x] = ML_DIV255_LANES(rb) | (ML_DIV255_LANES(ga) << 8);
+  }
+}
+
+#ifdef STBTT__SSE2
+/* Four pixels at a time, two per register in 16-bit components. */
+static void ml_grid_mix_sse2(uint32_t *px, const unsigned char *cov, int w,
+                             uint32_t fpx, uint32_t bpx)
+{
+  const __m128i zero = _mm_setzero_si128(), c128 = _mm_set1_epi16(128),
+                c257 = _mm_set1_epi16(257), c255 = _mm_set1_epi16(255),
+                f = _mm_unpacklo_epi8(_mm_set1_epi32(fpx), zero),
+                b = _mm_unpacklo_epi8(_mm_set1_epi32(bpx), zero);
+  int x = 0, k;
+  for (; x + 4 <= w; x += 4)
+  {
+    int c;
+    __m128i m, r[2];
+    memcpy(&c, cov + x, 4);
+    m = _mm_cvtsi32_si128(c);
+    m = _mm_unpacklo_epi8(m, m);
+    m = _mm_unpacklo_epi16(m, m);
+    for (k = 0; k < 2; ++k)
+    {
+      __m128i ck = k ? _mm_unpackhi_epi8(m, zero) : _mm_unpacklo_epi8(m, zero);
+      r[k] = _mm_add_epi16(_mm_mullo_epi16(f, ck),
+                           _mm_mullo_epi16(b, _mm_sub_epi16(c255, ck)));
+      r[k] = _mm_mulhi_epu16(_mm_add_epi16(r[k], c128), c257);
+    }
+    _mm_storeu_si128((__m128i *)(px + x), _mm_packus_epi16(r[0], r[1]));
+  }
+  ml_grid_mix_scalar(px + x, cov + x, w - x, fpx, bpx);
+}
+#define ml_grid_mix ml_grid_mix_sse2
+#else
+#define ml_grid_mix ml_grid_mix_scalar
+#endif
+
+/* Opaque cells, the background mixed with the foreground by coverage. */
+static void ml_grid_draw_color(ml_grid *g, unsigned char *dst, long stride,
+                               const unsigned char *mask, int format,
+                               unsigned fg, unsigned bg)
+{
+  unsigned char f[4], b[4];
+  uint32_t fpx, bpx;
+  int x, y, k, swap = format == ML_BGRA || format == ML_BGRA_PREMULTIPLIED;
+
+  for (k = 0; k < 3; ++k)
+  {
+    f[swap ? 2 - k : k] = (fg >> (16 - 8 * k)) & 255;
+    b[swap ? 2 - k : k] = (bg >> (16 - 8 * k)) & 255;
+  }
+  f[3] = b[3] = 255;
+  memcpy(&fpx, f, 4);
+  memcpy(&bpx, b, 4);
+
+  for (y = 0; y < g->cell_h; ++y, dst += stride)
+  {
+    if (mask)
+      ml_grid_mix((uint32_t *)dst, mask + y * g->cell_w, g->cell_w, fpx, bpx);
+    else
+      for (x = 0; x < g->cell_w; ++x)
+        ((uint32_t *)dst)[x] = bpx;
+  }
+}
+
+static long ml_grid_render(ml_grid *g, stbtt_fontinfo *info, int columns, int rows,
+                           const int32_t *cells, int32_t *previous,
+                           unsigned char *dst, long stride, int format)
+{
+  long drawn = 0;
+  int bpp = format == ML_GRID_GRAY ? 1 : 4, r, c, ok;
+
+  for (r = 0; r < rows; ++r)
+  {
+    for (c = 0; c < columns; ++c)
+    {
+      const int32_t *cell = cells + 3 * ((long)r * columns + c);
+      int32_t *prev = previous + 3 * ((long)r * columns + c);
+      unsigned char *out = dst + (long)r * g->cell_h * stride + (long)c * g->cell_w * bpp;
+      const unsigned char *mask;
+
+      if (memcmp(cell, prev, 3 * sizeof(int32_t)) == 0)
+        continue;
+      /* A cell without its mask is drawn blank and left different from
+       * [previous], to be drawn again by the next frame */
+      ok = ml_grid_mask(g, info, cell[0], &mask);
+      if (format == ML_GRID_GRAY)
+        ml_grid_draw_gray(g, out, stride, mask);
+      else
+        ml_grid_draw_color(g, out, stride, mask, format, cell[1], cell[2]);
+      if (ok)
+        memcpy(prev, cell, 3 * sizeof(int32_t));
+      drawn += 1;
+    }
+  }
+  return drawn;
+}
+
+value ml_stbtt_grid(value fontinfo, value scale)
+{
+  CAMLparam2(fontinfo, scale);
+  CAMLlocal2(ret, custom);
+
+  ml_grid *g = calloc(1, sizeof(ml_grid));
+  int advance, ascent, descent, line_gap;
+
+  if (g == NULL)
+    caml_raise_out_of_memory();
+  pthread_mutex_init(&g->lock, NULL);
+  g->info = *Fontinfo_val(fontinfo);
+  g->scale = Double_val(scale);
+  advance = stbtt_GetFontMonospaceAdvance(&g->info);
+  if (advance == 0)
+    stbtt_GetCodepointHMetrics(&g->info, '0', &advance, NULL);
+  stbtt_GetFontVMetrics(&g->info, &ascent, &descent, &line_gap);
+  g->cell_w = (int)ceilf(advance * g->scale);
+  g->cell_h = (int)ceilf((ascent - descent) * g->scale);
+  g->baseline = (int)(ascent * g->scale + 0.5f);
+  if (g->cell_w < 1) g->cell_w = 1;
+  if (g->cell_h < 1) g->cell_h = 1;
+
+  custom = caml_alloc_custom(&grid_custom_ops, sizeof(ml_grid *), 0, 1);
+  *(ml_grid **)Data_custom_val(custom) = g;
+
+  /* Keep the font alive, the grid points to its data */
+  ret = caml_alloc(2, 0);
+  Store_field(ret, 0, custom);
+  Store_field(ret, 1, fontinfo);
+  CAMLreturn(ret);
+}
+
+value ml_stbtt_grid_cell_width(value grid)
+{
+  return Val_int(Grid_val(grid)->cell_w);
+}
+
+value ml_stbtt_grid_cell_height(value grid)
+{
+  return Val_int(Grid_val(grid)->cell_h);
+}
+
+value ml_stbtt_RenderGrid(value grid, value columns, value rows, value cells, value previous, value target, value stride, value format)
+{
+  CAMLparam5(grid, columns, rows, cells, previous);
+  CAMLxparam3(target, stride, format);
+
+  ml_grid *g = Grid_val(grid);
+  stbtt_fontinfo info = g->info;
+  int w = Long_val(columns), h = Long_val(rows);
+  int fmt = Is_block(format) ? Int_val(Field(format, 0)) : ML_GRID_GRAY;
+  const int32_t *c = Caml_ba_data_val(cells);
+  int32_t *prev = Caml_ba_data_val(previous);
+  unsigned char *dst = Caml_ba_data_val(target);
+  long drawn;
+
+  info.userdata = ml_scratch_get();
+  /* The lock is taken without the runtime, so that a thread waiting for it
+   * does not hold up the one rendering */
+  int released = ml_release_runtime((long)w * h * g->cell_w * g->cell_h);
+  pthread_mutex_lock(&g->lock);
+  drawn = ml_grid_render(g, &info, w, h, c, prev, dst, Long_val(stride), fmt);
+  pthread_mutex_unlock(&g->lock);
+  ml_acquire_runtime(released);
+
+  CAMLreturn(Val_long(drawn));
+}
+
+value ml_stbtt_RenderGrid_bc(value *argv, int argn)
+{
+  if (argn != 8) abort();
+  return ml_stbtt_RenderGrid(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7]);
+}
+
+/* Glyph bitmap cache.
+ *
+ * Bitmaps are keyed by font, glyph, scale, subpixel phase and blur, and kept
+ * in least recently used order.  Their pixels come from per-size-class free
+ * lists of power-of-two blocks, so evicting a glyph recycles its memory for
+ * the next one without going through malloc.  The budget bounds all the
+ * memory the cache holds, free blocks included: before a block is allocated,
+ * glyphs are evicted until the live ones fit, then free blocks are released
+ * until the new one fits too.
+ * A mutex protects the cache.  It is never held while waiting for the
+ * runtime, so a stub may release the runtime while holding it. */
+
+#define ML_CACHE_MIN_CLASS 4   /* 16 bytes, room for the free list link */
+#define ML_CACHE_CLASSES 21    /* up to 16MB */
+#define ML_CACHE_LARGE (-1)    /* bitmaps too big for a class, or empty */
+
+typedef struct ml_cache_entry {
+  struct ml_cache_entry *hnext;       /* hash chain */
+  struct ml_cache_entry *prev, *next; /* LRU list */
+  unsigned hash;
+  long font;
+  int glyph, bin_x, bin_y;
+  float scale_x, scale_y, blur;
+  int w, h, xoff, yoff, cls;
+  unsigned char *pixels;
+} ml_cache_entry;
+
+typedef struct {
+  pthread_mutex_t lock;
+  int phases_x, phases_y;
+  size_t budget, live, held;
+  ml_cache_entry **buckets;
+  int num_buckets, count;
+  ml_cache_entry lru;                 /* lru.next is the most recent */
+  void *free_blocks[ML_CACHE_CLASSES];
+  long hits, misses, evictions;
+} ml_cache;
+
+#define Cache_val(v) (*(ml_cache **)Data_custom_val(v))
+
+static int ml_cache_class(size_t size)
+{
+  int c = ML_CACHE_MIN_CLASS;
+  while (c < ML_CACHE_MIN_CLASS + ML_CACHE_CLASSES && ((size_t)1 << c) < size)
+    ++c;
+  return c < ML_CACHE_MIN_CLASS + ML_CACHE_CLASSES ? c - ML_CACHE_MIN_CLASS : ML_CACHE_LARGE;
+}
+
+static size_t ml_cache_block_size(int cls, size_t size)
+{
+  return cls == ML_CACHE_LARGE ? size : (size_t)1 << (cls + ML_CACHE_MIN_CLASS);
+}
+
+static void ml_cache_unlink(ml_cache *c, ml_cache_entry *e)
+{
+  ml_cache_entry **p = &c->buckets[e->hash & (c->num_buckets - 1)];
+  while (*p != e)
+    p = &(*p)->hnext;
+  *p = e->hnext;
+  e->prev->next = e->next;
+  e->next->prev = e->prev;
+  c->count -= 1;
+}
+
+/* Drop [e]; its block goes to the free list of its class */
+static void ml_cache_drop(ml_cache *c, ml_cache_entry *e)
+{
+  size_t size = ml_cache_block_size(e->cls, (size_t)e->w * e->h);
+  ml_cache_unlink(c, e);
+  if (e->pixels && e->cls != ML_CACHE_LARGE)
+  {
+    *(void **)e->pixels = c->free_blocks[e->cls];
+    c->free_blocks[e->cls] = e->pixels;
+    c->live -= size;
+  }
+  else if (e->pixels)
+  {
+    free(e->pixels);
+    c->live -= size;
+    c->held -= size;
+  }
+  c->live -= sizeof(ml_cache_entry);
+  c->held -= sizeof(ml_cache_entry);
+  free(e);
+}
+
+static void ml_cache_release_free_blocks(ml_cache *c, size_t needed)
+{
+  int k;
+  for (k = ML_CACHE_CLASSES - 1; k >= 0 && c->held + needed > c->budget; --k)
+    while (c->free_blocks[k] && c->held + needed > c->budget)
+    {
+      void *b = c->free_blocks[k];
+      c->free_blocks[k] = *(void **)b;
+      free(b);
+      c->held -= ml_cache_block_size(k, 0);
+    }
+}
+
+/* Make room for an entry with a block of class [cls] for [size] pixels,
+ * evicting the least recently used glyphs, and allocate the block into
+ * [*block], accounted in live and held.  0 if it can never fit or memory
+ * runs out. */
+static int ml_cache_reserve(ml_cache *c, int cls, size_t size, unsigned char **block)
+{
+  size_t bytes = size ? ml_cache_block_size(cls, size) : 0;
+  *block = NULL;
+  if (sizeof(ml_cache_entry) + bytes > c->budget)
+    return 0;
+  while (c->live + sizeof(ml_cache_entry) + bytes > c->budget && c->lru.prev != &c->lru)
+  {
+    ml_cache_drop(c, c->lru.prev);
+    c->evictions += 1;
+  }
+  /* a free block of the class is reused as is, take it before trimming the
+   * free lists so that it is not released */
+  if (size && cls != ML_CACHE_LARGE && c->free_blocks[cls])
+  {
+    *block = c->free_blocks[cls];
+    c->free_blocks[cls] = *(void **)*block;
+    c->live += bytes;
+    bytes = 0;
+  }
+  ml_cache_release_free_blocks(c, sizeof(ml_cache_entry) + bytes);
+  if (bytes)
+  {
+    if ((*block = malloc(bytes)) == NULL)
+      return 0;
+    c->live += bytes;
+    c->held += bytes;
+  }
+  return 1;
+}
+
+static void ml_cache_free(ml_cache *c)
+{
+  int k;
+  while (c->lru.next != &c->lru)
+    ml_cache_drop(c, c->lru.next);
+  for (k = 0; k < ML_CACHE_CLASSES; ++k)
+    while (c->free_blocks[k])
+    {
+      void *b = c->free_blocks[k];
+      c->free_blocks[k] = *(void **)b;
+      free(b);
+    }
+  free(c->buckets);
+  pthread_mutex_destroy(&c->lock);
+  free(c);
+}
+
+static void cache_finalize(value v)
+{
+  ml_cache_free(Cache_val(v));
+}
+
+static struct custom_operations cache_custom_ops = {
+  .identifier  = "stbtt_bitmap_cache",
+  .finalize    = cache_finalize,
+  .compare     = custom_compare_default,
+  .hash        = custom_hash_default,
+  .serialize   = custom_serialize_default,
+  .deserialize = custom_deserialize_default
+};
+
+static unsigned ml_cache_hash(long font, int glyph, float sx, float sy, int bx, int by, float blur)
+{
+  uint32_t h = 2166136261u, words[7], i;
+  words[0] = (uint32_t)font;
+  words[1] = (uint32_t)glyph;
+  memcpy(&words[2], &sx, 4);
+  memcpy(&words[3], &sy, 4);
+  words[4] = (uint32_t)bx;
+  words[5] = (uint32_t)by;
+  memcpy(&words[6], &blur, 4);
+  for (i = 0; i < 7; ++i)
+    h = (h ^ words[i]) * 16777619u;
+  return h ^ (h >> 15);
+}
+
+static void ml_cache_grow(ml_cache *c)
+{
+  int n = c->num_buckets * 2, i;
+  ml_cache_entry **buckets = calloc(n, sizeof(ml_cache_entry *));
+  if (buckets == NULL)
+    return;
+  for (i = 0; i < c->num_buckets; ++i)
+    while (c->buckets[i])
+    {
+      ml_cache_entry *e = c->buckets[i];
+      c->buckets[i] = e->hnext;
+      e->hnext = buckets[e->hash & (n - 1)];
+      buckets[e->hash & (n - 1)] = e;
+    }
+  free(c->buckets);
+  c->buckets = buckets;
+  c->num_buckets = n;
+}
+
+/* Pixel and phase of the pen coordinate [v] */
+static void ml_cache_snap(float v, int phases, int *pixel, int *bin)
+{
+  int p = (int)floorf(v);
+  int b = (int)((v - p) * phases + 0.5f);
+  if (b == phases) { p += 1; b = 0; }
+  *pixel = p;
+  *bin = b;
+}
+
+/* Box of a cached bitmap, enlarged by the returned padding to hold the blur */
+static int ml_cache_box(stbtt_fontinfo *info, int glyph, float sx, float sy, float dx, float dy,
+                        float blur, int *x0, int *y0, int *x1, int *y1)
+{
+  int pad = blur >= 0.01f ? (int)ceilf(blur) + 1 : 0;
+  *x0 = *y0 = *x1 = *y1 = 0;
+  if (sx != 0 && sy != 0)
+    stbtt_GetGlyphBitmapBoxSubpixel(info, glyph, sx, sy, dx, dy, x0, y0, x1, y1);
+  if (*x1 > *x0 && *y1 > *y0)
+  {
+    *x0 -= pad; *y0 -= pad;
+    *x1 += pad; *y1 += pad;
+  }
+  return pad;
+}
+
+static void ml_cache_draw(stbtt_fontinfo *info, unsigned char *pixels, int w, int h, int pad,
+                          int glyph, float sx, float sy, float dx, float dy, float blur)
+{
+  if (w <= 0 || h <= 0)
+    return;
+  memset(pixels, 0, (size_t)w * h);
+  ml_make_glyph_bitmap(info, pixels + pad * w + pad, w - 2 * pad, h - 2 * pad, w,
+                       sx, sy, dx, dy, glyph);
+  expblur(pixels, w, h, w, blur);
+}
+
+/* Find or render a glyph.  NULL if it does not fit in the budget, then it
+ * is rendered to [*spill], which the caller frees. */
+static ml_cache_entry *ml_cache_lookup(ml_cache *c, stbtt_fontinfo *info, long font,
+                                       int glyph, float sx, float sy, float blur,
+                                       int bx, int by, ml_cache_entry *spill)
+{
+  unsigned hash = ml_cache_hash(font, glyph, sx, sy, bx, by, blur);
+  ml_cache_entry *e;
+  float dx = (float)bx / c->phases_x, dy = (float)by / c->phases_y;
+  int x0, y0, x1, y1, pad;
+  size_t size;
+
+  for (e = c->buckets[hash & (c->num_buckets - 1)]; e; e = e->hnext)
+    if (e->hash == hash && e->font == font && e->glyph == glyph &&
+        e->scale_x == sx && e->scale_y == sy && e->bin_x == bx && e->bin_y == by &&
+        e->blur == blur)
+    {
+      /* move to the front */
+      e->prev->next = e->next;
+      e->next->prev = e->prev;
+      e->next = c->lru.next;
+      e->prev = &c->lru;
+      c->lru.next->prev = e;
+      c->lru.next = e;
+      c->hits += 1;
+      return e;
+    }
+  c->misses += 1;
+
+  pad = ml_cache_box(info, glyph, sx, sy, dx, dy, blur, &x0, &y0, &x1, &y1);
+  size = (size_t)(x1 - x0) * (y1 - y0);
+
+  e = malloc(sizeof(ml_cache_entry));
+  if (e == NULL)
+  {
+    spill->w = spill->h = 0;
+    spill->pixels = NULL;
+    return NULL;
+  }
+  e->font = font; e->glyph = glyph; e->hash = hash;
+  e->scale_x = sx; e->scale_y = sy; e->bin_x = bx; e->bin_y = by; e->blur = blur;
+  e->w = x1 - x0; e->h = y1 - y0; e->xoff = x0; e->yoff = y0;
+  e->cls = size ? ml_cache_class(size) : ML_CACHE_LARGE;
+  e->pixels = NULL;
+
+  if (!ml_cache_reserve(c, e->cls, size, &e->pixels))
+  {
+    /* does not fit, render it on the side */
+    *spill = *e;
+    free(e);
+    spill->pixels = size ? malloc(size) : NULL;
+    e = spill;
+    if (size && e->pixels == NULL)
+    {
+      e->w = e->h = 0;
+      return NULL;
+    }
+  }
+  else
+  {
+    c->live += sizeof(ml_cache_entry);
+    c->held += sizeof(ml_cache_entry);
+  }
+
+  ml_cache_draw(info, e->pixels, e->w, e->h, pad, glyph, sx, sy, dx, dy, blur);
+  if (e == spill)
+    return NULL;
+
+  if (c->count + 1 > c->num_buckets)
+    ml_cache_grow(c);
+  e->hnext = c->buckets[hash & (c->num_buckets - 1)];
+  c->buckets[hash & (c->num_buckets - 1)] = e;
+  e->next = c->lru.next;
+  e->prev = &c->lru;
+  c->lru.next->prev = e;
+  c->lru.next = e;
+  c->count += 1;
+  return e;
+}
+
+value ml_stbtt_bitmap_cache(value phases_x, value phases_y, value budget)
+{
+  CAMLparam3(phases_x, phases_y, budget);
+  CAMLlocal1(ret);
+
+  ml_cache *c = calloc(1, sizeof(ml_cache));
+  if (c == NULL || (c->buckets = calloc(256, sizeof(ml_cache_entry *))) == NULL)
+  {
+    free(c);
+    caml_raise_out_of_memory();
+  }
+  pthread_mutex_init(&c->lock, NULL);
+  c->num_buckets = 256;
+  c->phases_x = Long_val(phases_x);
+  c->phases_y = Long_val(phases_y);
+  c->budget = Long_val(budget);
+  c->lru.next = c->lru.prev = &c->lru;
+
+  ret = caml_alloc_custom(&cache_custom_ops, sizeof(ml_cache *), 0, 1);
+  Cache_val(ret) = c;
+  CAMLreturn(ret);
+}
+
+value ml_stbtt_bitmap_cache_clear(value cache)
+{
+  ml_cache *c = Cache_val(cache);
+  /* The lock can be held by a render, wait for it without the runtime */
+  caml_release_runtime_system();
+  pthread_mutex_lock(&c->lock);
+  while (c->lru.next != &c->lru)
+    ml_cache_drop(c, c->lru.next);
+  ml_cache_release_free_blocks(c, c->budget);
+  pthread_mutex_unlock(&c->lock);
+  caml_acquire_runtime_system();
+  return Val_unit;
+}
+
+value ml_stbtt_bitmap_cache_stats(value cache)
+{
+  CAMLparam1(cache);
+  CAMLlocal1(ret);
+  ml_cache *c = Cache_val(cache);
+  long stats[5];
+  int i;
+
+  caml_release_runtime_system();
+  pthread_mutex_lock(&c->lock);
+  stats[0] = c->hits;
+  stats[1] = c->misses;
+  stats[2] = c->evictions;
+  stats[3] = c->count;
+  stats[4] = c->held;
+  pthread_mutex_unlock(&c->lock);
+  caml_acquire_runtime_system();
+
+  ret = caml_alloc(5, 0);
+  for (i = 0; i < 5; ++i)
+    Store_field(ret, i, Val_long(stats[i]));
+  CAMLreturn(ret);
+}
+
+value ml_stbtt_bitmap_cache_get(value cache, value fontinfo, value glyph, value scale_x, value scale_y, value blur, value x, value y)
+{
+  CAMLparam5(cache, fontinfo, glyph, scale_x, scale_y);
+  CAMLxparam3(blur, x, y);
+  CAMLlocal3(ret, bitmap, ba);
+
+  ml_cache *c = Cache_val(cache);
+  stbtt_fontinfo info = *Fontinfo_val(fontinfo);
+  ml_scratch *scratch = ml_scratch_get();
+  ml_cache_entry spill, *e, copy;
+  long font = Long_val(Field(fontinfo, 1));
+  int g = Long_val(glyph), ix, iy, bx, by;
+  float sx = Double_val(scale_x), sy = Double_val(scale_y), b = Double_val(blur);
+  unsigned char *pixels;
+  long dims[1];
+
+  info.userdata = scratch;
+  ml_cache_snap(Double_val(x), c->phases_x, &ix, &bx);
+  ml_cache_snap(Double_val(y), c->phases_y, &iy, &by);
+
+  /* Copy the bitmap out while holding the lock, the entry can be evicted
+   * as soon as it is released.  Nothing may raise before it is.
+   * A miss renders with the lock held, so it is taken without the runtime,
+   * as in render_run. */
+  caml_release_runtime_system();
+  pthread_mutex_lock(&c->lock);
+  e = ml_cache_lookup(c, &info, font, g, sx, sy, b, bx, by, &spill);
+  copy = e ? *e : spill;
+  if (e == NULL && spill.pixels)
+    pixels = spill.pixels;
+  else if ((pixels = malloc((size_t)copy.w * copy.h + 1)) != NULL && copy.pixels)
+    memcpy(pixels, copy.pixels, (size_t)copy.w * copy.h);
+  pthread_mutex_unlock(&c->lock);
+  caml_acquire_runtime_system();
+  if (pixels == NULL)
+    caml_raise_out_of_memory();
+
+  dims[0] = (long)copy.w * copy.h;
+  ba = caml_ba_alloc(CAML_BA_UINT8 | CAML_BA_C_LAYOUT | CAML_BA_MANAGED, 1, pixels, dims);
+  bitmap = caml_alloc(5, 0);
+  Store_field(bitmap, 0, ba);
+  Store_field(bitmap, 1, Val_int(copy.w));
+  Store_field(bitmap, 2, Val_int(copy.h));
+  Store_field(bitmap, 3, Val_int(copy.xoff));
+  Store_field(bitmap, 4, Val_int(copy.yoff));
+  ret = caml_alloc(3, 0);
+  Store_field(ret, 0, bitmap);
+  Store_field(ret, 1, Val_int(ix + copy.xoff));
+  Store_field(ret, 2, Val_int(iy + copy.yoff));
+  CAMLreturn(ret);
+}
+
+value ml_stbtt_bitmap_cache_get_bc(value *argv, int argn)
+{
+  if (argn != 8) abort();
+  return ml_stbtt_bitmap_cache_get(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7]);
+}
+
+value ml_stbtt_bitmap_cache_render_run(value cache, value fontinfo, value scale_x, value scale_y, value blur, value buffer, value offset, value gw, value gh, value stride, value run)
+{
+  CAMLparam5(cache, fontinfo, scale_x, scale_y, blur);
+  CAMLxparam5(buffer, offset, gw, gh, stride);
+  CAMLxparam1(run);
+
+  ml_cache *c = Cache_val(cache);
+  stbtt_fontinfo info = *Fontinfo_val(fontinfo);
+  ml_scratch *scratch = ml_scratch_get();
+  stbtt_run_glyph *glyphs = ml_run_glyphs(scratch, run);
+  int n = Wosize_val(run), w = Long_val(gw), h = Long_val(gh), i, x, y;
+  long font = Long_val(Field(fontinfo, 1)), s = Long_val(stride);
+  float sx = Double_val(scale_x), sy = Double_val(scale_y), b = Double_val(blur);
+  unsigned char *output = (unsigned char *)Caml_ba_data_val(buffer) + Long_val(offset);
+  int ox, oy;
+
+  info.userdata = scratch;
+  /* same origin as stbtt_MakeRunBitmap */
+  stbtt_GetRunBitmapBox(&info, glyphs, n, sx, sy, &ox, &oy, 0, 0);
+  /* Whatever the size of the run, the lock can be held by a miss of another
+   * thread: wait for it without the runtime */
+  caml_release_runtime_system();
+  pthread_mutex_lock(&c->lock);
+  for (y = 0; y < h; ++y)
+    memset(output + y * s, 0, w);
+  for (i = 0; i < n; ++i)
+  {
+    ml_cache_entry spill, *e;
+    int ix, iy, bx, by;
+    ml_cache_snap(glyphs[i].x, c->phases_x, &ix, &bx);
+    ml_cache_snap(glyphs[i].y, c->phases_y, &iy, &by);
+    e = ml_cache_lookup(c, &info, font, glyphs[i].glyph, sx, sy, b, bx, by, &spill);
+    if (e == NULL) e = &spill;
+    ix += e->xoff - ox;
+    iy += e->yoff - oy;
+    for (y = 0; y < e->h; ++y)
+    {
+      if (iy + y < 0 || iy + y >= h) continue;
+      for (x = 0; x < e->w; ++x)
+      {
+        int v;
+        if (ix + x < 0 || ix + x >= w) continue;
+        v = output[(iy + y) * s + ix + x] + e->pixels[y * e->w + x];
+        output[(iy + y) * s + ix + x] = (unsigned char)(v > 255 ? 255 : v);
+      }
+    }
+    if (e == &spill)
+      free(spill.pixels);
+  }
+  pthread_mutex_unlock(&c->lock);
+  caml_acquire_runtime_system();
+
+  CAMLreturn(Val_unit);
+}
+
+value ml_stbtt_bitmap_cache_render_run_bc(value *argv, int argn)
+{
+  if (argn != 11) abort();
+  return ml_stbtt_bitmap_cache_render_run(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7], argv[8], argv[9], argv[10]);
+}
+
+/* Shared glyph bitmap cache.
+ *
+ * The concurrent counterpart of the cache above, for many domains rendering
+ * with the same fonts.  A key hashes to a set of ML_SHARED_WAYS slots.
+ * Lookups take no lock: each slot is a seqlock, whose version is odd while
+ * it is being written, and a reader retries when the version it read before
+ * the key and mask is not the one it reads after.
+ * Writers, which only run on a miss, take a spinlock per set.  A miss claims
+ * a slot and marks it RENDERING before rendering without any lock, so that
+ * a domain missing the same key finds that slot and waits for the bitmap
+ * instead of rendering it a second time.
+ * Evicted bitmaps are freed by epochs: readers announce themselves in a
+ * counter of the parity of the current epoch, striped to spread them over
+ * cache lines, and a bitmap retired in epoch [e] is freed once the epoch
+ * reaches [e + 2], when no reader that could have seen it remains.
+ * Recently used bitmaps get a second chance, clock style, both when a full
+ * set needs a slot and when the budget needs bytes. */
+
+#define ML_SHARED_WAYS 8
+#define ML_SHARED_KEY 8
+#define ML_SHARED_STRIPES 16
+
+enum { ML_SLOT_EMPTY, ML_SLOT_RENDERING, ML_SLOT_READY };
+
+typedef struct ml_mask {
+  int w, h, xoff, yoff;
+  long size;                /* bytes accounted in the budget */
+  struct ml_mask *next;     /* retired list */
+  unsigned long epoch;      /* when it was retired */
+  unsigned char pixels[];
+} ml_mask;
+
+typedef struct {
+  atomic_uint version;
+  atomic_uchar state, referenced;
+  atomic_uint key[ML_SHARED_KEY];
+  _Atomic(ml_mask *) mask;
+} ml_slot;
+
+typedef struct {
+  atomic_flag lock;
+  ml_slot ways[ML_SHARED_WAYS];
+} ml_set;
+
+typedef struct {
+  atomic_long readers[2];   /* per parity of the epoch */
+  atomic_long hits, misses;
+  char pad[64 - 4 * sizeof(atomic_long)];
+} ml_stripe;
+
+typedef struct {
+  ml_stripe stripes[ML_SHARED_STRIPES];
+  atomic_ulong epoch;
+  atomic_long live, entries, evictions;
+  atomic_uint hand;         /* clock hand for budget evictions */
+  int phases_x, phases_y;
+  long budget;
+  ml_set *sets;
+  unsigned num_sets;
+  pthread_mutex_t retire_lock;
+  ml_mask *retired;         /* most recent first */
+} ml_shared;
+
+#define Shared_val(v) (*(ml_shared **)Data_custom_val(v))
+
+static int ml_shared_enter(ml_shared *c, ml_stripe *st)
+{
+  for (;;)
+  {
+    unsigned long e = atomic_load(&c->epoch);
+    atomic_fetch_add(&st->readers[e & 1], 1);
+    if (atomic_load(&c->epoch) == e)
+      return e & 1;
+    atomic_fetch_sub(&st->readers[e & 1], 1);
+  }
+}
+
+static void ml_shared_leave(ml_stripe *st, int parity)
+{
+  atomic_fetch_sub_explicit(&st->readers[parity], 1, memory_order_release);
+}
+
+/* Advance the epoch if its predecessor has no readers left, and free the
+ * masks retired two epochs ago.  Called with retire_lock held. */
+static void ml_shared_collect(ml_shared *c)
+{
+  unsigned long e = atomic_load(&c->epoch);
+  ml_mask **p = &c->retired, *m;
+  int i;
+
+  for (i = 0; i < ML_SHARED_STRIPES; ++i)
+    if (atomic_load(&c->stripes[i].readers[(e - 1) & 1]) != 0)
+      break;
+  if (i == ML_SHARED_STRIPES)
+    atomic_store(&c->epoch, ++e);
+
+  while (*p && (*p)->epoch + 2 > e)
+    p = &(*p)->next;
+  m = *p;
+  *p = NULL;
+  while (m)
+  {
+    ml_mask *next = m->next;
+    free(m);
+    m = next;
+  }
+}
+
+static void ml_shared_retire(ml_shared *c, ml_mask *m)
+{
+  if (m == NULL)
+    return;
+  /* the slot was cleared before the epoch is read */
+  atomic_thread_fence(memory_order_seq_cst);
+  pthread_mutex_lock(&c->retire_lock);
+  m->epoch = atomic_load(&c->epoch);
+  m->next = c->retired;
+  c->retired = m;
+  ml_shared_collect(c);
+  pthread_mutex_unlock(&c->retire_lock);
+}
+
+static void ml_set_lock(ml_set *set)
+{
+  while (atomic_flag_test_and_set_explicit(&set->lock, memory_order_acquire))
+    sched_yield();
+}
+
+static void ml_set_unlock(ml_set *set)
+{
+  atomic_flag_clear_explicit(&set->lock, memory_order_release);
+}
+
+/* Rewrite a slot, with its set locked */
+static void ml_slot_write(ml_slot *s, int state, const unsigned *key, ml_mask *mask)
+{
+  unsigned v = atomic_load_explicit(&s->version, memory_order_relaxed);
+  int k;
+  atomic_store_explicit(&s->version, v + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&s->state, state, memory_order_relaxed);
+  atomic_store_explicit(&s->referenced, 0, memory_order_relaxed);
+  if (key)
+    for (k = 0; k < ML_SHARED_KEY; ++k)
+      atomic_store_explicit(&s->key[k], key[k], memory_order_relaxed);
+  atomic_store_explicit(&s->mask, mask, memory_order_relaxed);
+  atomic_store_explicit(&s->version, v + 2, memory_order_release);
+}
+
+/* Empty a READY slot, with its set locked; its mask is to be retired */
+static ml_mask *ml_slot_evict(ml_shared *c, ml_slot *s)
+{
+  ml_mask *m = atomic_load_explicit(&s->mask, memory_order_relaxed);
+  ml_slot_write(s, ML_SLOT_EMPTY, NULL, NULL);
+  atomic_fetch_sub(&c->live, m->size);
+  atomic_fetch_sub(&c->entries, 1);
+  return m;
+}
+
+/* Slot of [key] in [set], and its state and mask, without locking */
+static ml_slot *ml_shared_find(ml_set *set, const unsigned *key, int *state, ml_mask **mask)
+{
+  int i, k;
+  for (i = 0; i < ML_SHARED_WAYS; ++i)
+  {
+    ml_slot *s = &set->ways[i];
+    unsigned v = atomic_load_explicit(&s->version, memory_order_acquire);
+    int st;
+    ml_mask *m;
+    if (v & 1)
+      continue;
+    st = atomic_load_explicit(&s->state, memory_order_relaxed);
+    if (st == ML_SLOT_EMPTY)
+      continue;
+    for (k = 0; k < ML_SHARED_KEY &&
+         atomic_load_explicit(&s->key[k], memory_order_relaxed) == key[k]; ++k)
+      ;
+    m = atomic_load_explicit(&s->mask, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (k < ML_SHARED_KEY || atomic_load_explicit(&s->version, memory_order_relaxed) != v)
+      continue;
+    *state = st;
+    *mask = m;
+    return s;
+  }
+  return NULL;
+}
+
+/* The cached mask of [key], or NULL, from inside an epoch */
+static ml_mask *ml_shared_hit(ml_stripe *st, ml_set *set, const unsigned *key)
+{
+  int state;
+  ml_mask *m;
+  ml_slot *s = ml_shared_find(set, key, &state, &m);
+  if (s == NULL || state != ML_SLOT_READY)
+    return NULL;
+  if (!atomic_load_explicit(&s->referenced, memory_order_relaxed))
+    atomic_store_explicit(&s->referenced, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&st->hits, 1, memory_order_relaxed);
+  return m;
+}
+
+/* Slot for a new key in a locked set: an empty one, else the first READY
+ * one not used since the last pass.  NULL if all are being rendered. */
+static ml_slot *ml_shared_victim(ml_set *set)
+{
+  ml_slot *victim = NULL;
+  int i;
+  for (i = 0; i < ML_SHARED_WAYS; ++i)
+  {
+    ml_slot *s = &set->ways[i];
+    int st = atomic_load_explicit(&s->state, memory_order_relaxed);
+    if (st == ML_SLOT_EMPTY)
+      return s;
+    if (st == ML_SLOT_READY &&
+        atomic_exchange_explicit(&s->referenced, 0, memory_order_relaxed) == 0 &&
+        victim == NULL)
+      victim = s;
+  }
+  for (i = 0; victim == NULL && i < ML_SHARED_WAYS; ++i)
+    if (atomic_load_explicit(&set->ways[i].state, memory_order_relaxed) == ML_SLOT_READY)
+      victim = &set->ways[i];
+  return victim;
+}
+
+/* Evict unreferenced bitmaps until the cache fits in its budget.  Sets
+ * locked by other domains are skipped. */
+static void ml_shared_trim(ml_shared *c)
+{
+  long steps = 2L * c->num_sets * ML_SHARED_WAYS;
+  while (atomic_load(&c->live) > c->budget && steps-- > 0)
+  {
+    unsigned hand = atomic_fetch_add(&c->hand, 1);
+    ml_set *set = &c->sets[(hand / ML_SHARED_WAYS) & (c->num_sets - 1)];
+    ml_slot *s = &set->ways[hand % ML_SHARED_WAYS];
+    ml_mask *m = NULL;
+    if (atomic_load_explicit(&s->state, memory_order_relaxed) != ML_SLOT_READY ||
+        atomic_flag_test_and_set_explicit(&set->lock, memory_order_acquire))
+      continue;
+    if (atomic_load_explicit(&s->state, memory_order_relaxed) == ML_SLOT_READY &&
+        atomic_exchange_explicit(&s->referenced, 0, memory_order_relaxed) == 0)
+    {
+      m = ml_slot_evict(c, s);
+      atomic_fetch_add(&c->evictions, 1);
+    }
+    ml_set_unlock(set);
+    ml_shared_retire(c, m);
+  }
+}
+
+typedef struct {
+  stbtt_fontinfo *info;
+  int glyph;
+  float sx, sy, dx, dy, blur;
+} ml_shared_glyph;
+
+static ml_mask *ml_shared_render(ml_shared_glyph *g)
+{
+  int x0, y0, x1, y1, pad = ml_cache_box(g->info, g->glyph, g->sx, g->sy, g->dx, g->dy, g->blur,
+                                        &x0, &y0, &x1, &y1);
+  size_t size = (size_t)(x1 - x0) * (y1 - y0);
+  ml_mask *m = malloc(sizeof(ml_mask) + size);
+  if (m == NULL)
+    return NULL;
+  m->w = x1 - x0; m->h = y1 - y0;
+  m->xoff = x0; m->yoff = y0;
+  m->size = sizeof(ml_mask) + size;
+  ml_cache_draw(g->info, m->pixels, m->w, m->h, pad, g->glyph, g->sx, g->sy, g->dx, g->dy, g->blur);
+  return m;
+}
+
+/* The mask of [key], rendered if no domain has it yet or is rendering it,
+ * in which case this waits for it.  Called from inside an epoch, the mask
+ * stays valid until the caller leaves it.  NULL if out of memory. */
+static ml_mask *ml_shared_fetch(ml_shared *c, ml_stripe *st, const unsigned *key, unsigned hash,
+                                ml_shared_glyph *g)
+{
+  ml_set *set = &c->sets[hash & (c->num_sets - 1)];
+  ml_slot *s;
+  ml_mask *m, *evicted = NULL;
+  int state;
+
+  for (;;)
+  {
+    if ((m = ml_shared_hit(st, set, key)) != NULL)
+      return m;
+    if (ml_shared_find(set, key, &state, &m) != NULL)
+    {
+      /* rendering elsewhere */
+      sched_yield();
+      continue;
+    }
+    ml_set_lock(set);
+    if (ml_shared_find(set, key, &state, &m) != NULL)
+    {
+      ml_set_unlock(set);
+      continue;
+    }
+    s = ml_shared_victim(set);
+    if (s && atomic_load_explicit(&s->state, memory_order_relaxed) == ML_SLOT_READY)
+    {
+      evicted = ml_slot_evict(c, s);
+      atomic_fetch_add(&c->evictions, 1);
+    }
+    if (s)
+      ml_slot_write(s, ML_SLOT_RENDERING, key, NULL);
+    ml_set_unlock(set);
+    break;
+  }
+  ml_shared_retire(c, evicted);
+  atomic_fetch_add_explicit(&st->misses, 1, memory_order_relaxed);
+
+  m = ml_shared_render(g);
+  if (s == NULL)
+  {
+    /* every slot of the set is being rendered: hand out an unpublished
+     * mask, which is freed after the caller leaves its epoch */
+    ml_shared_retire(c, m);
+    return m;
+  }
+
+  ml_set_lock(set);
+  ml_slot_write(s, m ? ML_SLOT_READY : ML_SLOT_EMPTY, key, m);
+  ml_set_unlock(set);
+  if (m)
+  {
+    atomic_fetch_add(&c->entries, 1);
+    if (atomic_fetch_add(&c->live, m->size) + m->size > c->budget)
+      ml_shared_trim(c);
+  }
+  return m;
+}
+
+static void ml_shared_key(ml_shared *c, long font, int glyph, float sx, float sy, float blur,
+                          float x, float y, unsigned *key, unsigned *hash, int *ix, int *iy,
+                          float *dx, float *dy)
+{
+  int bx, by;
+  ml_cache_snap(x, c->phases_x, ix, &bx);
+  ml_cache_snap(y, c->phases_y, iy, &by);
+  *dx = (float)bx / c->phases_x;
+  *dy = (float)by / c->phases_y;
+  key[0] = (unsigned)font;
+  key[1] = (unsigned)((unsigned long)font >> 16 >> 16);
+  key[2] = glyph;
+  memcpy(&key[3], &sx, 4);
+  memcpy(&key[4], &sy, 4);
+  key[5] = bx;
+  key[6] = by;
+  memcpy(&key[7], &blur, 4);
+  *hash = ml_cache_hash(font, glyph, sx, sy, bx, by, blur);
+}
+
+static void ml_shared_free(ml_shared *c)
+{
+  unsigned i;
+  int k;
+  for (i = 0; i < c->num_sets; ++i)
+    for (k = 0; k < ML_SHARED_WAYS; ++k)
+      free(atomic_load(&c->sets[i].ways[k].mask));
+  while (c->retired)
+  {
+    ml_mask *next = c->retired->next;
+    free(c->retired);
+    c->retired = next;
+  }
+  pthread_mutex_destroy(&c->retire_lock);
+  free(c->sets);
+  free(c);
+}
+
+static void shared_finalize(value v)
+{
+  ml_shared_free(Shared_val(v));
+}
+
+static struct custom_operations shared_custom_ops = {
+  .identifier  = "stbtt_shared_cache",
+  .finalize    = shared_finalize,
+  .compare     = custom_compare_default,
+  .hash        = custom_hash_default,
+  .serialize   = custom_serialize_default,
+  .deserialize = custom_deserialize_default
+};
+
+value ml_stbtt_shared_cache(value phases_x, value phases_y, value budget)
+{
+  CAMLparam3(phases_x, phases_y, budget);
+  CAMLlocal1(ret);
+
+  /* about one slot per 256 bytes of budget */
+  unsigned num_sets = 8, i;
+  ml_shared *c = calloc(1, sizeof(ml_shared));
+  while (num_sets < (1u << 17) && (long)num_sets * ML_SHARED_WAYS * 256 < Long_val(budget))
+    num_sets *= 2;
+  if (c == NULL || (c->sets = calloc(num_sets, sizeof(ml_set))) == NULL)
+  {
+    free(c);
+    caml_raise_out_of_memory();
+  }
+  for (i = 0; i < num_sets; ++i)
+    atomic_flag_clear(&c->sets[i].lock);
+  pthread_mutex_init(&c->retire_lock, NULL);
+  atomic_init(&c->epoch, 1);
+  c->num_sets = num_sets;
+  c->phases_x = Long_val(phases_x);
+  c->phases_y = Long_val(phases_y);
+  c->budget = Long_val(budget);
+
+  ret = caml_alloc_custom(&shared_custom_ops, sizeof(ml_shared *), 0, 1);
+  Shared_val(ret) = c;
+  CAMLreturn(ret);
+}
+
+value ml_stbtt_shared_cache_clear(value cache)
+{
+  ml_shared *c = Shared_val(cache);
+  unsigned i;
+  int k;
+  for (i = 0; i < c->num_sets; ++i)
+  {
+    ml_mask *evicted[ML_SHARED_WAYS];
+    int n = 0;
+    ml_set_lock(&c->sets[i]);
+    for (k = 0; k < ML_SHARED_WAYS; ++k)
+      if (atomic_load_explicit(&c->sets[i].ways[k].state, memory_order_relaxed) == ML_SLOT_READY)
+        evicted[n++] = ml_slot_evict(c, &c->sets[i].ways[k]);
+    ml_set_unlock(&c->sets[i]);
+    while (n > 0)
+      ml_shared_retire(c, evicted[--n]);
+  }
+  return Val_unit;
+}
+
+value ml_stbtt_shared_cache_stats(value cache)
+{
+  CAMLparam1(cache);
+  CAMLlocal1(ret);
+  ml_shared *c = Shared_val(cache);
+  long stats[5] = {0, 0, 0, 0, 0};
+  int i;
+
+  for (i = 0; i < ML_SHARED_STRIPES; ++i)
+  {
+    stats[0] += atomic_load_explicit(&c->stripes[i].hits, memory_order_relaxed);
+    stats[1] += atomic_load_explicit(&c->stripes[i].misses, memory_order_relaxed);
+  }
+  stats[2] = atomic_load(&c->evictions);
+  stats[3] = atomic_load(&c->entries);
+  stats[4] = atomic_load(&c->live);
+
+  ret = caml_alloc(5, 0);
+  for (i = 0; i < 5; ++i)
+    Store_field(ret, i, Val_long(stats[i]));
+  CAMLreturn(ret);
+}
+
+value ml_stbtt_shared_cache_get(value cache, value fontinfo, value glyph, value scale_x, value scale_y, value blur, value x, value y)
+{
+  CAMLparam5(cache, fontinfo, glyph, scale_x, scale_y);
+  CAMLxparam3(blur, x, y);
+  CAMLlocal3(ret, bitmap, ba);
+
+  ml_shared *c = Shared_val(cache);
+  stbtt_fontinfo info = *Fontinfo_val(fontinfo);
+  ml_scratch *scratch = ml_scratch_get();
+  ml_stripe *st = &c->stripes[scratch->stripe % ML_SHARED_STRIPES];
+  ml_shared_glyph g = { &info, Long_val(glyph), Double_val(scale_x), Double_val(scale_y),
+                        0, 0, Double_val(blur) };
+  unsigned key[ML_SHARED_KEY], hash;
+  int ix, iy, parity, w = 0, h = 0, xoff = 0, yoff = 0;
+  unsigned char *pixels = NULL;
+  ml_mask *m;
+  long dims[1];
+
+  info.userdata = scratch;
+  ml_shared_key(c, Long_val(Field(fontinfo, 1)), g.glyph, g.sx, g.sy, g.blur, Double_val(x), Double_val(y),
+                key, &hash, &ix, &iy, &g.dx, &g.dy);
+
+  parity = ml_shared_enter(c, st);
+  m = ml_shared_hit(st, &c->sets[hash & (c->num_sets - 1)], key);
+  if (m == NULL)
+  {
+    /* rendering, or waiting for another domain to render */
+    caml_release_runtime_system();
+    m = ml_shared_fetch(c, st, key, hash, &g);
+    caml_acquire_runtime_system();
+  }
+  /* Nothing may raise before the epoch is left */
+  if (m)
+  {
+    w = m->w; h = m->h;
+    xoff = m->xoff; yoff = m->yoff;
+  }
+  if ((pixels = malloc((size_t)w * h + 1)) != NULL && m)
+    memcpy(pixels, m->pixels, (size_t)w * h);
+  ml_shared_leave(st, parity);
+  if (pixels == NULL)
+    caml_raise_out_of_memory();
+
+  dims[0] = (long)w * h;
+  ba = caml_ba_alloc(CAML_BA_UINT8 | CAML_BA_C_LAYOUT | CAML_BA_MANAGED, 1, pixels, dims);
+  bitmap = caml_alloc(5, 0);
+  Store_field(bitmap, 0, ba);
+  Store_field(bitmap, 1, Val_int(w));
+  Store_field(bitmap, 2, Val_int(h));
+  Store_field(bitmap, 3, Val_int(xoff));
+  Store_field(bitmap, 4, Val_int(yoff));
+  ret = caml_alloc(3, 0);
+  Store_field(ret, 0, bitmap);
+  Store_field(ret, 1, Val_int(ix + xoff));
+  Store_field(ret, 2, Val_int(iy + yoff));
+  CAMLreturn(ret);
+}
+
+value ml_stbtt_shared_cache_get_bc(value *argv, int argn)
+{
+  if (argn != 8) abort();
+  return ml_stbtt_shared_cache_get(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7]);
+}
+
+value ml_stbtt_shared_cache_render_run(value cache, value fontinfo, value scale_x, value scale_y, value blur, value buffer, value offset, value gw, value gh, value stride, value run)
+{
+  CAMLparam5(cache, fontinfo, scale_x, scale_y, blur);
+  CAMLxparam5(buffer, offset, gw, gh, stride);
+  CAMLxparam1(run);
+
+  ml_shared *c = Shared_val(cache);
+  stbtt_fontinfo info = *Fontinfo_val(fontinfo);
+  ml_scratch *scratch = ml_scratch_get();
+  ml_stripe *st = &c->stripes[scratch->stripe % ML_SHARED_STRIPES];
+  stbtt_run_glyph *glyphs = ml_run_glyphs(scratch, run);
+  int n = Wosize_val(run), w = Long_val(gw), h = Long_val(gh), i, x, y, ox, oy;
+  long s = Long_val(stride), font = Long_val(Field(fontinfo, 1));
+  ml_shared_glyph g = { &info, 0, Double_val(scale_x), Double_val(scale_y),
+                        0, 0, Double_val(blur) };
+  unsigned char *output = (unsigned char *)Caml_ba_data_val(buffer) + Long_val(offset);
+
+  info.userdata = scratch;
+  /* same origin as stbtt_MakeRunBitmap */
+  stbtt_GetRunBitmapBox(&info, glyphs, n, g.sx, g.sy, &ox, &oy, 0, 0);
+  caml_release_runtime_system();
+  for (y = 0; y < h; ++y)
+    memset(output + y * s, 0, w);
+  for (i = 0; i < n; ++i)
+  {
+    unsigned key[ML_SHARED_KEY], hash;
+    int ix, iy, parity;
+    ml_mask *m;
+    g.glyph = glyphs[i].glyph;
+    ml_shared_key(c, font, g.glyph, g.sx, g.sy, g.blur, glyphs[i].x, glyphs[i].y,
+                  key, &hash, &ix, &iy, &g.dx, &g.dy);
+    parity = ml_shared_enter(c, st);
+    m = ml_shared_fetch(c, st, key, hash, &g);
+    if (m)
+    {
+      ix += m->xoff - ox;
+      iy += m->yoff - oy;
+      for (y = 0; y < m->h; ++y)
+      {
+        if (iy + y < 0 || iy + y >= h) continue;
+        for (x = 0; x < m->w; ++x)
+        {
+          int v;
+          if (ix + x < 0 || ix + x >= w) continue;
+          v = output[(iy + y) * s + ix + x] + m->pixels[y * m->w + x];
+          output[(iy + y) * s + ix + x] = (unsigned char)(v > 255 ? 255 : v);
+        }
+      }
+    }
+    ml_shared_leave(st, parity);
+  }
+  caml_acquire_runtime_system();
+
+  CAMLreturn(Val_unit);
+}
+
+value ml_stbtt_shared_cache_render_run_bc(value *argv, int argn)
+{
+  if (argn != 11) abort();
+  return ml_stbtt_shared_cache_render_run(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5], argv[6], argv[7], argv[8], argv[9], argv[10]);
 }
@@ -14,7 +14,6 @@
 //        cleartype-style AA?
 //        optimize: use simple memory allocator for intermediates
 //        optimize: build edge-list directly from curves
-//        optimize: rasterize directly from curves?
 //
 // ADDITIONAL CONTRIBUTORS
 //
@@ -116,6 +115,18 @@
 //        #define STBTT_RASTERIZER_VERSION 1
 //   which will incur about a 15% speed hit.
 //
+//   A third rasterizer computes the same exact-area coverage in 16.16 fixed
+//   point with integer accumulation, without sorting the edges:
+//        #define STBTT_RASTERIZER_VERSION 3
+//   It stays within a couple of levels of the default one.
+//
+//   With the new rasterizer you can also
+//        #define STBTT_RASTERIZE_CURVES
+//   to rasterize straight from the glyph outline instead of flattening it
+//   into line segments first. Curves are then followed within each scanline
+//   to the requested flatness, which is more accurate at the same flatness
+//   and uses fewer intermediate buffers, but costs more per scanline.
+//
 // ADDITIONAL DOCUMENTATION
 //
 //   Immediately after this block comment are a series of sample programs.
@@ -701,6 +712,12 @@ STBTT_DEF void stbtt_GetCodepointHMetrics(const stbtt_fontinfo *info, int codepo
 STBTT_DEF int  stbtt_GetCodepointKernAdvance(const stbtt_fontinfo *info, int ch1, int ch2);
 // an additional amount to add to the 'advance' value between ch1 and ch2
 
+STBTT_DEF int  stbtt_GetFontMonospaceAdvance(const stbtt_fontinfo *info);
+// the advanceWidth shared by the glyphs of a monospace font, one that lists
+// a single advance in its 'hmtx' table or is marked fixed pitch in 'post'
+// or 'OS/2'; 0 for other fonts. layout with such a font is pure arithmetic, without
+// looking up any glyph.
+
 STBTT_DEF int stbtt_GetCodepointBox(const stbtt_fontinfo *info, int codepoint, int *x0, int *y0, int *x1, int *y1);
 // Gets the bounding box of the visible part of the glyph, in unscaled coordinates
 
@@ -803,6 +820,93 @@ STBTT_DEF void stbtt_MakeGlyphBitmapSubpixel(const stbtt_fontinfo *info, unsigne
 STBTT_DEF void stbtt_GetGlyphBitmapBox(const stbtt_fontinfo *font, int glyph, float scale_x, float scale_y, int *ix0, int *iy0, int *ix1, int *iy1);
 STBTT_DEF void stbtt_GetGlyphBitmapBoxSubpixel(const stbtt_fontinfo *font, int glyph, float scale_x, float scale_y,float shift_x, float shift_y, int *ix0, int *iy0, int *ix1, int *iy1);
 
+STBTT_DEF void stbtt_MakeGlyphBitmapTile(const stbtt_fontinfo *info, unsigned char *output, int tile_x, int tile_y, int tile_w, int tile_h, int out_stride, float scale_x, float scale_y, float shift_x, float shift_y, int glyph);
+// draws the tile_w x tile_h pixels at (tile_x,tile_y) of the bitmap that
+// stbtt_MakeGlyphBitmapSubpixel would draw, relative to its top-left corner.
+// memory use depends on the tile and the outline, not on the size of the
+// whole bitmap, so a giant glyph can be streamed out tile by tile.
+
+STBTT_DEF void stbtt_GetGlyphBitmapBoxTransform(const stbtt_fontinfo *font, int glyph, const float transform[6], int *ix0, int *iy0, int *ix1, int *iy1);
+STBTT_DEF void stbtt_MakeGlyphBitmapTransform(const stbtt_fontinfo *info, unsigned char *output, int out_w, int out_h, int out_stride, const float transform[6], int glyph);
+// same as the Subpixel functions, but the glyph is mapped to the bitmap by
+// an arbitrary affine transform {a,b,c,d,e,f}, which takes the point (x,y)
+// of the outline in font units (y up) to (a*x+b*y+c, d*x+e*y+f) in pixels
+// (y down). {scale_x,0,shift_x, 0,-scale_y,shift_y} is the same as the
+// Subpixel call; rotations, shears and mirrored glyphs rasterize directly
+// from the outline, without resampling an upright bitmap. the box is that
+// of the transformed glyph bounding box, so it can be a little loose.
+
+typedef struct
+{
+   int glyph;
+   float x,y;              // origin of the glyph in pixels, y down
+} stbtt_run_glyph;
+
+STBTT_DEF void stbtt_GetRunBitmapBox(const stbtt_fontinfo *font, const stbtt_run_glyph *glyphs, int num_glyphs, float scale_x, float scale_y, int *ix0, int *iy0, int *ix1, int *iy1);
+STBTT_DEF void stbtt_MakeRunBitmap(const stbtt_fontinfo *info, unsigned char *output, int out_w, int out_h, int out_stride, float scale_x, float scale_y, const stbtt_run_glyph *glyphs, int num_glyphs);
+// renders a laid-out run of glyphs, e.g. a line of text, into one bitmap
+// whose top-left corner is the top-left corner of stbtt_GetRunBitmapBox.
+// with rasterizers 2 and 3 the edges of all the glyphs go into one list
+// that is rasterized in a single sweep, so there is no per-glyph setup and
+// overlapping glyphs merge like overlapping contours of a single glyph,
+// with no compositing. the other rasterizers draw the glyphs one by one
+// and add them up.
+
+typedef struct
+{
+   int y,x0,x1;            // pixels x0..x1-1 of row y of the glyph bitmap
+   unsigned char coverage; // the same for all of them; 255 inside the glyph
+} stbtt_span;
+
+STBTT_DEF stbtt_span *stbtt_GetGlyphSpans(const stbtt_fontinfo *info, float scale_x, float scale_y, float shift_x, float shift_y, int glyph, int *num_spans, int *width, int *height, int *xoff, int *yoff);
+// same as stbtt_GetGlyphBitmapSubpixel, but the bitmap comes out as runs of
+// equal coverage, row by row and left to right, with the empty ones left
+// out. interiors become long spans of 255 that can be filled without
+// blending, and most other spans are the antialiased pixels of the outline.
+// the default rasterizer emits them while it sweeps, without a bitmap.
+// returns NULL if there are no spans, or if it runs out of memory; then
+// *num_spans is 0, or -1 respectively.
+
+STBTT_DEF void stbtt_FreeSpans(stbtt_span *spans, void *userdata);
+
+STBTT_DEF int stbtt_MakeBoxDrawingBitmap(unsigned char *output, int out_w, int out_h, int out_stride, int codepoint);
+// draws the block element or box drawing character codepoint so that it
+// fills a terminal cell of out_w x out_h pixels, without a font. drawn this
+// way, the lines and blocks of neighbouring cells join exactly at any size,
+// which font outlines designed for one cell shape rarely do. covers the
+// blocks U+2580..U+259F and the light and heavy lines and dashes of
+// U+2500..U+257F; returns 0 without drawing for anything else (double
+// lines, arcs, diagonals), which is left to the font.
+
+typedef struct
+{
+   int glyph;
+   unsigned char *output;  // where to draw the glyph, with the batch's stride
+   int w,h;                // clips the bitmap like out_w/out_h
+} stbtt_batch_glyph;
+
+STBTT_DEF void stbtt_MakeGlyphBitmapBatch(const stbtt_fontinfo *info, stbtt_batch_glyph *glyphs, int num_glyphs, int out_stride, float scale_x, float scale_y);
+// same as calling stbtt_MakeGlyphBitmap for each of the glyphs, but with
+// the default rasterizer it draws up to 16 glyphs side by side in a single
+// scanline sweep, which saves most of the per-glyph and per-row cost of
+// small glyphs. meant for glyphs of a few dozen pixels at most; the pack
+// functions use it for glyphs up to STBTT_BATCH_MAX_SIZE pixels.
+
+typedef struct
+{
+   float shift_x, shift_y;
+   unsigned char *output;  // the box of the glyph at this shift, with the phases' stride
+   int w,h;                // clips the bitmap like out_w/out_h
+} stbtt_glyph_phase;
+
+STBTT_DEF void stbtt_MakeGlyphBitmapPhases(const stbtt_fontinfo *info, stbtt_glyph_phase *phases, int num_phases, int out_stride, float scale_x, float scale_y, int glyph);
+// same as calling stbtt_MakeGlyphBitmapSubpixel for each of the shifts,
+// with output at the top-left corner of stbtt_GetGlyphBitmapBoxSubpixel for
+// that shift. a shift moves every edge by the same amount, which keeps
+// their order, so the outline is decoded, flattened and sorted once and
+// only the scanline pass runs for each phase. for prerendering the
+// subpixel positions of a glyph cache.
+
 
 // @TODO: don't expose this structure
 typedef struct
@@ -945,12 +1049,34 @@ typedef int stbtt__test_oversample_pow2[(STBTT_MAX_OVERSAMPLE & (STBTT_MAX_OVERS
 #define STBTT_RASTERIZER_VERSION 2
 #endif
 
+// glyphs whose bitmap is at most this many pixels wide and tall are packed
+// with stbtt_MakeGlyphBitmapBatch(); 0 renders them one at a time
+#ifndef STBTT_BATCH_MAX_SIZE
+#define STBTT_BATCH_MAX_SIZE   32
+#endif
+
 #ifdef _MSC_VER
 #define STBTT__NOTUSED(v)  (void)(v)
 #else
 #define STBTT__NOTUSED(v)  (void)sizeof(v)
 #endif
 
+// SIMD kernels for the scanline rasterizer; #define STBTT_NO_SIMD to disable.
+// AVX2 is only compiled with gcc/clang and selected at runtime.
+#ifndef STBTT_NO_SIMD
+   #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+      #define STBTT__SSE2
+      #include <emmintrin.h>
+      #if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+         #define STBTT__AVX2
+         #include <immintrin.h>
+      #endif
+   #elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+      #define STBTT__NEON
+      #include <arm_neon.h>
+   #endif
+#endif
+
 //////////////////////////////////////////////////////////////////////////
 //
 // accessors to parse data from file
@@ -1475,6 +1601,21 @@ STBTT_DEF void stbtt_GetGlyphHMetrics(const stbtt_fontinfo *info, int glyph_inde
    }
 }
 
+STBTT_DEF int  stbtt_GetFontMonospaceAdvance(const stbtt_fontinfo *info)
+{
+   stbtt_uint16 numOfLongHorMetrics = ttUSHORT(info->data+info->hhea + 34);
+   stbtt_uint32 post = stbtt__find_table(info->data, info->fontstart, "post");
+   stbtt_uint32 os2  = stbtt__find_table(info->data, info->fontstart, "OS/2");
+   // the glyphs past the last long metric share its advance. monospace fonts
+   // list a single one, or list a few odd glyphs first and say they are
+   // monospace with isFixedPitch or their PANOSE proportion
+   if (numOfLongHorMetrics == 1
+       || (post && ttULONG(info->data + post + 12) != 0)
+       || (os2 && info->data[os2 + 32] == 2 && info->data[os2 + 35] == 9))
+      return ttUSHORT(info->data + info->hmtx + 4*(numOfLongHorMetrics-1));
+   return 0;
+}
+
 STBTT_DEF int  stbtt_GetGlyphKernAdvance(const stbtt_fontinfo *info, int glyph1, int glyph2)
 {
    stbtt_uint8 *data = info->data + info->kern;
@@ -1572,6 +1713,34 @@ STBTT_DEF void stbtt_GetGlyphBitmapBoxSubpixel(const stbtt_fontinfo *font, int g
    }
 }
 
+STBTT_DEF void stbtt_GetGlyphBitmapBoxTransform(const stbtt_fontinfo *font, int glyph, const float transform[6], int *ix0, int *iy0, int *ix1, int *iy1)
+{
+   int x0=0,y0=0,x1,y1,i;
+   if (!stbtt_GetGlyphBox(font, glyph, &x0,&y0,&x1,&y1)) {
+      if (ix0) *ix0 = 0;
+      if (iy0) *iy0 = 0;
+      if (ix1) *ix1 = 0;
+      if (iy1) *iy1 = 0;
+   } else {
+      // the outline lies inside its box, so it maps inside the box's image
+      float min_x=0,min_y=0,max_x=0,max_y=0;
+      for (i=0; i < 4; ++i) {
+         float x = (float) (i & 1 ? x1 : x0);
+         float y = (float) (i & 2 ? y1 : y0);
+         float tx = x * transform[0] + y * transform[1] + transform[2];
+         float ty = x * transform[3] + y * transform[4] + transform[5];
+         if (i == 0 || tx < min_x) min_x = tx;
+         if (i == 0 || tx > max_x) max_x = tx;
+         if (i == 0 || ty < min_y) min_y = ty;
+         if (i == 0 || ty > max_y) max_y = ty;
+      }
+      if (ix0) *ix0 = STBTT_ifloor(min_x);
+      if (iy0) *iy0 = STBTT_ifloor(min_y);
+      if (ix1) *ix1 = STBTT_iceil (max_x);
+      if (iy1) *iy1 = STBTT_iceil (max_y);
+   }
+}
+
 STBTT_DEF void stbtt_GetGlyphBitmapBox(const stbtt_fontinfo *font, int glyph, float scale_x, float scale_y, int *ix0, int *iy0, int *ix1, int *iy1)
 {
    stbtt_GetGlyphBitmapBoxSubpixel(font, glyph, scale_x, scale_y,0.0f,0.0f, ix0, iy0, ix1, iy1);
@@ -1591,6 +1760,7 @@ STBTT_DEF void stbtt_GetCodepointBitmapBox(const stbtt_fontinfo *font, int codep
 //
 //  Rasterizer
 
+#if STBTT_RASTERIZER_VERSION == 1
 typedef struct stbtt__hheap_chunk
 {
    struct stbtt__hheap_chunk *next;
@@ -1639,12 +1809,53 @@ static void stbtt__hheap_cleanup(stbtt__hheap *hh, void *userdata)
       c = n;
    }
 }
+#endif
 
 typedef struct stbtt__edge {
    float x0,y0, x1,y1;
    int invert;
 } stbtt__edge;
 
+typedef struct
+{
+   stbtt_span *spans;
+   int count, capacity, error;
+   unsigned char *row;     // the row being turned into spans
+   void *userdata;
+} stbtt__span_list;
+
+// append the non-empty runs of one row of pixels
+static void stbtt__emit_spans(stbtt__span_list *list, int y, const unsigned char *row, int w)
+{
+   int x = 0;
+   while (x < w) {
+      int x0 = x;
+      unsigned char c = row[x];
+      while (++x < w && row[x] == c)
+         ;
+      if (c == 0 || list->error)
+         continue;
+      if (list->count == list->capacity) {
+         int capacity = list->capacity ? list->capacity*2 : 64;
+         stbtt_span *spans = (stbtt_span *) STBTT_malloc(sizeof(*spans) * capacity, list->userdata);
+         if (spans == NULL) {
+            list->error = 1;
+            continue;
+         }
+         if (list->count)
+            STBTT_memcpy(spans, list->spans, sizeof(*spans) * list->count);
+         STBTT_free(list->spans, list->userdata);
+         list->spans = spans;
+         list->capacity = capacity;
+      }
+      list->spans[list->count].y = y;
+      list->spans[list->count].x0 = x0;
+      list->spans[list->count].x1 = x;
+      list->spans[list->count].coverage = c;
+      ++list->count;
+   }
+}
+
 
 typedef struct stbtt__active_edge
 {
@@ -1658,6 +1869,8 @@ typedef struct stbtt__active_edge
    float direction;
    float sy;
    float ey;
+   #elif STBTT_RASTERIZER_VERSION==3
+   // not used; the fixed-point rasterizer draws each edge on its own
    #else
    #error "Unrecognized value of STBTT_RASTERIZER_VERSION"
    #endif
@@ -1690,23 +1903,72 @@ static stbtt__active_edge *stbtt__new_active(stbtt__hheap *hh, stbtt__edge *e, i
    return z;
 }
 #elif STBTT_RASTERIZER_VERSION == 2
-static stbtt__active_edge *stbtt__new_active(stbtt__hheap *hh, stbtt__edge *e, int off_x, float start_point, void *userdata)
+// the active edge table is kept as parallel arrays, in insertion order, so
+// that advancing the edges vectorizes and removal is a single compaction pass
+typedef struct
+{
+   float *fx, *fdx, *fdy, *direction, *sy, *ey;
+   int count;
+} stbtt__active_table;
+
+#define STBTT__ACTIVE_FIELDS  6
+
+// 'storage' holds STBTT__ACTIVE_FIELDS*capacity floats
+static void stbtt__active_table_init(stbtt__active_table *t, float *storage, int capacity)
+{
+   t->fx        = storage;
+   t->fdx       = storage + capacity;
+   t->fdy       = storage + capacity*2;
+   t->direction = storage + capacity*3;
+   t->sy        = storage + capacity*4;
+   t->ey        = storage + capacity*5;
+   t->count     = 0;
+}
+
+static void stbtt__active_table_add(stbtt__active_table *t, stbtt__edge *e, int off_x, float start_point)
 {
-   stbtt__active_edge *z = (stbtt__active_edge *) stbtt__hheap_alloc(hh, sizeof(*z), userdata);
    float dxdy = (e->x1 - e->x0) / (e->y1 - e->y0);
-   STBTT_assert(z != NULL);
+   int i = t->count++;
    //STBTT_assert(e->y0 <= start_point);
-   if (!z) return z;
-   z->fdx = dxdy;
-   z->fdy = dxdy != 0.0f ? (1.0f/dxdy) : 0.0f;
-   z->fx = e->x0 + dxdy * (start_point - e->y0);
-   z->fx -= off_x;
-   z->direction = e->invert ? 1.0f : -1.0f;
-   z->sy = e->y0;
-   z->ey = e->y1;
-   z->next = 0;
-   return z;
+   t->fdx[i] = dxdy;
+   t->fdy[i] = dxdy != 0.0f ? (1.0f/dxdy) : 0.0f;
+   t->fx[i] = e->x0 + dxdy * (start_point - e->y0);
+   t->fx[i] -= off_x;
+   t->direction[i] = e->invert ? 1.0f : -1.0f;
+   t->sy[i] = e->y0;
+   t->ey[i] = e->y1;
+}
+
+// remove all edges that terminate at or above y, keeping the rest in order
+static void stbtt__active_table_prune(stbtt__active_table *t, float y)
+{
+   int i, k = 0;
+   for (i=0; i < t->count; ++i) {
+      if (t->ey[i] > y) {
+         if (k != i) {
+            t->fx[k] = t->fx[i];
+            t->fdx[k] = t->fdx[i];
+            t->fdy[k] = t->fdy[i];
+            t->direction[k] = t->direction[i];
+            t->sy[k] = t->sy[i];
+            t->ey[k] = t->ey[i];
+         }
+         ++k;
+      } else
+         STBTT_assert(t->direction[i]);
+   }
+   t->count = k;
+}
+
+static void stbtt__active_table_advance(stbtt__active_table *t)
+{
+   float *fx = t->fx, *fdx = t->fdx;
+   int i, count = t->count;
+   for (i=0; i < count; ++i)
+      fx[i] += fdx[i]; // advance to position for next scanline
 }
+#elif STBTT_RASTERIZER_VERSION == 3
+// no active edge table
 #else
 #error "Unrecognized value of STBTT_RASTERIZER_VERSION"
 #endif
@@ -1898,263 +2160,720 @@ static void stbtt__handle_clipped_edge(float *scanline, int x, stbtt__active_edg
    }
 }
 
-static void stbtt__fill_active_edges_new(float *scanline, float *scanline_fill, int len, stbtt__active_edge *e, float y_top)
+// columns touched by the active edges are tracked in granules of 16 pixels;
+// untouched granules need neither clearing nor accumulation
+#define STBTT__GRANULE_SHIFT  4
+#define STBTT__GRANULES(w)    (((w) >> STBTT__GRANULE_SHIFT) + 1)
+
+// mark columns x0..x1 (inclusive) of scanline or scanline2 as touched
+static void stbtt__touch(unsigned char *touched, int x0, int x1)
+{
+   int g0 = x0 >> STBTT__GRANULE_SHIFT, g1 = x1 >> STBTT__GRANULE_SHIFT;
+   while (g0 <= g1)
+      touched[g0++] = 1;
+}
+
+static void stbtt__fill_active_edge_new(float *scanline, float *scanline_fill, unsigned char *touched, int len, stbtt__active_edge *e, float y_top)
 {
    float y_bottom = y_top+1;
 
-   while (e) {
-      // brute force every pixel
+   // brute force every pixel
 
-      // compute intersection points with top & bottom
-      STBTT_assert(e->ey >= y_top);
+   // compute intersection points with top & bottom
+   STBTT_assert(e->ey >= y_top);
 
-      if (e->fdx == 0) {
-         float x0 = e->fx;
-         if (x0 < len) {
-            if (x0 >= 0) {
-               stbtt__handle_clipped_edge(scanline,(int) x0,e, x0,y_top, x0,y_bottom);
-               stbtt__handle_clipped_edge(scanline_fill-1,(int) x0+1,e, x0,y_top, x0,y_bottom);
-            } else {
-               stbtt__handle_clipped_edge(scanline_fill-1,0,e, x0,y_top, x0,y_bottom);
-            }
+   if (e->fdx == 0) {
+      float x0 = e->fx;
+      if (x0 < len) {
+         if (x0 >= 0) {
+            stbtt__handle_clipped_edge(scanline,(int) x0,e, x0,y_top, x0,y_bottom);
+            stbtt__handle_clipped_edge(scanline_fill-1,(int) x0+1,e, x0,y_top, x0,y_bottom);
+            stbtt__touch(touched, (int) x0, (int) x0+1);
+         } else {
+            stbtt__handle_clipped_edge(scanline_fill-1,0,e, x0,y_top, x0,y_bottom);
+            stbtt__touch(touched, 0, 0);
          }
+      }
+   } else {
+      float x0 = e->fx;
+      float dx = e->fdx;
+      float xb = x0 + dx;
+      float x_top, x_bottom;
+      float sy0,sy1;
+      float dy = e->fdy;
+      STBTT_assert(e->sy <= y_bottom && e->ey >= y_top);
+
+      // compute endpoints of line segment clipped to this scanline (if the
+      // line segment starts on this scanline. x0 is the intersection of the
+      // line with y_top, but that may be off the line segment.
+      if (e->sy > y_top) {
+         x_top = x0 + dx * (e->sy - y_top);
+         sy0 = e->sy;
+      } else {
+         x_top = x0;
+         sy0 = y_top;
+      }
+      if (e->ey < y_bottom) {
+         x_bottom = x0 + dx * (e->ey - y_top);
+         sy1 = e->ey;
       } else {
-         float x0 = e->fx;
-         float dx = e->fdx;
-         float xb = x0 + dx;
-         float x_top, x_bottom;
-         float sy0,sy1;
-         float dy = e->fdy;
-         STBTT_assert(e->sy <= y_bottom && e->ey >= y_top);
-
-         // compute endpoints of line segment clipped to this scanline (if the
-         // line segment starts on this scanline. x0 is the intersection of the
-         // line with y_top, but that may be off the line segment.
-         if (e->sy > y_top) {
-            x_top = x0 + dx * (e->sy - y_top);
-            sy0 = e->sy;
+         x_bottom = xb;
+         sy1 = y_bottom;
+      }
+
+      if (x_top >= 0 && x_bottom >= 0 && x_top < len && x_bottom < len) {
+         // from here on, we don't have to range check x values
+
+         if ((int) x_top == (int) x_bottom) {
+            float height;
+            // simple case, only spans one pixel
+            int x = (int) x_top;
+            height = sy1 - sy0;
+            STBTT_assert(x >= 0 && x < len);
+            scanline[x] += e->direction * (1-((x_top - x) + (x_bottom-x))/2)  * height;
+            scanline_fill[x] += e->direction * height; // everything right of this pixel is filled
+            stbtt__touch(touched, x, x+1);
          } else {
-            x_top = x0;
-            sy0 = y_top;
+            int x,x1,x2;
+            float y_crossing, step, sign, area;
+            // covers 2+ pixels
+            if (x_top > x_bottom) {
+               // flip scanline vertically; signed area is the same
+               float t;
+               sy0 = y_bottom - (sy0 - y_top);
+               sy1 = y_bottom - (sy1 - y_top);
+               t = sy0, sy0 = sy1, sy1 = t;
+               t = x_bottom, x_bottom = x_top, x_top = t;
+               dx = -dx;
+               dy = -dy;
+               t = x0, x0 = xb, xb = t;
+            }
+
+            x1 = (int) x_top;
+            x2 = (int) x_bottom;
+            // compute intersection with y axis at x1+1
+            y_crossing = (x1+1 - x0) * dy + y_top;
+
+            sign = e->direction;
+            // area of the rectangle covered from y0..y_crossing
+            area = sign * (y_crossing-sy0);
+            // area of the triangle (x_top,y0), (x+1,y0), (x+1,y_crossing)
+            scanline[x1] += area * (1-((x_top - x1)+(x1+1-x1))/2);
+
+            step = sign * dy;
+            for (x = x1+1; x < x2; ++x) {
+               scanline[x] += area + step/2;
+               area += step;
+            }
+            y_crossing += dy * (x2 - (x1+1));
+
+            STBTT_assert(STBTT_fabs(area) <= 1.01f);
+
+            scanline[x2] += area + sign * (1-((x2-x2)+(x_bottom-x2))/2) * (sy1-y_crossing);
+
+            scanline_fill[x2] += sign * (sy1-sy0);
+            stbtt__touch(touched, x1, x2+1);
          }
-         if (e->ey < y_bottom) {
-            x_bottom = x0 + dx * (e->ey - y_top);
-            sy1 = e->ey;
-         } else {
-            x_bottom = xb;
-            sy1 = y_bottom;
+      } else {
+         // if edge goes outside of box we're drawing, we require
+         // clipping logic. since this does not match the intended use
+         // of this library, we use a different, very slow brute
+         // force implementation
+         int x;
+         stbtt__touch(touched, 0, len-1);
+         for (x=0; x < len; ++x) {
+            // cases:
+            //
+            // there can be up to two intersections with the pixel. any intersection
+            // with left or right edges can be handled by splitting into two (or three)
+            // regions. intersections with top & bottom do not necessitate case-wise logic.
+            //
+            // the old way of doing this found the intersections with the left & right edges,
+            // then used some simple logic to produce up to three segments in sorted order
+            // from top-to-bottom. however, this had a problem: if an x edge was epsilon
+            // across the x border, then the corresponding y position might not be distinct
+            // from the other y segment, and it might ignored as an empty segment. to avoid
+            // that, we need to explicitly produce segments based on x positions.
+
+            // rename variables to clear pairs
+            float y0 = y_top;
+            float x1 = (float) (x);
+            float x2 = (float) (x+1);
+            float x3 = xb;
+            float y3 = y_bottom;
+            float y1,y2;
+
+            // x = e->x + e->dx * (y-y_top)
+            // (y-y_top) = (x - e->x) / e->dx
+            // y = (x - e->x) / e->dx + y_top
+            y1 = (x - x0) / dx + y_top;
+            y2 = (x+1 - x0) / dx + y_top;
+
+            if (x0 < x1 && x3 > x2) {         // three segments descending down-right
+               stbtt__handle_clipped_edge(scanline,x,e, x0,y0, x1,y1);
+               stbtt__handle_clipped_edge(scanline,x,e, x1,y1, x2,y2);
+               stbtt__handle_clipped_edge(scanline,x,e, x2,y2, x3,y3);
+            } else if (x3 < x1 && x0 > x2) {  // three segments descending down-left
+               stbtt__handle_clipped_edge(scanline,x,e, x0,y0, x2,y2);
+               stbtt__handle_clipped_edge(scanline,x,e, x2,y2, x1,y1);
+               stbtt__handle_clipped_edge(scanline,x,e, x1,y1, x3,y3);
+            } else if (x0 < x1 && x3 > x1) {  // two segments across x, down-right
+               stbtt__handle_clipped_edge(scanline,x,e, x0,y0, x1,y1);
+               stbtt__handle_clipped_edge(scanline,x,e, x1,y1, x3,y3);
+            } else if (x3 < x1 && x0 > x1) {  // two segments across x, down-left
+               stbtt__handle_clipped_edge(scanline,x,e, x0,y0, x1,y1);
+               stbtt__handle_clipped_edge(scanline,x,e, x1,y1, x3,y3);
+            } else if (x0 < x2 && x3 > x2) {  // two segments across x+1, down-right
+               stbtt__handle_clipped_edge(scanline,x,e, x0,y0, x2,y2);
+               stbtt__handle_clipped_edge(scanline,x,e, x2,y2, x3,y3);
+            } else if (x3 < x2 && x0 > x2) {  // two segments across x+1, down-left
+               stbtt__handle_clipped_edge(scanline,x,e, x0,y0, x2,y2);
+               stbtt__handle_clipped_edge(scanline,x,e, x2,y2, x3,y3);
+            } else {  // one segment
+               stbtt__handle_clipped_edge(scanline,x,e, x0,y0, x3,y3);
+            }
          }
+      }
+   }
+}
 
-         if (x_top >= 0 && x_bottom >= 0 && x_top < len && x_bottom < len) {
-            // from here on, we don't have to range check x values
-
-            if ((int) x_top == (int) x_bottom) {
-               float height;
-               // simple case, only spans one pixel
-               int x = (int) x_top;
-               height = sy1 - sy0;
-               STBTT_assert(x >= 0 && x < len);
-               scanline[x] += e->direction * (1-((x_top - x) + (x_bottom-x))/2)  * height;
-               scanline_fill[x] += e->direction * height; // everything right of this pixel is filled
-            } else {
-               int x,x1,x2;
-               float y_crossing, step, sign, area;
-               // covers 2+ pixels
-               if (x_top > x_bottom) {
-                  // flip scanline vertically; signed area is the same
-                  float t;
-                  sy0 = y_bottom - (sy0 - y_top);
-                  sy1 = y_bottom - (sy1 - y_top);
-                  t = sy0, sy0 = sy1, sy1 = t;
-                  t = x_bottom, x_bottom = x_top, x_top = t;
-                  dx = -dx;
-                  dy = -dy;
-                  t = x0, x0 = xb, xb = t;
-               }
+static void stbtt__fill_active_edges_new(float *scanline, float *scanline_fill, unsigned char *touched, int len, stbtt__active_table *t, float y_top)
+{
+   int i;
+   // newest edges first, as the linked list used to visit them
+   for (i=t->count-1; i >= 0; --i) {
+      stbtt__active_edge e;
+      e.fx = t->fx[i];
+      e.fdx = t->fdx[i];
+      e.fdy = t->fdy[i];
+      e.direction = t->direction[i];
+      e.sy = t->sy[i];
+      e.ey = t->ey[i];
+      stbtt__fill_active_edge_new(scanline, scanline_fill, touched, len, &e, y_top);
+   }
+}
 
-               x1 = (int) x_top;
-               x2 = (int) x_bottom;
-               // compute intersection with y axis at x1+1
-               y_crossing = (x1+1 - x0) * dy + y_top;
-
-               sign = e->direction;
-               // area of the rectangle covered from y0..y_crossing
-               area = sign * (y_crossing-sy0);
-               // area of the triangle (x_top,y0), (x+1,y0), (x+1,y_crossing)
-               scanline[x1] += area * (1-((x_top - x1)+(x1+1-x1))/2);
-
-               step = sign * dy;
-               for (x = x1+1; x < x2; ++x) {
-                  scanline[x] += area + step/2;
-                  area += step;
-               }
-               y_crossing += dy * (x2 - (x1+1));
+// convert one row of accumulated coverage to 8-bit pixels:
+//    out[i] = min(255, |scanline[i] + scanline2[0] + ... + scanline2[i]| * 255)
+// with 'sum' carried in from the left. scanline and scanline2 are zeroed as
+// they are consumed, so they are ready for the next row. returns the running
+// sum at the end of the row.
+typedef float stbtt__accumulate_func(unsigned char *out, float *scanline, float *scanline2, int len, float sum);
 
-               STBTT_assert(STBTT_fabs(area) <= 1.01f);
+static float stbtt__accumulate_scalar(unsigned char *out, float *scanline, float *scanline2, int len, float sum)
+{
+   int i;
+   for (i=0; i < len; ++i) {
+      float k;
+      int m;
+      sum += scanline2[i];
+      k = scanline[i] + sum;
+      k = (float) STBTT_fabs(k)*255 + 0.5f;
+      m = (int) k;
+      if (m > 255) m = 255;
+      out[i] = (unsigned char) m;
+      scanline[i] = scanline2[i] = 0;
+   }
+   return sum;
+}
 
-               scanline[x2] += area + sign * (1-((x2-x2)+(x_bottom-x2))/2) * (sy1-y_crossing);
+// value of the pixels where neither scanline nor scanline2 was written
+static unsigned char stbtt__coverage(float sum)
+{
+   int m = (int) ((float) STBTT_fabs(sum)*255 + 0.5f);
+   return (unsigned char) (m > 255 ? 255 : m);
+}
 
-               scanline_fill[x2] += sign * (sy1-sy0);
-            }
-         } else {
-            // if edge goes outside of box we're drawing, we require
-            // clipping logic. since this does not match the intended use
-            // of this library, we use a different, very slow brute
-            // force implementation
-            int x;
-            for (x=0; x < len; ++x) {
-               // cases:
-               //
-               // there can be up to two intersections with the pixel. any intersection
-               // with left or right edges can be handled by splitting into two (or three)
-               // regions. intersections with top & bottom do not necessitate case-wise logic.
-               //
-               // the old way of doing this found the intersections with the left & right edges,
-               // then used some simple logic to produce up to three segments in sorted order
-               // from top-to-bottom. however, this had a problem: if an x edge was epsilon
-               // across the x border, then the corresponding y position might not be distinct
-               // from the other y segment, and it might ignored as an empty segment. to avoid
-               // that, we need to explicitly produce segments based on x positions.
-
-               // rename variables to clear pairs
-               float y0 = y_top;
-               float x1 = (float) (x);
-               float x2 = (float) (x+1);
-               float x3 = xb;
-               float y3 = y_bottom;
-               float y1,y2;
-
-               // x = e->x + e->dx * (y-y_top)
-               // (y-y_top) = (x - e->x) / e->dx
-               // y = (x - e->x) / e->dx + y_top
-               y1 = (x - x0) / dx + y_top;
-               y2 = (x+1 - x0) / dx + y_top;
-
-               if (x0 < x1 && x3 > x2) {         // three segments descending down-right
-                  stbtt__handle_clipped_edge(scanline,x,e, x0,y0, x1,y1);
-                  stbtt__handle_clipped_edge(scanline,x,e, x1,y1, x2,y2);
-                  stbtt__handle_clipped_edge(scanline,x,e, x2,y2, x3,y3);
-               } else if (x3 < x1 && x0 > x2) {  // three segments descending down-left
-                  stbtt__handle_clipped_edge(scanline,x,e, x0,y0, x2,y2);
-                  stbtt__handle_clipped_edge(scanline,x,e, x2,y2, x1,y1);
-                  stbtt__handle_clipped_edge(scanline,x,e, x1,y1, x3,y3);
-               } else if (x0 < x1 && x3 > x1) {  // two segments across x, down-right
-                  stbtt__handle_clipped_edge(scanline,x,e, x0,y0, x1,y1);
-                  stbtt__handle_clipped_edge(scanline,x,e, x1,y1, x3,y3);
-               } else if (x3 < x1 && x0 > x1) {  // two segments across x, down-left
-                  stbtt__handle_clipped_edge(scanline,x,e, x0,y0, x1,y1);
-                  stbtt__handle_clipped_edge(scanline,x,e, x1,y1, x3,y3);
-               } else if (x0 < x2 && x3 > x2) {  // two segments across x+1, down-right
-                  stbtt__handle_clipped_edge(scanline,x,e, x0,y0, x2,y2);
-                  stbtt__handle_clipped_edge(scanline,x,e, x2,y2, x3,y3);
-               } else if (x3 < x2 && x0 > x2) {  // two segments across x+1, down-left
-                  stbtt__handle_clipped_edge(scanline,x,e, x0,y0, x2,y2);
-                  stbtt__handle_clipped_edge(scanline,x,e, x2,y2, x3,y3);
-               } else {  // one segment
-                  stbtt__handle_clipped_edge(scanline,x,e, x0,y0, x3,y3);
-               }
-            }
-         }
+#ifdef STBTT__SSE2
+// inclusive prefix sum of 4 lanes, plus carry
+static __m128 stbtt__prefix_sse2(__m128 x, __m128 carry)
+{
+   x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+   x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+   return _mm_add_ps(x, carry);
+}
+
+static float stbtt__accumulate_sse2(unsigned char *out, float *scanline, float *scanline2, int len, float sum)
+{
+   const __m128 sign = _mm_set1_ps(-0.0f), scale = _mm_set1_ps(255.0f),
+                half = _mm_set1_ps(0.5f), zero = _mm_setzero_ps();
+   __m128 carry = _mm_set1_ps(sum);
+   __m128i v[4];
+   int i=0, k;
+   for (; i+16 <= len; i += 16) {
+      for (k=0; k < 4; ++k) {
+         __m128 s = stbtt__prefix_sse2(_mm_loadu_ps(scanline2+i+4*k), carry);
+         __m128 c = _mm_add_ps(_mm_loadu_ps(scanline+i+4*k), s);
+         carry = _mm_shuffle_ps(s, s, _MM_SHUFFLE(3,3,3,3));
+         c = _mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, c), scale), half);
+         v[k] = _mm_cvttps_epi32(_mm_min_ps(c, scale));
+         _mm_storeu_ps(scanline +i+4*k, zero);
+         _mm_storeu_ps(scanline2+i+4*k, zero);
       }
-      e = e->next;
+      _mm_storeu_si128((__m128i *) (out+i),
+                       _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3])));
    }
+   return stbtt__accumulate_scalar(out+i, scanline+i, scanline2+i, len-i, _mm_cvtss_f32(carry));
 }
+#endif
 
-// directly AA rasterize edges w/o supersampling
-static void stbtt__rasterize_sorted_edges(stbtt__bitmap *result, stbtt__edge *e, int n, int vsubsample, int off_x, int off_y, void *userdata)
+#ifdef STBTT__AVX2
+__attribute__((target("avx2")))
+static __m256 stbtt__prefix_avx2(__m256 x, __m256 carry)
 {
-   stbtt__hheap hh = { 0, 0, 0 };
-   stbtt__active_edge *active = NULL;
-   int y,j=0, i;
-   float scanline_data[129], *scanline, *scanline2;
+   __m256 t;
+   // scan each 128-bit lane, then add the total of the low lane to the high one
+   x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 4)));
+   x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 8)));
+   t = _mm256_permute2f128_ps(x, x, 0x08);
+   t = _mm256_shuffle_ps(t, t, _MM_SHUFFLE(3,3,3,3));
+   return _mm256_add_ps(_mm256_add_ps(x, t), carry);
+}
 
-   STBTT__NOTUSED(vsubsample);
+__attribute__((target("avx2")))
+static float stbtt__accumulate_avx2(unsigned char *out, float *scanline, float *scanline2, int len, float sum)
+{
+   const __m256 sign = _mm256_set1_ps(-0.0f), scale = _mm256_set1_ps(255.0f),
+                half = _mm256_set1_ps(0.5f), zero = _mm256_setzero_ps();
+   __m256 carry = _mm256_set1_ps(sum);
+   __m256i v[2];
+   int i=0, k;
+   for (; i+16 <= len; i += 16) {
+      __m128i a, b;
+      for (k=0; k < 2; ++k) {
+         __m256 s = stbtt__prefix_avx2(_mm256_loadu_ps(scanline2+i+8*k), carry);
+         __m256 c = _mm256_add_ps(_mm256_loadu_ps(scanline+i+8*k), s);
+         carry = _mm256_permute2f128_ps(s, s, 0x11);
+         carry = _mm256_shuffle_ps(carry, carry, _MM_SHUFFLE(3,3,3,3));
+         c = _mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(sign, c), scale), half);
+         v[k] = _mm256_cvttps_epi32(_mm256_min_ps(c, scale));
+         _mm256_storeu_ps(scanline +i+8*k, zero);
+         _mm256_storeu_ps(scanline2+i+8*k, zero);
+      }
+      a = _mm_packs_epi32(_mm256_castsi256_si128(v[0]), _mm256_extracti128_si256(v[0], 1));
+      b = _mm_packs_epi32(_mm256_castsi256_si128(v[1]), _mm256_extracti128_si256(v[1], 1));
+      _mm_storeu_si128((__m128i *) (out+i), _mm_packus_epi16(a, b));
+   }
+   return stbtt__accumulate_scalar(out+i, scanline+i, scanline2+i, len-i, _mm256_cvtss_f32(carry));
+}
+#endif
+
+#ifdef STBTT__NEON
+static float stbtt__accumulate_neon(unsigned char *out, float *scanline, float *scanline2, int len, float sum)
+{
+   const float32x4_t zero = vdupq_n_f32(0.0f), scale = vdupq_n_f32(255.0f), half = vdupq_n_f32(0.5f);
+   float32x4_t carry = vdupq_n_f32(sum);
+   uint16x4_t v[2];
+   int i=0, k;
+   for (; i+8 <= len; i += 8) {
+      for (k=0; k < 2; ++k) {
+         float32x4_t s = vld1q_f32(scanline2+i+4*k), c;
+         s = vaddq_f32(s, vextq_f32(zero, s, 3));
+         s = vaddq_f32(s, vextq_f32(zero, s, 2));
+         s = vaddq_f32(s, carry);
+         carry = vdupq_n_f32(vgetq_lane_f32(s, 3));
+         c = vaddq_f32(vld1q_f32(scanline+i+4*k), s);
+         c = vaddq_f32(vmulq_f32(vabsq_f32(c), scale), half);
+         v[k] = vmovn_u32(vcvtq_u32_f32(vminq_f32(c, scale)));
+         vst1q_f32(scanline +i+4*k, zero);
+         vst1q_f32(scanline2+i+4*k, zero);
+      }
+      vst1_u8(out+i, vmovn_u16(vcombine_u16(v[0], v[1])));
+   }
+   return stbtt__accumulate_scalar(out+i, scanline+i, scanline2+i, len-i, vgetq_lane_f32(carry, 0));
+}
+#endif
+
+static stbtt__accumulate_func *stbtt__select_accumulate(void)
+{
+#if defined(STBTT__AVX2)
+   if (__builtin_cpu_supports("avx2"))
+      return stbtt__accumulate_avx2;
+#endif
+#if defined(STBTT__SSE2)
+   return stbtt__accumulate_sse2;
+#elif defined(STBTT__NEON)
+   return stbtt__accumulate_neon;
+#else
+   return stbtt__accumulate_scalar;
+#endif
+}
+
+// produce one row of pixels: accumulate touched granules, and fill the runs in
+// between with the constant value they have
+static void stbtt__resolve_row(unsigned char *out, float *scanline, float *scanline2, unsigned char *touched, int len, stbtt__accumulate_func *accumulate)
+{
+   int x = 0, g = 0, num_granules = STBTT__GRANULES(len);
+   float sum = 0;
+
+   while (x < len) {
+      int x1, g1 = g;
+      if (touched[g]) {
+         while (g1 < num_granules && touched[g1])
+            touched[g1++] = 0;
+         x1 = g1 << STBTT__GRANULE_SHIFT;
+         if (x1 > len) x1 = len;
+         sum = accumulate(out+x, scanline+x, scanline2+x, x1-x, sum);
+      } else {
+         while (g1 < num_granules && !touched[g1])
+            ++g1;
+         x1 = g1 << STBTT__GRANULE_SHIFT;
+         if (x1 > len) x1 = len;
+         STBTT_memset(out+x, stbtt__coverage(sum), x1-x);
+      }
+      x = x1;
+      g = g1;
+   }
+
+   // last granule may only hold scanline2[len], which is never accumulated
+   touched[num_granules-1] = 0;
+   scanline2[len] = 0;
+}
+
+// directly AA rasterize rows row0..row1-1 of the bitmap w/o supersampling.
+// e is sorted by y0 and e[n] is a sentinel below the bitmap; it is only read,
+// so bands of one bitmap can be rasterized concurrently from the same edges.
+// the active edge table of a band starts with the edges crossing its first
+// row, positioned directly rather than stepped down to it, so a band does not
+// inherit the rounding a single pass accumulates over tall bitmaps.
+// with a span list, rows go to it instead of the bitmap's pixels.
+static void stbtt__rasterize_sorted_edges_band(stbtt__bitmap *result, stbtt__edge *e, int n, int off_x, int off_y, int row0, int row1, stbtt__span_list *spans, void *userdata)
+{
+   stbtt__active_table active;
+   stbtt__accumulate_func *accumulate = stbtt__select_accumulate();
+   int y,j=row0;
+   float scanline_data[129+2], *scanline, *scanline2; // +2 holds the granule flags
+   float active_data[STBTT__ACTIVE_FIELDS*32], *active_storage;
+   unsigned char *touched;
 
    if (result->w > 64)
-      scanline = (float *) STBTT_malloc((result->w*2+1) * sizeof(float), userdata);
+      scanline = (float *) STBTT_malloc((result->w*2+1) * sizeof(float) + STBTT__GRANULES(result->w), userdata);
    else
       scanline = scanline_data;
 
+   // every edge could be active at once
+   if (n > 32)
+      active_storage = (float *) STBTT_malloc(STBTT__ACTIVE_FIELDS*n * sizeof(float), userdata);
+   else
+      active_storage = active_data;
+
+   // out of memory: leave the rows alone, and fail the spans
+   if (scanline == NULL || active_storage == NULL) {
+      if (active_storage != active_data)
+         STBTT_free(active_storage, userdata);
+      if (scanline != scanline_data)
+         STBTT_free(scanline, userdata);
+      if (spans)
+         spans->error = 1;
+      return;
+   }
+   stbtt__active_table_init(&active, active_storage, n > 32 ? n : 32);
+
    scanline2 = scanline + result->w;
+   touched = (unsigned char *) (scanline2 + result->w + 1);
 
-   y = off_y;
-   e[n].y0 = (float) (off_y + result->h) + 1;
+   // rows are cleared by stbtt__resolve_row() as they are consumed
+   STBTT_memset(scanline, 0, (result->w*2+1)*sizeof(scanline[0]) + STBTT__GRANULES(result->w));
 
-   while (j < result->h) {
+   y = off_y + row0;
+
+   while (j < row1) {
       // find center of pixel for this scanline
       float scan_y_top    = y + 0.0f;
       float scan_y_bottom = y + 1.0f;
-      stbtt__active_edge **step = &active;
-
-      STBTT_memset(scanline , 0, result->w*sizeof(scanline[0]));
-      STBTT_memset(scanline2, 0, (result->w+1)*sizeof(scanline[0]));
 
       // update all active edges;
       // remove all active edges that terminate before the top of this scanline
-      while (*step) {
-         stbtt__active_edge * z = *step;
-         if (z->ey <= scan_y_top) {
-            *step = z->next; // delete from list
-            STBTT_assert(z->direction);
-            z->direction = 0;
-            stbtt__hheap_free(&hh, z);
-         } else {
-            step = &((*step)->next); // advance through list
-         }
-      }
+      stbtt__active_table_prune(&active, scan_y_top);
 
       // insert all edges that start before the bottom of this scanline
       while (e->y0 <= scan_y_bottom) {
-         if (e->y0 != e->y1) {
-            stbtt__active_edge *z = stbtt__new_active(&hh, e, off_x, scan_y_top, userdata);
-            if (z != NULL) {
-               STBTT_assert(z->ey >= scan_y_top);
-               // insert at front
-               z->next = active;
-               active = z;
-            }
+         // edges that end above the row only occur at the start of a band,
+         // or above a clipped bitmap
+         if (e->y0 != e->y1 && e->y1 > scan_y_top) {
+            // an edge from above the band starts where a single sweep of the
+            // bitmap would have left it, adding up fdx row by row, so that
+            // bands render the same pixels as the sweep
+            int first = STBTT_iceil(e->y0) - 1;
+            if (first < off_y) first = off_y;
+            if (first < y) {
+               int k = active.count;
+               stbtt__active_table_add(&active, e, off_x, (float) first);
+               for (; first < y; ++first)
+                  active.fx[k] += active.fdx[k];
+            } else
+               stbtt__active_table_add(&active, e, off_x, scan_y_top);
+            STBTT_assert(active.ey[active.count-1] >= scan_y_top);
          }
          ++e;
       }
 
       // now process all active edges
-      if (active)
-         stbtt__fill_active_edges_new(scanline, scanline2+1, result->w, active, scan_y_top);
-
-      {
-         float sum = 0;
-         for (i=0; i < result->w; ++i) {
-            float k;
-            int m;
-            sum += scanline2[i];
-            k = scanline[i] + sum;
-            k = (float) STBTT_fabs(k)*255 + 0.5f;
-            m = (int) k;
-            if (m > 255) m = 255;
-            result->pixels[j*result->stride + i] = (unsigned char) m;
-         }
-      }
+      if (active.count)
+         stbtt__fill_active_edges_new(scanline, scanline2+1, touched, result->w, &active, scan_y_top);
+
+      if (spans) {
+         stbtt__resolve_row(spans->row, scanline, scanline2, touched, result->w, accumulate);
+         stbtt__emit_spans(spans, j, spans->row, result->w);
+      } else
+         stbtt__resolve_row(result->pixels + j*result->stride, scanline, scanline2, touched, result->w, accumulate);
       // advance all the edges
-      step = &active;
-      while (*step) {
-         stbtt__active_edge *z = *step;
-         z->fx += z->fdx; // advance to position for current scanline
-         step = &((*step)->next); // advance through list
-      }
+      stbtt__active_table_advance(&active);
 
       ++y;
       ++j;
    }
 
-   stbtt__hheap_cleanup(&hh, userdata);
+   if (active_storage != active_data)
+      STBTT_free(active_storage, userdata);
 
    if (scanline != scanline_data)
       STBTT_free(scanline, userdata);
 }
+
+static void stbtt__rasterize_sorted_edges(stbtt__bitmap *result, stbtt__edge *e, int n, int vsubsample, int off_x, int off_y, void *userdata)
+{
+   STBTT__NOTUSED(vsubsample);
+   e[n].y0 = (float) (off_y + result->h) + 1;
+   stbtt__rasterize_sorted_edges_band(result, e, n, off_x, off_y, 0, result->h, NULL, userdata);
+}
+
+// draw the edges in any order straight into area and fill rows covering the
+// whole bitmap, then resolve the rows. this skips the sort and the active
+// edge table, and pays for it with a buffer the size of the bitmap, so it is
+// only worth it for small bitmaps, whose buffer stays in cache. the sums come
+// out in a different order than in stbtt__rasterize_sorted_edges(), so pixels
+// may differ from it by one level. returns 0 without drawing if it runs out
+// of memory.
+static int stbtt__rasterize_edges_direct(stbtt__bitmap *result, stbtt__edge *e, int n, void *userdata)
+{
+   stbtt__accumulate_func *accumulate = stbtt__select_accumulate();
+   int w = result->w, h = result->h, row = w*2+1, granules = STBTT__GRANULES(w), i, y;
+   size_t size = (size_t) h * (row * sizeof(float) + granules);
+   float *buffer = (float *) STBTT_malloc(size, userdata);
+   unsigned char *touched;
+
+   if (buffer == NULL) return 0;
+   STBTT_memset(buffer, 0, size);
+   touched = (unsigned char *) (buffer + h*row);
+
+   for (i=0; i < n; ++i) {
+      stbtt__active_edge z;
+      float dxdy = (e[i].x1 - e[i].x0) / (e[i].y1 - e[i].y0);
+      int y0 = (int) STBTT_ifloor(e[i].y0), y1 = (int) STBTT_iceil(e[i].y1);
+      if (y0 < 0) y0 = 0;
+      if (y1 > h) y1 = h;
+      z.fdx = dxdy;
+      z.fdy = dxdy != 0.0f ? (1.0f/dxdy) : 0.0f;
+      z.fx = e[i].x0 + dxdy * (y0 - e[i].y0);
+      z.direction = e[i].invert ? 1.0f : -1.0f;
+      z.sy = e[i].y0;
+      z.ey = e[i].y1;
+      for (y=y0; y < y1; ++y) {
+         float *scanline = buffer + y*row;
+         stbtt__fill_active_edge_new(scanline, scanline + w+1, touched + y*granules, w, &z, (float) y);
+         z.fx += z.fdx;
+      }
+   }
+
+   for (y=0; y < h; ++y)
+      stbtt__resolve_row(result->pixels + y*result->stride, buffer + y*row, buffer + y*row + w, touched + y*granules, w, accumulate);
+
+   STBTT_free(buffer, userdata);
+   return 1;
+}
+#elif STBTT_RASTERIZER_VERSION == 3
+
+// fixed-point rasterizer. coordinates and areas are 16.16. every edge adds
+// its exact signed area to an int32 buffer covering the whole bitmap, with no
+// active edge table and no sorting; the coverage of a pixel is then the prefix
+// sum of its row up to it, as with scanline2 in the float rasterizer.
+// coordinates reach one pixel past the bitmap, rounded up to the next pixel,
+// so bitmaps wider or higher than STBTT__FIX_MAX_SIZE are left untouched.
+
+#define STBTT__FIX_SHIFT  16
+#define STBTT__FIX_ONE    (1 << STBTT__FIX_SHIFT)
+#define STBTT__FIX_MAX_SIZE 32766
+
+typedef int stbtt__fix;
+typedef long long stbtt__fix64;
+
+static stbtt__fix stbtt__fix_mul(stbtt__fix a, stbtt__fix64 b)
+{
+   return (stbtt__fix) ((a * b) >> STBTT__FIX_SHIFT);
+}
+
+// add the area of a piece of edge inside one row, from xa at its top to xb
+// at its bottom, with signed height d. the per-pixel amounts add up to
+// exactly d, so each row of the buffer sums to zero over a closed outline.
+static void stbtt__fix_cells(stbtt__fix *row, stbtt__fix xa, stbtt__fix xb, stbtt__fix d)
+{
+   stbtt__fix x0 = xa < xb ? xa : xb, x1 = xa < xb ? xb : xa;
+   int i0 = x0 >> STBTT__FIX_SHIFT, i1 = (x1 + STBTT__FIX_ONE - 1) >> STBTT__FIX_SHIFT;
+
+   if (i1 <= i0 + 1) {
+      // within one pixel: the pixel gets the part right of the midpoint
+      stbtt__fix xm = ((xa + xb) >> 1) - (i0 << STBTT__FIX_SHIFT);
+      stbtt__fix c = stbtt__fix_mul(d, xm);
+      row[i0]   += d - c;
+      row[i0+1] += c;
+   } else {
+      // s = 1/(x1-x0); the first pixel gets the triangle s*(1-x0f)^2/2, the
+      // last one s*x1f^2/2, and the ones in between the rest
+      stbtt__fix64 s = ((stbtt__fix64) STBTT__FIX_ONE << STBTT__FIX_SHIFT) / (x1 - x0);
+      stbtt__fix64 x0f = STBTT__FIX_ONE - (x0 - (i0 << STBTT__FIX_SHIFT));
+      stbtt__fix64 x1f = x1 - (i1 << STBTT__FIX_SHIFT) + STBTT__FIX_ONE;
+      stbtt__fix a0 = (stbtt__fix) ((s * ((x0f * x0f) >> STBTT__FIX_SHIFT)) >> (STBTT__FIX_SHIFT+1));
+      stbtt__fix am = (stbtt__fix) ((s * ((x1f * x1f) >> STBTT__FIX_SHIFT)) >> (STBTT__FIX_SHIFT+1));
+      stbtt__fix c0 = stbtt__fix_mul(d, a0), cm = stbtt__fix_mul(d, am);
+      stbtt__fix sum = c0 + cm;
+      row[i0] += c0;
+      if (i1 > i0 + 2) {
+         // a1 = s*(1.5-x0f) is the coverage up to the end of the second pixel
+         stbtt__fix a1 = (stbtt__fix) ((s * (x0f + STBTT__FIX_ONE/2)) >> STBTT__FIX_SHIFT);
+         stbtt__fix c1 = stbtt__fix_mul(d, a1 - a0), cs = stbtt__fix_mul(d, s);
+         int i;
+         row[i0+1] += c1;
+         sum += c1;
+         for (i=i0+2; i < i1-1; ++i) {
+            row[i] += cs;
+            sum += cs;
+         }
+      }
+      row[i1-1] += d - sum;
+      row[i1]   += cm;
+   }
+}
+
+// add a line segment with y0 < y1 and x inside [0, w], in 16.16
+static void stbtt__fix_line(stbtt__fix *acc, int stride, int w, int h, stbtt__fix x0, stbtt__fix y0, stbtt__fix x1, stbtt__fix y1, int dir)
+{
+   stbtt__fix64 dxdy = (stbtt__fix64) (x1 - x0) * STBTT__FIX_ONE / (y1 - y0);
+   stbtt__fix xmin = x0 < x1 ? x0 : x1, xmax = x0 < x1 ? x1 : x0;
+   int row = y0 >> STBTT__FIX_SHIFT, row_end = (y1 + STBTT__FIX_ONE - 1) >> STBTT__FIX_SHIFT;
+   STBTT__NOTUSED(w);
+   if (row < 0) row = 0;
+   if (row_end > h) row_end = h;
+   for (; row < row_end; ++row) {
+      stbtt__fix top = row << STBTT__FIX_SHIFT, bottom = top + STBTT__FIX_ONE;
+      stbtt__fix ya = y0 > top ? y0 : top, yb = y1 < bottom ? y1 : bottom;
+      stbtt__fix xa = x0 + (stbtt__fix) ((dxdy * (ya - y0)) >> STBTT__FIX_SHIFT);
+      stbtt__fix xb = x0 + (stbtt__fix) ((dxdy * (yb - y0)) >> STBTT__FIX_SHIFT);
+      if (ya >= yb) continue;
+      // keep rounding from stepping outside the segment
+      xa = xa < xmin ? xmin : xa > xmax ? xmax : xa;
+      xb = xb < xmin ? xmin : xb > xmax ? xmax : xb;
+      stbtt__fix_cells(acc + row*stride, xa, xb, (yb - ya) * dir);
+   }
+}
+
+// add an edge in bitmap pixels. the parts left of the bitmap act as if they
+// were on its left border, and the parts right of it are dropped into the
+// spare columns, so the edge is split where it crosses x = 0 and x = w
+static void stbtt__fix_edge(stbtt__fix *acc, int stride, int w, int h, stbtt__edge *e, int off_x, int off_y)
+{
+   float x0 = e->x0 - off_x, y0 = e->y0 - off_y, x1 = e->x1 - off_x, y1 = e->y1 - off_y;
+   float xs[4], ys[4], t;
+   int i, n = 1, dir = e->invert ? 1 : -1;
+
+   if (y1 <= 0 || y0 >= h)
+      return;
+
+   // cut the parts far above or below the bitmap, whatever the size of the
+   // glyph they belong to, so that they fit in 16.16
+   if (y0 < -1) x0 += (x1 - x0) * (-1 - y0) / (y1 - y0), y0 = -1;
+   if (y1 > h+1) x1 = x0 + (x1 - x0) * (h+1 - y0) / (y1 - y0), y1 = (float) (h+1);
+
+   xs[0] = x0, ys[0] = y0;
+   if ((x0 < 0) != (x1 < 0) || (x0 > w) != (x1 > w)) {
+      float ta = (x0 < 0) != (x1 < 0) ? (0 - x0) / (x1 - x0) : 2;
+      float tb = (x0 > w) != (x1 > w) ? (w - x0) / (x1 - x0) : 2;
+      if (ta > tb) t = ta, ta = tb, tb = t;
+      if (ta < 1) xs[n] = x0 + (x1-x0)*ta, ys[n] = y0 + (y1-y0)*ta, ++n;
+      if (tb < 1) xs[n] = x0 + (x1-x0)*tb, ys[n] = y0 + (y1-y0)*tb, ++n;
+   }
+   xs[n] = x1, ys[n] = y1;
+
+   for (i=0; i < n; ++i) {
+      float xa = xs[i], xb = xs[i+1];
+      stbtt__fix ya = (stbtt__fix) STBTT_ifloor(ys[i]   * STBTT__FIX_ONE + 0.5f);
+      stbtt__fix yb = (stbtt__fix) STBTT_ifloor(ys[i+1] * STBTT__FIX_ONE + 0.5f);
+      if (ya >= yb) continue;
+      xa = xa < 0 ? 0 : xa > w ? (float) w : xa;
+      xb = xb < 0 ? 0 : xb > w ? (float) w : xb;
+      stbtt__fix_line(acc, stride, w, h,
+                      (stbtt__fix) STBTT_ifloor(xa * STBTT__FIX_ONE + 0.5f), ya,
+                      (stbtt__fix) STBTT_ifloor(xb * STBTT__FIX_ONE + 0.5f), yb, dir);
+   }
+}
+
+// out[i] = min(255, |acc[0] + ... + acc[i]| * 255), rounded
+static void stbtt__fix_accumulate(unsigned char *out, stbtt__fix *acc, int len)
+{
+   stbtt__fix sum = 0;
+   int i=0;
+#ifdef STBTT__SSE2
+   {
+      const __m128i one = _mm_set1_epi32(STBTT__FIX_ONE), half = _mm_set1_epi32(STBTT__FIX_ONE/2);
+      __m128i carry = _mm_setzero_si128(), v[2];
+      int k;
+      for (; i+8 <= len; i += 8) {
+         for (k=0; k < 2; ++k) {
+            __m128i x = _mm_loadu_si128((__m128i *) (acc+i+4*k)), sign, big;
+            x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+            x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+            x = _mm_add_epi32(x, carry);
+            carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3,3,3,3));
+            sign = _mm_srai_epi32(x, 31);
+            x = _mm_sub_epi32(_mm_xor_si128(x, sign), sign);
+            big = _mm_cmpgt_epi32(x, one);
+            x = _mm_or_si128(_mm_andnot_si128(big, x), _mm_and_si128(big, one));
+            x = _mm_sub_epi32(_mm_slli_epi32(x, 8), x);
+            v[k] = _mm_srli_epi32(_mm_add_epi32(x, half), STBTT__FIX_SHIFT);
+         }
+         v[0] = _mm_packs_epi32(v[0], v[1]);
+         _mm_storel_epi64((__m128i *) (out+i), _mm_packus_epi16(v[0], v[0]));
+      }
+      sum = _mm_cvtsi128_si32(carry);
+   }
+#endif
+   for (; i < len; ++i) {
+      stbtt__fix v;
+      sum += acc[i];
+      v = sum < 0 ? -sum : sum;
+      if (v > STBTT__FIX_ONE) v = STBTT__FIX_ONE;
+      out[i] = (unsigned char) ((v*255 + STBTT__FIX_ONE/2) >> STBTT__FIX_SHIFT);
+   }
+}
+
+static void stbtt__rasterize_edges_fixed(stbtt__bitmap *result, stbtt__edge *e, int n, int off_x, int off_y, void *userdata)
+{
+   // two spare columns take the area right of the bitmap
+   int stride = result->w + 2, i, j;
+   stbtt__fix *acc;
+
+   if (result->w <= 0 || result->h <= 0)
+      return;
+   if (result->w > STBTT__FIX_MAX_SIZE || result->h > STBTT__FIX_MAX_SIZE)
+      return;
+   acc = (stbtt__fix *) STBTT_malloc(stride * result->h * sizeof(*acc), userdata);
+   if (acc == NULL)
+      return;
+   STBTT_memset(acc, 0, stride * result->h * sizeof(*acc));
+
+   for (i=0; i < n; ++i)
+      stbtt__fix_edge(acc, stride, result->w, result->h, &e[i], off_x, off_y);
+
+   for (j=0; j < result->h; ++j)
+      stbtt__fix_accumulate(result->pixels + j*result->stride, acc + j*stride, result->w);
+
+   STBTT_free(acc, userdata);
+}
 #else
 #error "Unrecognized value of STBTT_RASTERIZER_VERSION"
 #endif
 
+#if STBTT_RASTERIZER_VERSION != 3
 #define STBTT__COMPARE(a,b)  ((a)->y0 < (b)->y0)
 
 static void stbtt__sort_edges_ins_sort(stbtt__edge *p, int n)
@@ -2237,36 +2956,112 @@ static void stbtt__sort_edges_quicksort(stbtt__edge *p, int n)
    }
 }
 
-static void stbtt__sort_edges(stbtt__edge *p, int n)
+// below this many edges, quicksort beats the setup cost of the bucket sort
+// (see bench/bench_sort.c)
+#define STBTT__BUCKET_SORT_MIN     32
+// give up on the bucket sort if the edges span more than this many rows per edge
+#define STBTT__BUCKET_SORT_SPREAD  4
+
+// counting sort on the scanline of y0, finished by an insertion sort to order
+// the edges within each scanline. O(n) when the edges span a modest number of
+// rows, which is the case for glyphs with many edges. returns 0 if it gave up.
+static int stbtt__sort_edges_bucket(stbtt__edge *p, int n, void *userdata)
+{
+   float ymin = p[0].y0, ymax = p[0].y0;
+   stbtt__edge *sorted;
+   int i, base, rows, *start;
+
+   for (i=1; i < n; ++i) {
+      if (p[i].y0 < ymin) ymin = p[i].y0;
+      if (p[i].y0 > ymax) ymax = p[i].y0;
+   }
+   if (!(ymax - ymin < (float) n * STBTT__BUCKET_SORT_SPREAD))
+      return 0;
+
+   base = STBTT_ifloor(ymin);
+   rows = STBTT_ifloor(ymax) - base + 1;
+   sorted = (stbtt__edge *) STBTT_malloc(n * sizeof(*sorted) + (rows+1) * sizeof(int), userdata);
+   if (sorted == NULL)
+      return 0;
+   start = (int *) (sorted + n);
+
+   STBTT_memset(start, 0, (rows+1) * sizeof(int));
+   for (i=0; i < n; ++i)
+      ++start[STBTT_ifloor(p[i].y0) - base + 1];
+   for (i=1; i <= rows; ++i)
+      start[i] += start[i-1];
+   for (i=0; i < n; ++i)
+      sorted[start[STBTT_ifloor(p[i].y0) - base]++] = p[i];
+
+   STBTT_memcpy(p, sorted, n * sizeof(*p));
+   STBTT_free(sorted, userdata);
+
+   stbtt__sort_edges_ins_sort(p, n);
+   return 1;
+}
+
+static void stbtt__sort_edges(stbtt__edge *p, int n, void *userdata)
 {
+   if (n >= STBTT__BUCKET_SORT_MIN && stbtt__sort_edges_bucket(p, n, userdata))
+      return;
    stbtt__sort_edges_quicksort(p, n);
    stbtt__sort_edges_ins_sort(p, n);
 }
+#endif
 
 typedef struct
 {
    float x,y;
 } stbtt__point;
 
-static void stbtt__rasterize(stbtt__bitmap *result, stbtt__point *pts, int *wcount, int windings, float scale_x, float scale_y, float shift_x, float shift_y, int off_x, int off_y, int invert, void *userdata)
+// transforms are 2x3 matrices {a,b,c,d,e,f} mapping (x,y) in the outline to
+// (a*x + b*y + c, d*x + e*y + f) in the bitmap
+static void stbtt__scale_transform(float *m, float scale_x, float scale_y, float shift_x, float shift_y, int invert)
+{
+   m[0] = scale_x, m[1] = 0, m[2] = shift_x;
+   m[3] = 0, m[4] = invert ? -scale_y : scale_y, m[5] = shift_y;
+}
+
+// number of uniform segments that keep a quadratic within 'flatness' of its
+// chords: n pieces have second difference a/n^2, and a piece with second
+// difference a' strays |a'|/4 from its chord
+static int stbtt__curve_segments(float x0, float y0, float x1, float y1, float x2, float y2, float flatness)
+{
+   float ax = x0 - 2*x1 + x2, ay = y0 - 2*y1 + y2;
+   float dd = ax*ax + ay*ay;
+   float n;
+   if (dd <= 16*flatness*flatness)
+      return 1;
+   n = (float) STBTT_sqrt(STBTT_sqrt(dd) / (4*flatness));
+   return n < 65535 ? (int) n + 1 : 65536; // same limit as the old recursion depth
+}
+
+#if STBTT_RASTERIZER_VERSION == 1
+// the old rasterizer works from flattened contours; the new one builds its
+// edges straight from the vertices, see stbtt__build_edges()
+static void stbtt__rasterize(stbtt__bitmap *result, stbtt__point *pts, int *wcount, int windings, const float *mtx, int off_x, int off_y, void *userdata)
 {
-   float y_scale_inv = invert ? -scale_y : scale_y;
    stbtt__edge *e;
    int n,i,j,k,m;
-#if STBTT_RASTERIZER_VERSION == 1
-   int vsubsample = result->h < 8 ? 15 : 5;
-#elif STBTT_RASTERIZER_VERSION == 2
-   int vsubsample = 1;
-#else
-   #error "Unrecognized value of STBTT_RASTERIZER_VERSION"
-#endif
-   // vsubsample should divide 255 evenly; otherwise we won't reach full opacity
+   int vsubsample;
+   float ymin, ymax;
 
    // now we have to blow out the windings into explicit edge lists
    n = 0;
    for (i=0; i < windings; ++i)
       n += wcount[i];
 
+   // small glyphs get more subsamples; go by the outline's height, not the
+   // bitmap's, so that a tile or band of a glyph is sampled like the whole.
+   // vsubsample should divide 255 evenly; otherwise we won't reach full opacity
+   ymin = ymax = n ? pts[0].x * mtx[3] + pts[0].y * mtx[4] : 0;
+   for (i=1; i < n; ++i) {
+      float y = pts[i].x * mtx[3] + pts[i].y * mtx[4];
+      if (y < ymin) ymin = y;
+      if (y > ymax) ymax = y;
+   }
+   vsubsample = STBTT_iceil(ymax + mtx[5]) - STBTT_ifloor(ymin + mtx[5]) < 8 ? 15 : 5;
+
    e = (stbtt__edge *) STBTT_malloc(sizeof(*e) * (n+1), userdata); // add an extra one as a sentinel
    if (e == 0) return;
    n = 0;
@@ -2277,27 +3072,30 @@ static void stbtt__rasterize(stbtt__bitmap *result, stbtt__point *pts, int *wcou
       m += wcount[i];
       j = wcount[i]-1;
       for (k=0; k < wcount[i]; j=k++) {
-         int a=k,b=j;
+         float xj = p[j].x * mtx[0] + p[j].y * mtx[1] + mtx[2];
+         float yj = p[j].x * mtx[3] + p[j].y * mtx[4] + mtx[5];
+         float xk = p[k].x * mtx[0] + p[k].y * mtx[1] + mtx[2];
+         float yk = p[k].x * mtx[3] + p[k].y * mtx[4] + mtx[5];
          // skip the edge if horizontal
-         if (p[j].y == p[k].y)
+         if (yj == yk)
             continue;
-         // add edge from j to k to the list
+         // add edge from j to k to the list, top to bottom
          e[n].invert = 0;
-         if (invert ? p[j].y > p[k].y : p[j].y < p[k].y) {
+         if (yj < yk) {
             e[n].invert = 1;
-            a=j,b=k;
+            e[n].x0 = xj, e[n].y0 = yj * vsubsample;
+            e[n].x1 = xk, e[n].y1 = yk * vsubsample;
+         } else {
+            e[n].x0 = xk, e[n].y0 = yk * vsubsample;
+            e[n].x1 = xj, e[n].y1 = yj * vsubsample;
          }
-         e[n].x0 = p[a].x * scale_x + shift_x;
-         e[n].y0 = (p[a].y * y_scale_inv + shift_y) * vsubsample;
-         e[n].x1 = p[b].x * scale_x + shift_x;
-         e[n].y1 = (p[b].y * y_scale_inv + shift_y) * vsubsample;
          ++n;
       }
    }
 
    // now sort the edges by their highest point (should snap to integer, and then by x)
    //STBTT_sort(e, n, sizeof(e[0]), stbtt__edge_compare);
-   stbtt__sort_edges(e, n);
+   stbtt__sort_edges(e, n, userdata);
 
    // now, traverse the scanlines and find the intersections on each scanline, use xor winding rule
    stbtt__rasterize_sorted_edges(result, e, n, vsubsample, off_x, off_y, userdata);
@@ -2305,32 +3103,22 @@ static void stbtt__rasterize(stbtt__bitmap *result, stbtt__point *pts, int *wcou
    STBTT_free(e, userdata);
 }
 
-static void stbtt__add_point(stbtt__point *points, int n, float x, float y)
+// write the end points of the n uniform segments of a quadratic, using
+// forward differences
+static void stbtt__flatten_curve(stbtt__point *points, float x0, float y0, float x1, float y1, float x2, float y2, int n)
 {
-   if (!points) return; // during first pass, it's unallocated
-   points[n].x = x;
-   points[n].y = y;
-}
-
-// tesselate until threshhold p is happy... @TODO warped to compensate for non-linear stretching
-static int stbtt__tesselate_curve(stbtt__point *points, int *num_points, float x0, float y0, float x1, float y1, float x2, float y2, float objspace_flatness_squared, int n)
-{
-   // midpoint
-   float mx = (x0 + 2*x1 + x2)/4;
-   float my = (y0 + 2*y1 + y2)/4;
-   // versus directly drawn line
-   float dx = (x0+x2)/2 - mx;
-   float dy = (y0+y2)/2 - my;
-   if (n > 16) // 65536 segments on one curve better be enough!
-      return 1;
-   if (dx*dx+dy*dy > objspace_flatness_squared) { // half-pixel error allowed... need to be smaller if AA
-      stbtt__tesselate_curve(points, num_points, x0,y0, (x0+x1)/2.0f,(y0+y1)/2.0f, mx,my, objspace_flatness_squared,n+1);
-      stbtt__tesselate_curve(points, num_points, mx,my, (x1+x2)/2.0f,(y1+y2)/2.0f, x2,y2, objspace_flatness_squared,n+1);
-   } else {
-      stbtt__add_point(points, *num_points,x2,y2);
-      *num_points = *num_points+1;
-   }
-   return 1;
+   float h = 1.0f / n;
+   float ax = (x0 - 2*x1 + x2)*h*h, ay = (y0 - 2*y1 + y2)*h*h;
+   float dx = 2*(x1 - x0)*h + ax, dy = 2*(y1 - y0)*h + ay;
+   int i;
+   for (i=0; i < n-1; ++i) {
+      x0 += dx, y0 += dy;
+      points[i].x = x0;
+      points[i].y = y0;
+      dx += 2*ax, dy += 2*ay;
+   }
+   points[n-1].x = x2;
+   points[n-1].y = y2;
 }
 
 // returns number of contours
@@ -2338,14 +3126,27 @@ static stbtt__point *stbtt_FlattenCurves(stbtt_vertex *vertices, int num_verts,
 {
    stbtt__point *points=0;
    int num_points=0;
-
-   float objspace_flatness_squared = objspace_flatness * objspace_flatness;
-   int i,n=0,start=0, pass;
-
-   // count how many "moves" there are to get the contour count
-   for (i=0; i < num_verts; ++i)
-      if (vertices[i].type == STBTT_vmove)
-         ++n;
+   float x=0,y=0;
+   int i,n=0,start=0;
+
+   // the segment count of each curve is known up front, so count the
+   // contours and points, allocate, and then flatten in a single pass
+   for (i=0; i < num_verts; ++i) {
+      switch (vertices[i].type) {
+         case STBTT_vmove:
+            ++n;
+            ++num_points;
+            break;
+         case STBTT_vline:
+            ++num_points;
+            break;
+         case STBTT_vcurve:
+            num_points += stbtt__curve_segments(x,y, vertices[i].cx,vertices[i].cy,
+                                                vertices[i].x,vertices[i].y, objspace_flatness);
+            break;
+      }
+      x = vertices[i].x, y = vertices[i].y;
+   }
 
    *num_contours = n;
    if (n == 0) return 0;
@@ -2357,42 +3158,41 @@ static stbtt__point *stbtt_FlattenCurves(stbtt_vertex *vertices, int num_verts,
       return 0;
    }
 
-   // make two passes through the points so we don't need to realloc
-   for (pass=0; pass < 2; ++pass) {
-      float x=0,y=0;
-      if (pass == 1) {
-         points = (stbtt__point *) STBTT_malloc(num_points * sizeof(points[0]), userdata);
-         if (points == NULL) goto error;
-      }
-      num_points = 0;
-      n= -1;
-      for (i=0; i < num_verts; ++i) {
-         switch (vertices[i].type) {
-            case STBTT_vmove:
-               // start the next contour
-               if (n >= 0)
-                  (*contour_lengths)[n] = num_points - start;
-               ++n;
-               start = num_points;
-
-               x = vertices[i].x, y = vertices[i].y;
-               stbtt__add_point(points, num_points++, x,y);
-               break;
-            case STBTT_vline:
-               x = vertices[i].x, y = vertices[i].y;
-               stbtt__add_point(points, num_points++, x, y);
-               break;
-            case STBTT_vcurve:
-               stbtt__tesselate_curve(points, &num_points, x,y,
-                                        vertices[i].cx, vertices[i].cy,
-                                        vertices[i].x,  vertices[i].y,
-                                        objspace_flatness_squared, 0);
-               x = vertices[i].x, y = vertices[i].y;
-               break;
+   points = (stbtt__point *) STBTT_malloc(num_points * sizeof(points[0]), userdata);
+   if (points == NULL) goto error;
+
+   num_points = 0;
+   n= -1;
+   x = y = 0;
+   for (i=0; i < num_verts; ++i) {
+      switch (vertices[i].type) {
+         case STBTT_vmove:
+            // start the next contour
+            if (n >= 0)
+               (*contour_lengths)[n] = num_points - start;
+            ++n;
+            start = num_points;
+            points[num_points].x = vertices[i].x;
+            points[num_points].y = vertices[i].y;
+            ++num_points;
+            break;
+         case STBTT_vline:
+            points[num_points].x = vertices[i].x;
+            points[num_points].y = vertices[i].y;
+            ++num_points;
+            break;
+         case STBTT_vcurve: {
+            int segments = stbtt__curve_segments(x,y, vertices[i].cx,vertices[i].cy,
+                                                 vertices[i].x,vertices[i].y, objspace_flatness);
+            stbtt__flatten_curve(points + num_points, x,y, vertices[i].cx,vertices[i].cy,
+                                 vertices[i].x,vertices[i].y, segments);
+            num_points += segments;
+            break;
          }
       }
-      (*contour_lengths)[n] = num_points - start;
+      x = vertices[i].x, y = vertices[i].y;
    }
+   (*contour_lengths)[n] = num_points - start;
 
    return points;
 error:
@@ -2402,17 +3202,503 @@ error:
    *num_contours = 0;
    return NULL;
 }
+#endif
 
-STBTT_DEF void stbtt_Rasterize(stbtt__bitmap *result, float flatness_in_pixels, stbtt_vertex *vertices, int num_verts, float scale_x, float scale_y, float shift_x, float shift_y, int x_off, int y_off, int invert, void *userdata)
+#if STBTT_RASTERIZER_VERSION >= 2
+static void stbtt__add_edge(stbtt__edge *e, int *n, float x0, float y0, float x1, float y1)
+{
+   stbtt__edge *z;
+   if (y0 == y1)
+      return; // skip the edge if horizontal
+   z = &e[(*n)++];
+   // orient the edge top to bottom, remembering if it pointed down
+   if (y0 < y1) {
+      z->x0 = x0, z->y0 = y0, z->x1 = x1, z->y1 = y1;
+      z->invert = 1;
+   } else {
+      z->x0 = x1, z->y0 = y1, z->x1 = x0, z->y1 = y0;
+      z->invert = 0;
+   }
+}
+
+// turn the outline straight into scaled, oriented edges, flattening curves
+// on the way, with no point lists. with e == NULL this only counts them.
+// returns the number of edges.
+static int stbtt__emit_edges(stbtt__edge *e, stbtt_vertex *vertices, int num_verts, float flatness, const float *m)
+{
+   float x = 0, y = 0, start_x = 0, start_y = 0;
+   int i, n = 0;
+
+   for (i=0; i < num_verts; ++i) {
+      float vx = vertices[i].x * m[0] + vertices[i].y * m[1] + m[2];
+      float vy = vertices[i].x * m[3] + vertices[i].y * m[4] + m[5];
+      switch (vertices[i].type) {
+         case STBTT_vmove:
+            // close the previous contour
+            if (i > 0) {
+               if (e) stbtt__add_edge(e, &n, x,y, start_x,start_y);
+               else ++n;
+            }
+            start_x = vx, start_y = vy;
+            break;
+         case STBTT_vline:
+            if (e) stbtt__add_edge(e, &n, x,y, vx,vy);
+            else ++n;
+            break;
+         case STBTT_vcurve: {
+            float cx = vertices[i].cx * m[0] + vertices[i].cy * m[1] + m[2];
+            float cy = vertices[i].cx * m[3] + vertices[i].cy * m[4] + m[5];
+            int k, segments = stbtt__curve_segments(x,y, cx,cy, vx,vy, flatness);
+            if (e) {
+               // forward differences of the curve at steps of 1/segments
+               float h = 1.0f / segments;
+               float ax = (x - 2*cx + vx)*h*h, ay = (y - 2*cy + vy)*h*h;
+               float dx = 2*(cx - x)*h + ax, dy = 2*(cy - y)*h + ay;
+               float px = x, py = y;
+               for (k=1; k < segments; ++k) {
+                  float qx = px + dx, qy = py + dy;
+                  stbtt__add_edge(e, &n, px,py, qx,qy);
+                  px = qx, py = qy;
+                  dx += 2*ax, dy += 2*ay;
+               }
+               stbtt__add_edge(e, &n, px,py, vx,vy);
+            } else
+               n += segments;
+            break;
+         }
+      }
+      x = vx, y = vy;
+   }
+   if (num_verts > 0) {
+      if (e) stbtt__add_edge(e, &n, x,y, start_x,start_y);
+      else ++n;
+   }
+   return n;
+}
+
+// the edges of an outline, with room for a sentinel after them, or NULL
+static stbtt__edge *stbtt__build_edges(stbtt_vertex *vertices, int num_verts, float flatness, const float *m, int *num_edges, void *userdata)
+{
+   int n = stbtt__emit_edges(NULL, vertices, num_verts, flatness, m);
+   stbtt__edge *e = (stbtt__edge *) STBTT_malloc(sizeof(*e) * (n+1), userdata); // add an extra one as a sentinel
+   *num_edges = 0;
+   if (e == NULL) return NULL;
+   *num_edges = stbtt__emit_edges(e, vertices, num_verts, flatness, m);
+   return e;
+}
+
+
+// drop the edges that the rows from y0 to y1 never reach: those ending at or
+// above y0, which the scanline loop skips, and those starting below y1, which
+// it never gets to. only worth it when drawing part of a bitmap, but cheap.
+static int stbtt__clip_edge_rows(stbtt__edge *e, int n, float y0, float y1)
+{
+   int i, k = 0;
+   for (i=0; i < n; ++i)
+      if (e[i].y1 > y0 && e[i].y0 <= y1)
+         e[k++] = e[i];
+   return k;
+}
+#endif
+
+#ifdef STBTT_RASTERIZE_CURVES
+#if STBTT_RASTERIZER_VERSION != 2
+#error "STBTT_RASTERIZE_CURVES requires STBTT_RASTERIZER_VERSION 2"
+#endif
+
+// a quadratic in bitmap space that is monotonic in y, with y0 <= y1 <= y2.
+// lines have bend == 0 and only use the end points and fdx.
+typedef struct
+{
+   float x0,y0, x1,y1, x2,y2;
+   float direction;
+   float fdx;   // lines: dx/dy
+   float bend;  // curves: |x0-2x1+x2, y0-2y1+y2| / 4, the chord error over all of t
+   float t;     // curves: parameter at the bottom of the last scanline, or -1
+} stbtt__curve;
+
+static stbtt__curve *stbtt__new_curve(stbtt__curve *c, int *n, float x0, float y0, float x2, float y2)
+{
+   stbtt__curve *z = &c[(*n)++];
+   if (y0 < y2) {
+      z->x0 = x0, z->y0 = y0, z->x2 = x2, z->y2 = y2;
+      z->direction = 1.0f;
+   } else {
+      z->x0 = x2, z->y0 = y2, z->x2 = x0, z->y2 = y0;
+      z->direction = -1.0f;
+   }
+   z->fdx = (z->x2 - z->x0) / (z->y2 - z->y0);
+   z->bend = 0;
+   z->t = -1;
+   return z;
+}
+
+static void stbtt__add_line(stbtt__curve *c, int *n, float x0, float y0, float x1, float y1)
+{
+   if (y0 != y1) // horizontal lines contribute no coverage
+      stbtt__new_curve(c, n, x0,y0, x1,y1);
+}
+
+static void stbtt__add_monotonic_curve(stbtt__curve *c, int *n, float x0, float y0, float x1, float y1, float x2, float y2)
+{
+   stbtt__curve *z;
+   float ax = x0 - 2*x1 + x2, ay = y0 - 2*y1 + y2;
+   if (y0 == y2)
+      return;
+   z = stbtt__new_curve(c, n, x0,y0, x2,y2);
+   z->x1 = x1;
+   // keep the control point inside the y range despite rounding in the split
+   z->y1 = y1 < z->y0 ? z->y0 : y1 > z->y2 ? z->y2 : y1;
+   z->bend = (float) STBTT_sqrt(ax*ax + ay*ay) / 4;
+}
+
+// split a quadratic at its y extremum, if it has one inside the curve
+static void stbtt__add_curve(stbtt__curve *c, int *n, float x0, float y0, float x1, float y1, float x2, float y2)
+{
+   float a = y0 - 2*y1 + y2;
+   if (a != 0) {
+      float t = (y0 - y1) / a;
+      if (t > 0 && t < 1) {
+         float ax = x0 + (x1-x0)*t, ay = y0 + (y1-y0)*t;
+         float bx = x1 + (x2-x1)*t, by = y1 + (y2-y1)*t;
+         float mx = ax + (bx-ax)*t, my = ay + (by-ay)*t;
+         stbtt__add_monotonic_curve(c, n, x0,y0, ax,ay, mx,my);
+         stbtt__add_monotonic_curve(c, n, mx,my, bx,by, x2,y2);
+         return;
+      }
+   }
+   stbtt__add_monotonic_curve(c, n, x0,y0, x1,y1, x2,y2);
+}
+
+// parameter at which the curve reaches y, for y0 <= y <= y2
+static float stbtt__curve_solve(stbtt__curve *c, float y)
+{
+   // a*t^2 + b*t = d, with b >= 0 and 2a+b >= 0 since the curve is monotonic;
+   // this form of the root is stable, and also covers a == 0
+   float a = c->y0 - 2*c->y1 + c->y2, b = 2*(c->y1 - c->y0), d = y - c->y0;
+   float disc = b*b + 4*a*d;
+   float den = b + (float) STBTT_sqrt(disc > 0 ? disc : 0);
+   float t = den > 0 ? 2*d / den : 0;
+   return t < 0 ? 0 : t > 1 ? 1 : t;
+}
+
+// add the coverage of the part of the curve inside scanline y_top..y_top+1,
+// as chords that stay within 'flatness' of the curve
+static void stbtt__fill_curve(float *scanline, float *scanline_fill, unsigned char *touched, int len, stbtt__curve *c, float y_top, float flatness)
+{
+   float ya = c->y0 > y_top ? c->y0 : y_top;
+   float yb = c->y2 < y_top+1 ? c->y2 : y_top+1;
+   float ax, ay, bx, by, t0, t1, h, px, py;
+   stbtt__active_edge e;
+   int i, k = 1;
+
+   if (ya >= yb)
+      return;
+
+   e.direction = c->direction;
+   if (c->bend == 0) {
+      e.fdx = c->fdx;
+      e.fdy = e.fdx != 0.0f ? (1.0f/e.fdx) : 0.0f;
+      e.fx = c->x0 + e.fdx * (y_top - c->y0);
+      e.sy = c->y0;
+      e.ey = c->y2;
+      stbtt__fill_active_edge_new(scanline, scanline_fill, touched, len, &e, y_top);
+      return;
+   }
+
+   // the curve enters this scanline where it left the previous one
+   t0 = c->y0 >= y_top ? 0 : c->t >= 0 ? c->t : stbtt__curve_solve(c, ya);
+   t1 = c->y2 <= yb ? 1 : stbtt__curve_solve(c, yb);
+   c->t = t1;
+   h = t1 - t0;
+
+   // a chord over dt deviates from the curve by bend*dt^2
+   if (c->bend*h*h > flatness)
+      k = (int) STBTT_sqrt(c->bend*h*h / flatness) + 1;
+
+   ax = c->x0 - 2*c->x1 + c->x2, ay = c->y0 - 2*c->y1 + c->y2;
+   bx = 2*(c->x1 - c->x0), by = 2*(c->y1 - c->y0);
+   px = c->x0 + t0*(bx + t0*ax);
+   py = ya;
+   for (i=1; i <= k; ++i) {
+      float t = t0 + h*i/k;
+      float x = c->x0 + t*(bx + t*ax);
+      float y = i == k ? yb : c->y0 + t*(by + t*ay);
+      if (y > py) {
+         e.fdx = (x - px) / (y - py);
+         e.fdy = e.fdx != 0.0f ? (1.0f/e.fdx) : 0.0f;
+         e.fx = px + e.fdx * (y_top - py);
+         e.sy = py;
+         e.ey = y;
+         stbtt__fill_active_edge_new(scanline, scanline_fill, touched, len, &e, y_top);
+         px = x, py = y;
+      }
+   }
+}
+
+// scanline on which a curve becomes active, or -1 if it misses the bitmap
+static int stbtt__curve_row(stbtt__curve *c, int off_y, int h)
 {
+   int row = STBTT_ifloor(c->y0) - off_y;
+   if (c->y2 <= off_y || row >= h)
+      return -1;
+   return row < 0 ? 0 : row;
+}
+
+// rasterize straight from the glyph outline: no flattening, and no point or
+// edge lists. curves are split into y-monotonic pieces, bucketed by the
+// scanline they start on, and each scanline takes the chords of the part of
+// each active curve inside it.
+static void stbtt__rasterize_curves(stbtt__bitmap *result, float flatness, stbtt_vertex *vertices, int num_verts, const float *mtx, int off_x, int off_y, void *userdata)
+{
+   stbtt__accumulate_func *accumulate = stbtt__select_accumulate();
+   int max_curves = num_verts*2 + 1; // a curve splits in at most two, plus the closing lines
+   int w = result->w, h = result->h;
+   int i, j, m, n = 0, num_active = 0;
+   float x = 0, y = 0, start_x = 0, start_y = 0;
+   float *scanline, *scanline2;
+   int *row_end, *order, *active;
+   unsigned char *touched;
+   stbtt__curve *curves;
+   size_t size;
+
+   if (w <= 0 || h <= 0)
+      return;
+
+   size = max_curves * sizeof(stbtt__curve) + (w*2+1) * sizeof(float)
+        + (h + max_curves*2) * sizeof(int) + STBTT__GRANULES(w);
+   curves = (stbtt__curve *) STBTT_malloc(size, userdata);
+   if (curves == NULL)
+      return;
+   scanline  = (float *) (curves + max_curves);
+   scanline2 = scanline + w;
+   row_end   = (int *) (scanline2 + w + 1);
+   order     = row_end + h;
+   active    = order + max_curves;
+   touched   = (unsigned char *) (active + max_curves);
+
+   for (i=0; i < num_verts; ++i) {
+      float vx = vertices[i].x * mtx[0] + vertices[i].y * mtx[1] + mtx[2] - off_x;
+      float vy = vertices[i].x * mtx[3] + vertices[i].y * mtx[4] + mtx[5];
+      switch (vertices[i].type) {
+         case STBTT_vmove:
+            // close the previous contour
+            if (i > 0)
+               stbtt__add_line(curves, &n, x,y, start_x,start_y);
+            start_x = vx, start_y = vy;
+            break;
+         case STBTT_vline:
+            stbtt__add_line(curves, &n, x,y, vx,vy);
+            break;
+         case STBTT_vcurve:
+            stbtt__add_curve(curves, &n, x,y,
+                             vertices[i].cx * mtx[0] + vertices[i].cy * mtx[1] + mtx[2] - off_x,
+                             vertices[i].cx * mtx[3] + vertices[i].cy * mtx[4] + mtx[5],
+                             vx,vy);
+            break;
+      }
+      x = vx, y = vy;
+   }
+   if (num_verts > 0)
+      stbtt__add_line(curves, &n, x,y, start_x,start_y);
+
+   // counting sort of the curves by the scanline they become active on;
+   // afterwards the curves of row j are order[row_end[j-1] .. row_end[j]-1]
+   STBTT_memset(row_end, 0, h * sizeof(int));
+   for (i=0; i < n; ++i) {
+      int row = stbtt__curve_row(&curves[i], off_y, h);
+      if (row >= 0) ++row_end[row];
+   }
+   for (j=0, m=0; j < h; ++j) {
+      int count = row_end[j];
+      row_end[j] = m;
+      m += count;
+   }
+   for (i=0; i < n; ++i) {
+      int row = stbtt__curve_row(&curves[i], off_y, h);
+      if (row >= 0) order[row_end[row]++] = i;
+   }
+
+   STBTT_memset(scanline, 0, (w*2+1) * sizeof(float));
+   STBTT_memset(touched, 0, STBTT__GRANULES(w));
+
+   for (j=0, i=0; j < h; ++j) {
+      float y_top = (float) (off_y + j);
+      int k;
+
+      // drop the curves that ended above this scanline, add the ones starting on it
+      for (k=0, m=0; k < num_active; ++k)
+         if (curves[active[k]].y2 > y_top)
+            active[m++] = active[k];
+      num_active = m;
+      for (; i < row_end[j]; ++i)
+         active[num_active++] = order[i];
+
+      for (k=0; k < num_active; ++k)
+         stbtt__fill_curve(scanline, scanline2+1, touched, w, &curves[active[k]], y_top, flatness);
+
+      stbtt__resolve_row(result->pixels + j*result->stride, scanline, scanline2, touched, w, accumulate);
+   }
+
+   STBTT_free(curves, userdata);
+}
+#endif
+
+// Outlines made only of horizontal and vertical lines -- block elements, box
+// drawing, many punctuation and CJK strokes -- have an exact coverage that is
+// cheaper to compute than scanning edges: under an axis-aligned transform,
+// only the vertical edges contribute, each by the height it spans in a row.
+static int stbtt__shape_is_rectilinear(stbtt_vertex *vertices, int num_verts)
+{
+   int i, start = 0;
+   for (i=1; i <= num_verts; ++i) {
+      // at the end of each contour, check the implicit closing line too
+      int k = i < num_verts && vertices[i].type != STBTT_vmove ? i : start;
+      if (i < num_verts && vertices[i].type != STBTT_vmove && vertices[i].type != STBTT_vline)
+         return 0;
+      if (vertices[k].x != vertices[i-1].x && vertices[k].y != vertices[i-1].y)
+         return 0;
+      if (i < num_verts && vertices[i].type == STBTT_vmove)
+         start = i;
+   }
+   return num_verts > 0;
+}
+
+// a row's coverage differs from the previous one only if an edge ends within
+// a pixel of their shared boundary
+static void stbtt__mark_rows(unsigned char *changed, float y, int h)
+{
+   if (y > -1 && y < h) {
+      int j = (int) STBTT_ifloor(y);
+      if (j >= 0) changed[j] = 1;
+      changed[j+1] = 1;
+   }
+}
+
+static void stbtt__rasterize_rectilinear(stbtt__bitmap *result, stbtt_vertex *vertices, int num_verts, const float *mtx, int off_x, int off_y, void *userdata)
+{
+   stbtt__edge *e;
+   float *row;
+   unsigned char *changed;
+   int i, j, n = 0, start = 0;
+
+   for (i=1; i <= num_verts; ++i) {
+      int k = i < num_verts && vertices[i].type != STBTT_vmove ? i : start;
+      if (vertices[k].x == vertices[i-1].x && vertices[k].y != vertices[i-1].y)
+         ++n;
+      if (i < num_verts && vertices[i].type == STBTT_vmove)
+         start = i;
+   }
+   e = (stbtt__edge *) STBTT_malloc(sizeof(*e) * (n+1) + sizeof(float) * (result->w+2) + result->h+1, userdata);
+   if (e == NULL) return;
+   row = (float *) (e + n+1);
+   changed = (unsigned char *) (row + result->w+2);
+   STBTT_memset(changed, 0, result->h+1);
+   changed[0] = 1;
+
+   n = 0;
+   for (i=1, start=0; i <= num_verts; ++i) {
+      int k = i < num_verts && vertices[i].type != STBTT_vmove ? i : start;
+      if (vertices[k].x == vertices[i-1].x && vertices[k].y != vertices[i-1].y) {
+         float y0 = vertices[i-1].y * mtx[4] + mtx[5];
+         float y1 = vertices[k].y * mtx[4] + mtx[5];
+         e[n].invert = y0 > y1;
+         e[n].x0 = e[n].x1 = vertices[k].x * mtx[0] + mtx[2] - off_x;
+         e[n].y0 = e[n].invert ? y1 : y0;
+         e[n].y1 = e[n].invert ? y0 : y1;
+         stbtt__mark_rows(changed, e[n].y0 - off_y, result->h);
+         stbtt__mark_rows(changed, e[n].y1 - off_y, result->h);
+         ++n;
+      }
+      if (i < num_verts && vertices[i].type == STBTT_vmove)
+         start = i;
+   }
+
+   for (j=0; j < result->h; ++j) {
+      unsigned char *out = result->pixels + j*result->stride;
+      float top = (float) (off_y + j), bottom = top + 1, sum = 0;
+      if (!changed[j]) {
+         // no edge starts or ends within a pixel of this row: same as the last
+         STBTT_memcpy(out, out - result->stride, result->w);
+         continue;
+      }
+      STBTT_memset(row, 0, sizeof(float) * (result->w+2));
+      for (i=0; i < n; ++i) {
+         float d, x;
+         if (e[i].y1 <= top || e[i].y0 >= bottom) continue;
+         d = (e[i].y1 < bottom ? e[i].y1 : bottom) - (e[i].y0 > top ? e[i].y0 : top);
+         if (e[i].invert) d = -d;
+         x = e[i].x0;
+         if (x <= 0)
+            row[0] += d;
+         else if (x < result->w) {
+            // the pixel the edge crosses gets the part right of it, the
+            // pixels after it all of it
+            int ix = (int) x;
+            float f = x - ix;
+            row[ix  ] += d * (1-f);
+            row[ix+1] += d * f;
+         }
+      }
+      for (i=0; i < result->w; ++i) {
+         int m;
+         sum += row[i];
+         m = (int) (STBTT_fabs(sum) * 255 + 0.5f);
+         out[i] = (unsigned char) (m > 255 ? 255 : m);
+      }
+   }
+   STBTT_free(e, userdata);
+}
+
+static void stbtt__rasterize_outline(stbtt__bitmap *result, float flatness_in_pixels, stbtt_vertex *vertices, int num_verts, const float *mtx, int x_off, int y_off, void *userdata)
+{
+#if defined(STBTT_RASTERIZE_CURVES)
+   stbtt__rasterize_curves(result, flatness_in_pixels, vertices, num_verts, mtx, x_off, y_off, userdata);
+#elif STBTT_RASTERIZER_VERSION == 2
+   int n;
+   stbtt__edge *e = stbtt__build_edges(vertices, num_verts, flatness_in_pixels, mtx, &n, userdata);
+   if (e) {
+      n = stbtt__clip_edge_rows(e, n, (float) y_off, (float) (y_off + result->h));
+      stbtt__sort_edges(e, n, userdata);
+      stbtt__rasterize_sorted_edges(result, e, n, 1, x_off, y_off, userdata);
+      STBTT_free(e, userdata);
+   }
+#elif STBTT_RASTERIZER_VERSION == 3
+   int n;
+   stbtt__edge *e = stbtt__build_edges(vertices, num_verts, flatness_in_pixels, mtx, &n, userdata);
+   if (e) {
+      stbtt__rasterize_edges_fixed(result, e, n, x_off, y_off, userdata);
+      STBTT_free(e, userdata);
+   }
+#else
+   // flatten at the finer of the scales along the outline's x and y axes
+   float scale_x = (float) STBTT_sqrt(mtx[0]*mtx[0] + mtx[3]*mtx[3]);
+   float scale_y = (float) STBTT_sqrt(mtx[1]*mtx[1] + mtx[4]*mtx[4]);
    float scale = scale_x > scale_y ? scale_y : scale_x;
    int winding_count, *winding_lengths;
    stbtt__point *windings = stbtt_FlattenCurves(vertices, num_verts, flatness_in_pixels / scale, &winding_lengths, &winding_count, userdata);
    if (windings) {
-      stbtt__rasterize(result, windings, winding_lengths, winding_count, scale_x, scale_y, shift_x, shift_y, x_off, y_off, invert, userdata);
+      stbtt__rasterize(result, windings, winding_lengths, winding_count, mtx, x_off, y_off, userdata);
       STBTT_free(winding_lengths, userdata);
       STBTT_free(windings, userdata);
    }
+#endif
+}
+
+// rasterize an outline mapped to the bitmap by the transform mtx
+static void stbtt__rasterize_transform(stbtt__bitmap *result, float flatness_in_pixels, stbtt_vertex *vertices, int num_verts, const float *mtx, int x_off, int y_off, void *userdata)
+{
+   if (mtx[1] == 0 && mtx[3] == 0 && stbtt__shape_is_rectilinear(vertices, num_verts))
+      stbtt__rasterize_rectilinear(result, vertices, num_verts, mtx, x_off, y_off, userdata);
+   else
+      stbtt__rasterize_outline(result, flatness_in_pixels, vertices, num_verts, mtx, x_off, y_off, userdata);
+}
+
+STBTT_DEF void stbtt_Rasterize(stbtt__bitmap *result, float flatness_in_pixels, stbtt_vertex *vertices, int num_verts, float scale_x, float scale_y, float shift_x, float shift_y, int x_off, int y_off, int invert, void *userdata)
+{
+   float mtx[6];
+   stbtt__scale_transform(mtx, scale_x, scale_y, shift_x, shift_y, invert);
+   stbtt__rasterize_transform(result, flatness_in_pixels, vertices, num_verts, mtx, x_off, y_off, userdata);
 }
 
 STBTT_DEF void stbtt_FreeBitmap(unsigned char *bitmap, void *userdata)
@@ -2460,6 +3746,89 @@ STBTT_DEF unsigned char *stbtt_GetGlyphBitmapSubpixel(const stbtt_fontinfo *info
    return gbm.pixels;
 }   
 
+STBTT_DEF void stbtt_FreeSpans(stbtt_span *spans, void *userdata)
+{
+   STBTT_free(spans, userdata);
+}
+
+STBTT_DEF stbtt_span *stbtt_GetGlyphSpans(const stbtt_fontinfo *info, float scale_x, float scale_y, float shift_x, float shift_y, int glyph, int *num_spans, int *width, int *height, int *xoff, int *yoff)
+{
+   int ix0,iy0,ix1,iy1;
+   stbtt__bitmap gbm;
+   stbtt__span_list list;
+   stbtt_vertex *vertices;
+   int num_verts = stbtt_GetGlyphShape(info, glyph, &vertices);
+
+   *num_spans = 0;
+   if (scale_x == 0) scale_x = scale_y;
+   if (scale_y == 0) {
+      if (scale_x == 0) {
+         STBTT_free(vertices, info->userdata);
+         return NULL;
+      }
+      scale_y = scale_x;
+   }
+
+   stbtt_GetGlyphBitmapBoxSubpixel(info, glyph, scale_x, scale_y, shift_x, shift_y, &ix0,&iy0,&ix1,&iy1);
+   gbm.w = (ix1 - ix0);
+   gbm.h = (iy1 - iy0);
+   gbm.pixels = NULL;
+   gbm.stride = gbm.w;
+
+   if (width ) *width  = gbm.w;
+   if (height) *height = gbm.h;
+   if (xoff  ) *xoff   = ix0;
+   if (yoff  ) *yoff   = iy0;
+
+   list.spans = NULL;
+   list.count = list.capacity = list.error = 0;
+   list.userdata = info->userdata;
+
+   if (gbm.w && gbm.h) {
+#if STBTT_RASTERIZER_VERSION == 2 && !defined(STBTT_RASTERIZE_CURVES)
+      // sweep the rows into a single row of pixels. rectilinear shapes get
+      // the exact fill of stbtt_Rasterize instead, so the spans stay the
+      // same as the bitmap
+      if (!stbtt__shape_is_rectilinear(vertices, num_verts)) {
+         float mtx[6];
+         int n;
+         stbtt__edge *e;
+         stbtt__scale_transform(mtx, scale_x, scale_y, shift_x, shift_y, 1);
+         e = stbtt__build_edges(vertices, num_verts, 0.35f, mtx, &n, info->userdata);
+         list.row = (unsigned char *) STBTT_malloc(gbm.w, info->userdata);
+         if (e && list.row) {
+            stbtt__sort_edges(e, n, info->userdata);
+            e[n].y0 = (float) (iy0 + gbm.h) + 1;
+            stbtt__rasterize_sorted_edges_band(&gbm, e, n, ix0, iy0, 0, gbm.h, &list, info->userdata);
+         } else
+            list.error = 1;
+         STBTT_free(list.row, info->userdata);
+         STBTT_free(e, info->userdata);
+      } else
+#endif
+      {
+         int y;
+         gbm.pixels = (unsigned char *) STBTT_malloc(gbm.w * gbm.h, info->userdata);
+         if (gbm.pixels) {
+            stbtt_Rasterize(&gbm, 0.35f, vertices, num_verts, scale_x, scale_y, shift_x, shift_y, ix0, iy0, 1, info->userdata);
+            for (y=0; y < gbm.h; ++y)
+               stbtt__emit_spans(&list, y, gbm.pixels + y*gbm.stride, gbm.w);
+            STBTT_free(gbm.pixels, info->userdata);
+         } else
+            list.error = 1;
+      }
+   }
+   STBTT_free(vertices, info->userdata);
+
+   if (list.error) {
+      STBTT_free(list.spans, info->userdata);
+      *num_spans = -1;
+      return NULL;
+   }
+   *num_spans = list.count;
+   return list.spans;
+}
+
 STBTT_DEF unsigned char *stbtt_GetGlyphBitmap(const stbtt_fontinfo *info, float scale_x, float scale_y, int glyph, int *width, int *height, int *xoff, int *yoff)
 {
    return stbtt_GetGlyphBitmapSubpixel(info, scale_x, scale_y, 0.0f, 0.0f, glyph, width, height, xoff, yoff);
@@ -2484,11 +3853,436 @@ STBTT_DEF void stbtt_MakeGlyphBitmapSubpixel(const stbtt_fontinfo *info, unsigne
    STBTT_free(vertices, info->userdata);
 }
 
+STBTT_DEF void stbtt_MakeGlyphBitmapTile(const stbtt_fontinfo *info, unsigned char *output, int tile_x, int tile_y, int tile_w, int tile_h, int out_stride, float scale_x, float scale_y, float shift_x, float shift_y, int glyph)
+{
+   int ix0,iy0;
+   stbtt_vertex *vertices;
+   int num_verts = stbtt_GetGlyphShape(info, glyph, &vertices);
+   stbtt__bitmap gbm;
+
+   stbtt_GetGlyphBitmapBoxSubpixel(info, glyph, scale_x, scale_y, shift_x, shift_y, &ix0,&iy0,0,0);
+   gbm.pixels = output;
+   gbm.w = tile_w;
+   gbm.h = tile_h;
+   gbm.stride = out_stride;
+
+   // the tile is the bitmap, with its origin moved to the tile's corner
+   if (gbm.w > 0 && gbm.h > 0)
+      stbtt_Rasterize(&gbm, 0.35f, vertices, num_verts, scale_x, scale_y, shift_x, shift_y, ix0+tile_x,iy0+tile_y, 1, info->userdata);
+
+   STBTT_free(vertices, info->userdata);
+}
+
+STBTT_DEF void stbtt_MakeGlyphBitmapTransform(const stbtt_fontinfo *info, unsigned char *output, int out_w, int out_h, int out_stride, const float transform[6], int glyph)
+{
+   int ix0,iy0;
+   stbtt_vertex *vertices;
+   int num_verts = stbtt_GetGlyphShape(info, glyph, &vertices);
+   stbtt__bitmap gbm;
+
+   stbtt_GetGlyphBitmapBoxTransform(info, glyph, transform, &ix0,&iy0,0,0);
+   gbm.pixels = output;
+   gbm.w = out_w;
+   gbm.h = out_h;
+   gbm.stride = out_stride;
+
+   if (gbm.w && gbm.h)
+      stbtt__rasterize_transform(&gbm, 0.35f, vertices, num_verts, transform, ix0,iy0, info->userdata);
+
+   STBTT_free(vertices, info->userdata);
+}
+
+STBTT_DEF void stbtt_GetRunBitmapBox(const stbtt_fontinfo *font, const stbtt_run_glyph *glyphs, int num_glyphs, float scale_x, float scale_y, int *ix0, int *iy0, int *ix1, int *iy1)
+{
+   int x0=0,y0=0,x1=0,y1=0,i,empty=1;
+   for (i=0; i < num_glyphs; ++i) {
+      int gx0,gy0,gx1,gy1;
+      stbtt_GetGlyphBitmapBoxSubpixel(font, glyphs[i].glyph, scale_x, scale_y, glyphs[i].x, glyphs[i].y, &gx0,&gy0,&gx1,&gy1);
+      if (gx0 == gx1 || gy0 == gy1)
+         continue;
+      if (empty || gx0 < x0) x0 = gx0;
+      if (empty || gy0 < y0) y0 = gy0;
+      if (empty || gx1 > x1) x1 = gx1;
+      if (empty || gy1 > y1) y1 = gy1;
+      empty = 0;
+   }
+   if (ix0) *ix0 = x0;
+   if (iy0) *iy0 = y0;
+   if (ix1) *ix1 = x1;
+   if (iy1) *iy1 = y1;
+}
+
+STBTT_DEF void stbtt_MakeRunBitmap(const stbtt_fontinfo *info, unsigned char *output, int out_w, int out_h, int out_stride, float scale_x, float scale_y, const stbtt_run_glyph *glyphs, int num_glyphs)
+{
+   int ix0,iy0,i;
+   stbtt__bitmap gbm;
+
+   stbtt_GetRunBitmapBox(info, glyphs, num_glyphs, scale_x, scale_y, &ix0,&iy0,0,0);
+   gbm.pixels = output;
+   gbm.w = out_w;
+   gbm.h = out_h;
+   gbm.stride = out_stride;
+   if (gbm.w <= 0 || gbm.h <= 0)
+      return;
+   for (i=0; i < gbm.h; ++i)
+      STBTT_memset(gbm.pixels + i*gbm.stride, 0, gbm.w);
+
+#if (STBTT_RASTERIZER_VERSION == 2 || STBTT_RASTERIZER_VERSION == 3) && !defined(STBTT_RASTERIZE_CURVES)
+   {
+      stbtt_vertex **vertices = (stbtt_vertex **) STBTT_malloc(sizeof(*vertices) * num_glyphs, info->userdata);
+      int *num_verts = (int *) STBTT_malloc(sizeof(*num_verts) * num_glyphs, info->userdata);
+      stbtt__edge *e = NULL;
+      float mtx[6];
+      int n = 0;
+
+      if (vertices && num_verts) {
+         // count the edges of the whole run, then emit them in one list
+         for (i=0; i < num_glyphs; ++i) {
+            num_verts[i] = stbtt_GetGlyphShape(info, glyphs[i].glyph, &vertices[i]);
+            stbtt__scale_transform(mtx, scale_x, scale_y, glyphs[i].x, glyphs[i].y, 1);
+            n += stbtt__emit_edges(NULL, vertices[i], num_verts[i], 0.35f, mtx);
+         }
+         e = (stbtt__edge *) STBTT_malloc(sizeof(*e) * (n+1), info->userdata); // add an extra one as a sentinel
+         if (e) {
+            n = 0;
+            for (i=0; i < num_glyphs; ++i) {
+               stbtt__scale_transform(mtx, scale_x, scale_y, glyphs[i].x, glyphs[i].y, 1);
+               n += stbtt__emit_edges(e + n, vertices[i], num_verts[i], 0.35f, mtx);
+            }
+         }
+         for (i=0; i < num_glyphs; ++i)
+            STBTT_free(vertices[i], info->userdata);
+      }
+      if (e) {
+#if STBTT_RASTERIZER_VERSION == 2
+         n = stbtt__clip_edge_rows(e, n, (float) iy0, (float) (iy0 + gbm.h));
+         stbtt__sort_edges(e, n, info->userdata);
+         stbtt__rasterize_sorted_edges(&gbm, e, n, 1, ix0, iy0, info->userdata);
+#else
+         stbtt__rasterize_edges_fixed(&gbm, e, n, ix0, iy0, info->userdata);
+#endif
+         STBTT_free(e, info->userdata);
+      }
+      STBTT_free(num_verts, info->userdata);
+      STBTT_free(vertices, info->userdata);
+   }
+#else
+   for (i=0; i < num_glyphs; ++i) {
+      // draw the glyph on its own, then add it to the run
+      stbtt__bitmap g;
+      stbtt_vertex *vertices;
+      int num_verts, gx0,gy0,gx1,gy1,x,y;
+      float mtx[6];
+      stbtt_GetGlyphBitmapBoxSubpixel(info, glyphs[i].glyph, scale_x, scale_y, glyphs[i].x, glyphs[i].y, &gx0,&gy0,&gx1,&gy1);
+      g.w = gx1 - gx0;
+      g.h = gy1 - gy0;
+      g.stride = g.w;
+      if (g.w <= 0 || g.h <= 0)
+         continue;
+      g.pixels = (unsigned char *) STBTT_malloc(g.w * g.h, info->userdata);
+      if (g.pixels == NULL)
+         continue;
+      num_verts = stbtt_GetGlyphShape(info, glyphs[i].glyph, &vertices);
+      stbtt__scale_transform(mtx, scale_x, scale_y, glyphs[i].x, glyphs[i].y, 1);
+      stbtt__rasterize_transform(&g, 0.35f, vertices, num_verts, mtx, gx0,gy0, info->userdata);
+      STBTT_free(vertices, info->userdata);
+      for (y=0; y < g.h; ++y) {
+         int oy = gy0 - iy0 + y;
+         if (oy < 0 || oy >= gbm.h) continue;
+         for (x=0; x < g.w; ++x) {
+            int ox = gx0 - ix0 + x, v;
+            if (ox < 0 || ox >= gbm.w) continue;
+            v = gbm.pixels[oy*gbm.stride + ox] + g.pixels[y*g.stride + x];
+            gbm.pixels[oy*gbm.stride + ox] = (unsigned char) (v > 255 ? 255 : v);
+         }
+      }
+      STBTT_free(g.pixels, info->userdata);
+   }
+#endif
+}
+
+// the arms of the box drawing characters U+2500..U+257F, from their Unicode
+// names: 2 bits each for up, right, down and left, 1 for a light line and 2
+// for a heavy one. 0 for the double lines, arcs and diagonals.
+static const unsigned char stbtt__box_arms[128] = {
+   0x44,0x88,0x11,0x22,0x44,0x88,0x11,0x22,0x44,0x88,0x11,0x22,0x14,0x18,0x24,0x28,
+   0x50,0x90,0x60,0xa0,0x05,0x09,0x06,0x0a,0x41,0x81,0x42,0x82,0x15,0x19,0x16,0x25,
+   0x26,0x1a,0x29,0x2a,0x51,0x91,0x52,0x61,0x62,0x92,0xa1,0xa2,0x54,0x94,0x58,0x98,
+   0x64,0xa4,0x68,0xa8,0x45,0x85,0x49,0x89,0x46,0x86,0x4a,0x8a,0x55,0x95,0x59,0x99,
+   0x56,0x65,0x66,0x96,0x5a,0xa5,0x69,0x9a,0xa9,0xa6,0x6a,0xaa,0x44,0x88,0x11,0x22,
+   0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+   0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+   0x00,0x00,0x00,0x00,0x40,0x01,0x04,0x10,0x80,0x02,0x08,0x20,0x48,0x21,0x84,0x12,
+};
+
+// the filled quarters of U+2596..U+259F: 1 upper left, 2 upper right, 4
+// lower left, 8 lower right
+static const unsigned char stbtt__block_quadrants[10] = { 4,8,1,13,9,7,11,2,6,14 };
+
+// adds the coverage of the rectangle x0..x1, y0..y1, exact at fractional
+// pixel edges
+static void stbtt__fill_rect(unsigned char *output, int w, int h, int stride, float x0, float y0, float x1, float y1, float coverage)
+{
+   int i,j;
+   if (x0 < 0) x0 = 0;
+   if (y0 < 0) y0 = 0;
+   if (x1 > w) x1 = (float) w;
+   if (y1 > h) y1 = (float) h;
+   for (j = (int) y0; j < y1; ++j) {
+      float cy = (j+1 < y1 ? j+1 : y1) - (j > y0 ? j : y0);
+      for (i = (int) x0; i < x1; ++i) {
+         float cx = (i+1 < x1 ? i+1 : x1) - (i > x0 ? i : x0);
+         int v = output[j*stride + i] + (int) (cx*cy*coverage*255 + 0.5f);
+         output[j*stride + i] = (unsigned char) (v > 255 ? 255 : v);
+      }
+   }
+}
+
+static void stbtt__draw_box_lines(unsigned char *output, int w, int h, int stride, int arms, int dashes)
+{
+   int light = (w+4) / 8, t[4], k, i;
+   int hx0 = w, hx1 = 0, vy0 = h, vy1 = 0;
+   if (light < 1) light = 1;
+   for (k=0; k < 4; ++k)
+      t[k] = ((arms >> (2*k)) & 3) * light;
+
+   // lines run into the middle of the cell, or across the lines they meet
+   for (k=0; k < 4; k += 2) {
+      if (t[k] == 0) continue;
+      if ((w - t[k])/2 < hx0) hx0 = (w - t[k])/2;
+      if ((w - t[k])/2 + t[k] > hx1) hx1 = (w - t[k])/2 + t[k];
+   }
+   for (k=1; k < 4; k += 2) {
+      if (t[k] == 0) continue;
+      if ((h - t[k])/2 < vy0) vy0 = (h - t[k])/2;
+      if ((h - t[k])/2 + t[k] > vy1) vy1 = (h - t[k])/2 + t[k];
+   }
+   if (hx0 > hx1) hx0 = (w - light)/2, hx1 = hx0 + light;
+   if (vy0 > vy1) vy0 = (h - light)/2, vy1 = vy0 + light;
+
+   if (dashes) {
+      // a straight line broken into dashes, with a gap after each
+      int horizontal = t[1] != 0, len = horizontal ? w : h;
+      int th = horizontal ? t[1] : t[0];
+      for (i=0; i < dashes; ++i) {
+         int a = i * len / dashes, b = (i+1) * len / dashes;
+         b -= (b - a) > 1 ? ((b - a) / 4 > 0 ? (b - a) / 4 : 1) : 0;
+         if (horizontal)
+            stbtt__fill_rect(output, w, h, stride, (float) a, (float) ((h - th)/2), (float) b, (float) ((h - th)/2 + th), 1);
+         else
+            stbtt__fill_rect(output, w, h, stride, (float) ((w - th)/2), (float) a, (float) ((w - th)/2 + th), (float) b, 1);
+      }
+      return;
+   }
+
+   if (t[0]) stbtt__fill_rect(output, w, h, stride, (float) ((w - t[0])/2), 0, (float) ((w - t[0])/2 + t[0]), (float) vy1, 1);
+   if (t[2]) stbtt__fill_rect(output, w, h, stride, (float) ((w - t[2])/2), (float) vy0, (float) ((w - t[2])/2 + t[2]), (float) h, 1);
+   if (t[1]) stbtt__fill_rect(output, w, h, stride, (float) hx0, (float) ((h - t[1])/2), (float) w, (float) ((h - t[1])/2 + t[1]), 1);
+   if (t[3]) stbtt__fill_rect(output, w, h, stride, 0, (float) ((h - t[3])/2), (float) hx1, (float) ((h - t[3])/2 + t[3]), 1);
+}
+
+STBTT_DEF int stbtt_MakeBoxDrawingBitmap(unsigned char *output, int out_w, int out_h, int out_stride, int codepoint)
+{
+   float w = (float) out_w, h = (float) out_h;
+   int i, arms = 0, dashes = 0;
+
+   if (codepoint >= 0x2500 && codepoint < 0x2580) {
+      arms = stbtt__box_arms[codepoint - 0x2500];
+      if (arms == 0) return 0;
+      if (codepoint >= 0x2504 && codepoint <= 0x250b)
+         dashes = codepoint < 0x2508 ? 3 : 4;
+      else if (codepoint >= 0x254c && codepoint <= 0x254f)
+         dashes = 2;
+   } else if (codepoint < 0x2580 || codepoint > 0x259f)
+      return 0;
+
+   if (out_w <= 0 || out_h <= 0)
+      return 1;
+   for (i=0; i < out_h; ++i)
+      STBTT_memset(output + i*out_stride, 0, out_w);
+
+   if (arms)
+      stbtt__draw_box_lines(output, out_w, out_h, out_stride, arms, dashes);
+   else if (codepoint == 0x2580) // upper half
+      stbtt__fill_rect(output, out_w, out_h, out_stride, 0, 0, w, h/2, 1);
+   else if (codepoint <= 0x2588) // lower eighths
+      stbtt__fill_rect(output, out_w, out_h, out_stride, 0, h - h*(codepoint - 0x2580)/8, w, h, 1);
+   else if (codepoint <= 0x258f) // left eighths
+      stbtt__fill_rect(output, out_w, out_h, out_stride, 0, 0, w*(0x2590 - codepoint)/8, h, 1);
+   else if (codepoint == 0x2590) // right half
+      stbtt__fill_rect(output, out_w, out_h, out_stride, w/2, 0, w, h, 1);
+   else if (codepoint <= 0x2593) // light, medium and dark shade
+      stbtt__fill_rect(output, out_w, out_h, out_stride, 0, 0, w, h, (codepoint - 0x2590) / 4.0f);
+   else if (codepoint == 0x2594) // upper eighth
+      stbtt__fill_rect(output, out_w, out_h, out_stride, 0, 0, w, h/8, 1);
+   else if (codepoint == 0x2595) // right eighth
+      stbtt__fill_rect(output, out_w, out_h, out_stride, w*7/8, 0, w, h, 1);
+   else {
+      int q = stbtt__block_quadrants[codepoint - 0x2596];
+      if (q & 1) stbtt__fill_rect(output, out_w, out_h, out_stride, 0, 0, w/2, h/2, 1);
+      if (q & 2) stbtt__fill_rect(output, out_w, out_h, out_stride, w/2, 0, w, h/2, 1);
+      if (q & 4) stbtt__fill_rect(output, out_w, out_h, out_stride, 0, h/2, w/2, h, 1);
+      if (q & 8) stbtt__fill_rect(output, out_w, out_h, out_stride, w/2, h/2, w, h, 1);
+   }
+   return 1;
+}
+
 STBTT_DEF void stbtt_MakeGlyphBitmap(const stbtt_fontinfo *info, unsigned char *output, int out_w, int out_h, int out_stride, float scale_x, float scale_y, int glyph)
 {
    stbtt_MakeGlyphBitmapSubpixel(info, output, out_w, out_h, out_stride, scale_x, scale_y, 0.0f,0.0f, glyph);
 }
 
+STBTT_DEF void stbtt_MakeGlyphBitmapPhases(const stbtt_fontinfo *info, stbtt_glyph_phase *phases, int num_phases, int out_stride, float scale_x, float scale_y, int glyph)
+{
+   stbtt_vertex *vertices;
+   int num_verts = stbtt_GetGlyphShape(info, glyph, &vertices);
+   stbtt__edge *e = NULL, *work = NULL;
+   float mtx[6];
+   int i, k, n = 0;
+
+#if (STBTT_RASTERIZER_VERSION == 2 || STBTT_RASTERIZER_VERSION == 3) && !defined(STBTT_RASTERIZE_CURVES)
+   // edges at shift 0, sorted once; rectilinear outlines have their own path
+   if (num_phases > 1 && !stbtt__shape_is_rectilinear(vertices, num_verts)) {
+      stbtt__scale_transform(mtx, scale_x, scale_y, 0,0, 1);
+      e = stbtt__build_edges(vertices, num_verts, 0.35f, mtx, &n, info->userdata);
+      if (e) {
+#if STBTT_RASTERIZER_VERSION == 2
+         stbtt__sort_edges(e, n, info->userdata);
+#endif
+         work = (stbtt__edge *) STBTT_malloc(sizeof(*work) * (n+1), info->userdata);
+      }
+   }
+#endif
+
+   for (i=0; i < num_phases; ++i) {
+      stbtt_glyph_phase *p = &phases[i];
+      stbtt__bitmap gbm;
+      int ix0,iy0;
+      stbtt_GetGlyphBitmapBoxSubpixel(info, glyph, scale_x, scale_y, p->shift_x, p->shift_y, &ix0,&iy0,0,0);
+      gbm.pixels = p->output;
+      gbm.w = p->w;
+      gbm.h = p->h;
+      gbm.stride = out_stride;
+      if (gbm.w <= 0 || gbm.h <= 0)
+         continue;
+      if (work) {
+         for (k=0; k < n; ++k) {
+            work[k] = e[k];
+            work[k].x0 += p->shift_x, work[k].x1 += p->shift_x;
+            work[k].y0 += p->shift_y, work[k].y1 += p->shift_y;
+         }
+#if STBTT_RASTERIZER_VERSION == 2
+         stbtt__rasterize_sorted_edges(&gbm, work, stbtt__clip_edge_rows(work, n, (float) iy0, (float) (iy0 + gbm.h)), 1, ix0, iy0, info->userdata);
+#elif STBTT_RASTERIZER_VERSION == 3
+         stbtt__rasterize_edges_fixed(&gbm, work, n, ix0, iy0, info->userdata);
+#endif
+      } else {
+         stbtt__scale_transform(mtx, scale_x, scale_y, p->shift_x, p->shift_y, 1);
+         stbtt__rasterize_transform(&gbm, 0.35f, vertices, num_verts, mtx, ix0, iy0, info->userdata);
+      }
+   }
+
+   STBTT_free(work, info->userdata);
+   STBTT_free(e, info->userdata);
+   STBTT_free(vertices, info->userdata);
+}
+
+#define STBTT__LANES  16
+
+#if STBTT_RASTERIZER_VERSION == 2 && !defined(STBTT_RASTERIZE_CURVES)
+// draw up to STBTT__LANES glyphs as one wide bitmap, each in its own lane of
+// columns with a blank one after it, and copy the lanes out. the coverage
+// of a lane sums back to zero by its blank column, so the lanes don't see
+// each other. a glyph whose outline leaves its lane is drawn on its own.
+// returns the number of glyphs consumed.
+static int stbtt__rasterize_lanes(const stbtt_fontinfo *info, stbtt_batch_glyph *glyphs, int num_glyphs, int out_stride, float scale_x, float scale_y)
+{
+   stbtt_vertex *vertices[STBTT__LANES];
+   int num_verts[STBTT__LANES], lane_x[STBTT__LANES], alone[STBTT__LANES];
+   float mtx[STBTT__LANES][6];
+   int lanes = num_glyphs < STBTT__LANES ? num_glyphs : STBTT__LANES;
+   int i, k, n = 0, m;
+   stbtt__bitmap gbm;
+   stbtt__edge *e;
+
+   gbm.w = gbm.h = 0;
+   for (i=0; i < lanes; ++i) {
+      stbtt_batch_glyph *g = &glyphs[i];
+      int ix0, iy0;
+      vertices[i] = NULL;
+      num_verts[i] = 0;
+      alone[i] = 0;
+      lane_x[i] = gbm.w;
+      if (g->w <= 0 || g->h <= 0)
+         continue;
+      num_verts[i] = stbtt_GetGlyphShape(info, g->glyph, &vertices[i]);
+      stbtt_GetGlyphBitmapBox(info, g->glyph, scale_x, scale_y, &ix0,&iy0,0,0);
+      stbtt__scale_transform(mtx[i], scale_x, scale_y, (float) (lane_x[i] - ix0), (float) -iy0, 1);
+      n += stbtt__emit_edges(NULL, vertices[i], num_verts[i], 0.35f, mtx[i]);
+      gbm.w += g->w + 1;
+      if (g->h > gbm.h) gbm.h = g->h;
+   }
+
+   e = (stbtt__edge *) STBTT_malloc(sizeof(*e) * (n+1), info->userdata);
+   gbm.stride = gbm.w;
+   gbm.pixels = (unsigned char *) STBTT_malloc(gbm.w * gbm.h, info->userdata);
+   if (e && gbm.pixels) {
+      n = 0;
+      for (i=0; i < lanes; ++i) {
+         float x0 = (float) lane_x[i], x1 = x0 + glyphs[i].w;
+         m = stbtt__emit_edges(e + n, vertices[i], num_verts[i], 0.35f, mtx[i]);
+         for (k=n; k < n+m; ++k)
+            if (e[k].x0 < x0 || e[k].x0 > x1 || e[k].x1 < x0 || e[k].x1 > x1 || e[k].y0 < 0)
+               break;
+         if (k < n+m)
+            alone[i] = 1; // drop its edges
+         else
+            n += m;
+      }
+   }
+   if (!e || !gbm.pixels || !stbtt__rasterize_edges_direct(&gbm, e, n, info->userdata)) {
+      // no memory for the lanes, draw every glyph on its own
+      STBTT_free(gbm.pixels, info->userdata);
+      STBTT_free(e, info->userdata);
+      gbm.pixels = NULL;
+      e = NULL;
+      for (i=0; i < lanes; ++i)
+         alone[i] = 1;
+   }
+
+   for (i=0; i < lanes; ++i) {
+      stbtt_batch_glyph *g = &glyphs[i];
+      if (g->w <= 0 || g->h <= 0) continue;
+      if (alone[i]) {
+         stbtt_MakeGlyphBitmap(info, g->output, g->w, g->h, out_stride, scale_x, scale_y, g->glyph);
+         continue;
+      }
+      for (k=0; k < g->h; ++k)
+         STBTT_memcpy(g->output + k*out_stride, gbm.pixels + k*gbm.stride + lane_x[i], g->w);
+   }
+
+   STBTT_free(gbm.pixels, info->userdata);
+   STBTT_free(e, info->userdata);
+   for (i=0; i < lanes; ++i)
+      STBTT_free(vertices[i], info->userdata);
+   return lanes;
+}
+#endif
+
+STBTT_DEF void stbtt_MakeGlyphBitmapBatch(const stbtt_fontinfo *info, stbtt_batch_glyph *glyphs, int num_glyphs, int out_stride, float scale_x, float scale_y)
+{
+#if STBTT_RASTERIZER_VERSION == 2 && !defined(STBTT_RASTERIZE_CURVES)
+   int i = 0;
+   while (i < num_glyphs)
+      i += stbtt__rasterize_lanes(info, glyphs + i, num_glyphs - i, out_stride, scale_x, scale_y);
+#else
+   int i;
+   for (i=0; i < num_glyphs; ++i)
+      if (glyphs[i].w > 0 && glyphs[i].h > 0)
+         stbtt_MakeGlyphBitmap(info, glyphs[i].output, glyphs[i].w, glyphs[i].h, out_stride, scale_x, scale_y, glyphs[i].glyph);
+#endif
+}
+
 STBTT_DEF unsigned char *stbtt_GetCodepointBitmapSubpixel(const stbtt_fontinfo *info, float scale_x, float scale_y, float shift_x, float shift_y, int codepoint, int *width, int *height, int *xoff, int *yoff)
 {
    return stbtt_GetGlyphBitmapSubpixel(info, scale_x, scale_y,shift_x,shift_y, stbtt_FindGlyphIndex(info,codepoint), width,height,xoff,yoff);
@@ -2873,10 +4667,36 @@ STBTT_DEF int stbtt_PackFontRangesGatherRects(stbtt_pack_context *spc, const stb
    return k;
 }
 
+static void stbtt__pack_prefilter(stbtt_pack_context *spc, stbrp_rect *r)
+{
+   if (spc->h_oversample > 1)
+      stbtt__h_prefilter(spc->pixels + r->x + r->y*spc->stride_in_bytes,
+                         r->w, r->h, spc->stride_in_bytes,
+                         spc->h_oversample);
+
+   if (spc->v_oversample > 1)
+      stbtt__v_prefilter(spc->pixels + r->x + r->y*spc->stride_in_bytes,
+                         r->w, r->h, spc->stride_in_bytes,
+                         spc->v_oversample);
+}
+
+static void stbtt__pack_flush(stbtt_pack_context *spc, const stbtt_fontinfo *info, float scale, stbtt_batch_glyph *batch, stbrp_rect **batch_rects, int count)
+{
+   int i;
+   stbtt_MakeGlyphBitmapBatch(info, batch, count, spc->stride_in_bytes,
+                              scale * spc->h_oversample,
+                              scale * spc->v_oversample);
+   for (i=0; i < count; ++i)
+      stbtt__pack_prefilter(spc, batch_rects[i]);
+}
+
 // rects array must be big enough to accommodate all characters in the given ranges
 STBTT_DEF int stbtt_PackFontRangesRenderIntoRects(stbtt_pack_context *spc, const stbtt_fontinfo *info, stbtt_pack_range *ranges, int num_ranges, stbrp_rect *rects)
 {
    int i,j,k, return_value = 1;
+   stbtt_batch_glyph batch[STBTT__LANES];
+   stbrp_rect *batch_rects[STBTT__LANES];
+   int num_batched = 0;
 
    // save current values
    int old_h_over = spc->h_oversample;
@@ -2897,7 +4717,7 @@ STBTT_DEF int stbtt_PackFontRangesRenderIntoRects(stbtt_pack_context *spc, const
          stbrp_rect *r = &rects[k];
          if (r->was_packed) {
             stbtt_packedchar *bc = &ranges[i].chardata_for_range[j];
-            int advance, lsb, x0,y0,x1,y1;
+            int advance, lsb, x0,y0,x1,y1, out_w,out_h;
             int codepoint = ranges[i].array_of_unicode_codepoints == NULL ? ranges[i].first_unicode_codepoint_in_range + j : ranges[i].array_of_unicode_codepoints[j];
             int glyph = stbtt_FindGlyphIndex(info, codepoint);
             stbrp_coord pad = (stbrp_coord) spc->padding;
@@ -2912,25 +4732,30 @@ STBTT_DEF int stbtt_PackFontRangesRenderIntoRects(stbtt_pack_context *spc, const
                                     scale * spc->h_oversample,
                                     scale * spc->v_oversample,
                                     &x0,&y0,&x1,&y1);
-            stbtt_MakeGlyphBitmapSubpixel(info,
-                                          spc->pixels + r->x + r->y*spc->stride_in_bytes,
-                                          r->w - spc->h_oversample+1,
-                                          r->h - spc->v_oversample+1,
-                                          spc->stride_in_bytes,
-                                          scale * spc->h_oversample,
-                                          scale * spc->v_oversample,
-                                          0,0,
-                                          glyph);
-
-            if (spc->h_oversample > 1)
-               stbtt__h_prefilter(spc->pixels + r->x + r->y*spc->stride_in_bytes,
-                                  r->w, r->h, spc->stride_in_bytes,
-                                  spc->h_oversample);
-
-            if (spc->v_oversample > 1)
-               stbtt__v_prefilter(spc->pixels + r->x + r->y*spc->stride_in_bytes,
-                                  r->w, r->h, spc->stride_in_bytes,
-                                  spc->v_oversample);
+            out_w = r->w - spc->h_oversample+1;
+            out_h = r->h - spc->v_oversample+1;
+            if (out_w <= STBTT_BATCH_MAX_SIZE && out_h <= STBTT_BATCH_MAX_SIZE) {
+               // small glyphs are drawn a batch at a time, and prefiltered after
+               batch[num_batched].glyph  = glyph;
+               batch[num_batched].output = spc->pixels + r->x + r->y*spc->stride_in_bytes;
+               batch[num_batched].w      = out_w;
+               batch[num_batched].h      = out_h;
+               batch_rects[num_batched++] = r;
+               if (num_batched == STBTT__LANES) {
+                  stbtt__pack_flush(spc, info, scale, batch, batch_rects, num_batched);
+                  num_batched = 0;
+               }
+            } else {
+               stbtt_MakeGlyphBitmapSubpixel(info,
+                                             spc->pixels + r->x + r->y*spc->stride_in_bytes,
+                                             out_w, out_h,
+                                             spc->stride_in_bytes,
+                                             scale * spc->h_oversample,
+                                             scale * spc->v_oversample,
+                                             0,0,
+                                             glyph);
+               stbtt__pack_prefilter(spc, r);
+            }
 
             bc->x0       = (stbtt_int16)  r->x;
             bc->y0       = (stbtt_int16)  r->y;
@@ -2947,6 +4772,10 @@ STBTT_DEF int stbtt_PackFontRangesRenderIntoRects(stbtt_pack_context *spc, const
 
          ++k;
       }
+      if (num_batched) {
+         stbtt__pack_flush(spc, info, scale, batch, batch_rects, num_batched);
+         num_batched = 0;
+      }
    }
 
    // restore original values
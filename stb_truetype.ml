@@ -64,6 +64,12 @@ external hmetrics : t -> glyph -> hmetrics = "ml_stbtt_GetGlyphHMetrics"
 
 external glyph_advance : t -> glyph -> int = "ml_stbtt_GetGlyphAdvance" [@@noalloc]
 external kern_advance : t -> glyph -> glyph -> int = "ml_stbtt_GetGlyphKernAdvance" [@@noalloc]
+external monospace_advance : t -> int = "ml_stbtt_GetFontMonospaceAdvance" [@@noalloc]
+
+let monospace_advance t =
+  match monospace_advance t with
+  | 0 -> None
+  | advance -> Some advance
 
 type box = {x0: int; y0: int; x1: int; y1: int}
 
@@ -75,7 +81,7 @@ external glyph_box : t -> glyph -> box = "ml_stbtt_GetGlyphBox"
 type pack_context
 
 external pack_begin : buffer -> width:int -> height:int -> stride:int -> padding:int -> pack_context option = "ml_stbtt_PackBegin"
-external pack_set_oversampling : pack_context -> h:int -> v:int -> unit = "ml_stbtt_PackSetOversampling" [@@noalloc]
+external pack_set_oversampling : pack_context -> h:int -> v:int -> unit = "ml_stbtt_PackSetOversampling"
 
 type char_range = {
   font_size: font_size;
@@ -110,11 +116,21 @@ external packed_chars_of_string : string -> packed_chars = "ml_stbtt_packed_char
 external string_of_packed_chars : packed_chars -> string = "ml_stbtt_string_of_packed_chars"
 
 
+external set_render_threads : int -> unit = "ml_stbtt_set_render_threads" [@@noalloc]
+
+(* Part of [box] inside [clip], if any *)
+let clip_box box clip =
+  let x0 = max box.x0 clip.x0 and y0 = max box.y0 clip.y0 in
+  let x1 = min box.x1 clip.x1 and y1 = min box.y1 clip.y1 in
+  if x0 < x1 && y0 < y1 then Some {x0; y0; x1; y1} else None
+
+external make_glyph_bitmap_tile: t -> buffer -> offset:int -> gw:int -> gh:int -> stride:int -> scale_x:float -> scale_y:float -> shift_x:float -> shift_y:float -> tile_x:int -> tile_y:int -> glyph -> unit
+  = "ml_stbtt_MakeGlyphBitmapTile_bc" "ml_stbtt_MakeGlyphBitmapTile"
+
 external make_glyph_bitmap: t -> buffer -> offset:int -> gw:int -> gh:int -> stride:int -> scale_x:float -> scale_y:float -> glyph -> unit
   = "ml_stbtt_MakeGlyphBitmap_bc" "ml_stbtt_MakeGlyphBitmap"
-  [@@noalloc]
 
-let make_glyph_bitmap t buffer ~width ~height ~scale_x ~scale_y box glyph =
+let make_glyph_bitmap t buffer ~width ~height ~scale_x ~scale_y ?clip box glyph =
   let dim = Bigarray.Array1.dim buffer in
   if width * height > dim then
     invalid_arg "Stb_truetype.make_glyph_bitmap: \
@@ -126,18 +142,32 @@ let make_glyph_bitmap t buffer ~width ~height ~scale_x ~scale_y box glyph =
       box.x0 box.y0 box.x1 box.y1;
   if box.x0 < 0 || box.y0 < 0 || box.x1 > width || box.y1 > height then
     invalid_arg "Stb_truetype.make_glyph_bitmap: box outside of buffer";
-  make_glyph_bitmap t buffer
-    ~stride:width
-    ~offset:(box.y0 * width + box.x0)
-    ~gw:(box.x1-box.x0)
-    ~gh:(box.y1-box.y0)
-    ~scale_x ~scale_y glyph
+  match clip with
+  | None ->
+    make_glyph_bitmap t buffer
+      ~stride:width
+      ~offset:(box.y0 * width + box.x0)
+      ~gw:(box.x1-box.x0)
+      ~gh:(box.y1-box.y0)
+      ~scale_x ~scale_y glyph
+  | Some clip ->
+    match clip_box box clip with
+    | None -> ()
+    | Some c ->
+      make_glyph_bitmap_tile t buffer
+        ~stride:width
+        ~offset:(c.y0 * width + c.x0)
+        ~gw:(c.x1-c.x0)
+        ~gh:(c.y1-c.y0)
+        ~scale_x ~scale_y
+        ~shift_x:0.0 ~shift_y:0.0
+        ~tile_x:(c.x0-box.x0) ~tile_y:(c.y0-box.y0)
+        glyph
 
 external make_glyph_bitmap_subpixel: t -> buffer -> offset:int -> gw:int -> gh:int -> stride:int -> scale_x:float -> scale_y:float -> shift_x:float -> shift_y:float -> glyph -> unit
   = "ml_stbtt_MakeGlyphBitmapSubpixel_bc" "ml_stbtt_MakeGlyphBitmapSubpixel"
-  [@@noalloc]
 
-let make_glyph_bitmap_subpixel t buffer ~width ~height ~scale_x ~scale_y ~shift_x ~shift_y box glyph =
+let make_glyph_bitmap_subpixel t buffer ~width ~height ~scale_x ~scale_y ~shift_x ~shift_y ?clip box glyph =
   let dim = Bigarray.Array1.dim buffer in
   if width * height > dim then
     invalid_arg "Stb_truetype.make_glyph_bitmap_subpixel: \
@@ -149,13 +179,50 @@ let make_glyph_bitmap_subpixel t buffer ~width ~height ~scale_x ~scale_y ~shift_
       box.x0 box.y0 box.x1 box.y1;
   if box.x0 < 0 || box.y0 < 0 || box.x1 > width || box.y1 > height then
     invalid_arg "Stb_truetype.make_glyph_bitmap_subpixel: box outside of buffer";
-  make_glyph_bitmap_subpixel t buffer
+  match clip with
+  | None ->
+    make_glyph_bitmap_subpixel t buffer
+      ~stride:width
+      ~offset:(box.y0 * width + box.x0)
+      ~gw:(box.x1-box.x0)
+      ~gh:(box.y1-box.y0)
+      ~scale_x ~scale_y
+      ~shift_x ~shift_y
+      glyph
+  | Some clip ->
+    match clip_box box clip with
+    | None -> ()
+    | Some c ->
+      make_glyph_bitmap_tile t buffer
+        ~stride:width
+        ~offset:(c.y0 * width + c.x0)
+        ~gw:(c.x1-c.x0)
+        ~gh:(c.y1-c.y0)
+        ~scale_x ~scale_y
+        ~shift_x ~shift_y
+        ~tile_x:(c.x0-box.x0) ~tile_y:(c.y0-box.y0)
+        glyph
+
+let make_glyph_bitmap_tile t buffer ~width ~height ~scale_x ~scale_y ~shift_x ~shift_y ~tile_x ~tile_y box glyph =
+  let dim = Bigarray.Array1.dim buffer in
+  if width * height > dim then
+    invalid_arg "Stb_truetype.make_glyph_bitmap_tile: \
+                 width * height bigger than buffer";
+  if box.x0 > box.x1 || box.y0 > box.y1 then
+    Printf.ksprintf invalid_arg
+      "Stb_truetype.make_glyph_bitmap_tile: malformed box \
+       {x0=%d; y0=%d; x1=%d; y1=%d}"
+      box.x0 box.y0 box.x1 box.y1;
+  if box.x0 < 0 || box.y0 < 0 || box.x1 > width || box.y1 > height then
+    invalid_arg "Stb_truetype.make_glyph_bitmap_tile: box outside of buffer";
+  make_glyph_bitmap_tile t buffer
     ~stride:width
     ~offset:(box.y0 * width + box.x0)
     ~gw:(box.x1-box.x0)
     ~gh:(box.y1-box.y0)
     ~scale_x ~scale_y
     ~shift_x ~shift_y
+    ~tile_x ~tile_y
     glyph
 
 external get_glyph_bitmap_box: t -> glyph -> scale_x:float -> scale_y:float -> box
@@ -164,9 +231,96 @@ external get_glyph_bitmap_box: t -> glyph -> scale_x:float -> scale_y:float -> b
 external get_glyph_bitmap_box_subpixel: t -> glyph -> scale_x:float -> scale_y:float -> shift_x:float -> shift_y:float -> box
   = "ml_stbtt_GetGlyphBitmapBoxSubpixel_bc" "ml_stbtt_GetGlyphBitmapBoxSubpixel"
 
+type transform = {
+  xx: float; xy: float; tx: float;
+  yx: float; yy: float; ty: float;
+}
+
+let transform_of_scale ?(shift_x=0.0) ?(shift_y=0.0) ~scale_x ~scale_y () =
+  {xx = scale_x; xy = 0.0; tx = shift_x;
+   yx = 0.0; yy = -. scale_y; ty = shift_y}
+
+external get_glyph_bitmap_box_transform: t -> glyph -> transform -> box
+  = "ml_stbtt_GetGlyphBitmapBoxTransform"
+
+external make_glyph_bitmap_transform: t -> buffer -> offset:int -> gw:int -> gh:int -> stride:int -> transform -> glyph -> unit
+  = "ml_stbtt_MakeGlyphBitmapTransform_bc" "ml_stbtt_MakeGlyphBitmapTransform"
+
+let make_glyph_bitmap_transform t buffer ~width ~height transform box glyph =
+  let dim = Bigarray.Array1.dim buffer in
+  if width * height > dim then
+    invalid_arg "Stb_truetype.make_glyph_bitmap_transform: \
+                 width * height bigger than buffer";
+  if box.x0 > box.x1 || box.y0 > box.y1 then
+    Printf.ksprintf invalid_arg
+      "Stb_truetype.make_glyph_bitmap_transform: malformed box \
+       {x0=%d; y0=%d; x1=%d; y1=%d}"
+      box.x0 box.y0 box.x1 box.y1;
+  if box.x0 < 0 || box.y0 < 0 || box.x1 > width || box.y1 > height then
+    invalid_arg "Stb_truetype.make_glyph_bitmap_transform: box outside of buffer";
+  make_glyph_bitmap_transform t buffer
+    ~stride:width
+    ~offset:(box.y0 * width + box.x0)
+    ~gw:(box.x1-box.x0)
+    ~gh:(box.y1-box.y0)
+    transform glyph
+
+type run_glyph = {glyph: glyph; x: float; y: float}
+
+external get_run_bitmap_box: t -> run_glyph array -> scale_x:float -> scale_y:float -> box
+  = "ml_stbtt_GetRunBitmapBox"
+
+external make_run_bitmap: t -> buffer -> offset:int -> gw:int -> gh:int -> stride:int -> scale_x:float -> scale_y:float -> run_glyph array -> unit
+  = "ml_stbtt_MakeRunBitmap_bc" "ml_stbtt_MakeRunBitmap"
+
+let make_run_bitmap t buffer ~width ~height ~scale_x ~scale_y box run =
+  let dim = Bigarray.Array1.dim buffer in
+  if width * height > dim then
+    invalid_arg "Stb_truetype.make_run_bitmap: \
+                 width * height bigger than buffer";
+  if box.x0 > box.x1 || box.y0 > box.y1 then
+    Printf.ksprintf invalid_arg
+      "Stb_truetype.make_run_bitmap: malformed box \
+       {x0=%d; y0=%d; x1=%d; y1=%d}"
+      box.x0 box.y0 box.x1 box.y1;
+  if box.x0 < 0 || box.y0 < 0 || box.x1 > width || box.y1 > height then
+    invalid_arg "Stb_truetype.make_run_bitmap: box outside of buffer";
+  make_run_bitmap t buffer
+    ~stride:width
+    ~offset:(box.y0 * width + box.x0)
+    ~gw:(box.x1-box.x0)
+    ~gh:(box.y1-box.y0)
+    ~scale_x ~scale_y run
+
+external make_box_drawing_bitmap: buffer -> offset:int -> gw:int -> gh:int -> stride:int -> codepoint -> bool
+  = "ml_stbtt_MakeBoxDrawingBitmap_bc" "ml_stbtt_MakeBoxDrawingBitmap"
+
+let make_box_drawing_bitmap buffer ~width ~height box codepoint =
+  let dim = Bigarray.Array1.dim buffer in
+  if width * height > dim then
+    invalid_arg "Stb_truetype.make_box_drawing_bitmap: \
+                 width * height bigger than buffer";
+  if box.x0 > box.x1 || box.y0 > box.y1 then
+    Printf.ksprintf invalid_arg
+      "Stb_truetype.make_box_drawing_bitmap: malformed box \
+       {x0=%d; y0=%d; x1=%d; y1=%d}"
+      box.x0 box.y0 box.x1 box.y1;
+  if box.x0 < 0 || box.y0 < 0 || box.x1 > width || box.y1 > height then
+    invalid_arg "Stb_truetype.make_box_drawing_bitmap: box outside of buffer";
+  make_box_drawing_bitmap buffer
+    ~stride:width
+    ~offset:(box.y0 * width + box.x0)
+    ~gw:(box.x1-box.x0)
+    ~gh:(box.y1-box.y0)
+    codepoint
+
+let glyph_visible t glyph ~scale_x ~scale_y ~x ~y clip =
+  let b = get_glyph_bitmap_box t glyph ~scale_x ~scale_y in
+  x + b.x1 > clip.x0 && x + b.x0 < clip.x1 &&
+  y + b.y1 > clip.y0 && y + b.y0 < clip.y1
+
 external blur_glyph_bitmap: buffer -> offset:int -> gw:int -> gh:int -> stride:int -> float -> unit
   = "ml_stbtt_BlurGlyphBitmap_bc" "ml_stbtt_BlurGlyphBitmap"
-  [@@noalloc]
 
 let blur_glyph_bitmap buffer ~width ~height box amount =
   let dim = Bigarray.Array1.dim buffer in
@@ -197,3 +351,260 @@ external get_glyph_bitmap: t -> glyph -> scale_x:float -> scale_y:float -> glyph
 
 external get_glyph_bitmap_subpixel: t -> glyph -> scale_x:float -> scale_y:float -> shift_x:float -> shift_y:float -> glyph_bitmap
   = "ml_stbtt_GetGlyphBitmapSubpixel_bc" "ml_stbtt_GetGlyphBitmapSubpixel"
+
+external get_glyph_bitmap_phases: t -> glyph -> scale_x:float -> scale_y:float -> (float * float) array -> glyph_bitmap array
+  = "ml_stbtt_GetGlyphBitmapPhases"
+
+(* Glyph cache.  Pen positions are snapped to the nearest of [phases_x] x
+   [phases_y] subpixel offsets, so a glyph is rendered at most once per
+   phase and size.  All the phases of a glyph are rendered together, the
+   first time one of them is needed. *)
+
+type glyph_cache = {
+  phases_x : int;
+  phases_y : int;
+  bitmaps : (t * glyph * float * int * int, glyph_bitmap) Hashtbl.t;
+}
+
+let glyph_cache ?(phases_x=4) ?(phases_y=1) () =
+  if phases_x < 1 || phases_y < 1 then
+    invalid_arg "Stb_truetype.glyph_cache: phases must be positive";
+  {phases_x; phases_y; bitmaps = Hashtbl.create 256}
+
+let clear_glyph_cache cache = Hashtbl.reset cache.bitmaps
+
+let glyph_cache_length cache = Hashtbl.length cache.bitmaps
+
+(* Integer pixel and phase of pen coordinate [v] *)
+let snap v phases =
+  let p = int_of_float (floor v) in
+  let bin = int_of_float ((v -. float p) *. float phases +. 0.5) in
+  if bin = phases then (p + 1, 0) else (p, bin)
+
+let cached_glyph_bitmap cache t glyph ~scale ~x ~y =
+  let ix, bx = snap x cache.phases_x and iy, by = snap y cache.phases_y in
+  let key = (t, glyph, scale, bx, by) in
+  let bitmap =
+    match Hashtbl.find_opt cache.bitmaps key with
+    | Some bitmap -> bitmap
+    | None ->
+      let px = cache.phases_x and py = cache.phases_y in
+      let shifts =
+        Array.init (px * py) (fun i ->
+            (float (i mod px) /. float px, float (i / px) /. float py))
+      in
+      let bitmaps = get_glyph_bitmap_phases t glyph ~scale_x:scale ~scale_y:scale shifts in
+      Array.iteri (fun i bitmap ->
+          Hashtbl.replace cache.bitmaps (t, glyph, scale, i mod px, i / px) bitmap)
+        bitmaps;
+      bitmaps.(by * px + bx)
+  in
+  (bitmap, ix + bitmap.xoff, iy + bitmap.yoff)
+
+type glyph_spans = {
+  spans : int array;
+  box : box;
+}
+
+external get_glyph_spans: t -> glyph -> scale_x:float -> scale_y:float -> shift_x:float -> shift_y:float -> glyph_spans
+  = "ml_stbtt_GetGlyphSpans_bc" "ml_stbtt_GetGlyphSpans"
+
+type pixel_format =
+  | Rgba
+  | Bgra
+  | Rgba_premultiplied
+  | Bgra_premultiplied
+
+type color = {r: int; g: int; b: int; a: int}
+
+type gamma
+external gamma : float -> gamma = "ml_stbtt_gamma"
+
+external composite: gamma option -> buffer -> offset:int -> stride:int -> gw:int -> gh:int -> buffer -> target_offset:int -> target_stride:int -> pixel_format -> color -> unit
+  = "ml_stbtt_Composite_bc" "ml_stbtt_Composite"
+
+let composite ?gamma buffer ~width ~height box ~target ~target_width ~target_height ~target_stride format ~x ~y color =
+  let dim = Bigarray.Array1.dim buffer in
+  if width * height > dim then
+    invalid_arg "Stb_truetype.composite: \
+                 width * height bigger than buffer";
+  if box.x0 > box.x1 || box.y0 > box.y1 then
+    invalid_arg "Stb_truetype.composite: malformed box";
+  if box.x0 < 0 || box.y0 < 0 || box.x1 > width || box.y1 > height then
+    invalid_arg "Stb_truetype.composite: box outside of buffer";
+  if target_width < 0 || target_height < 0 || target_stride < 4 * target_width then
+    invalid_arg "Stb_truetype.composite: invalid target dimensions";
+  if target_height > 0 &&
+     (target_height - 1) * target_stride + 4 * target_width > Bigarray.Array1.dim target then
+    invalid_arg "Stb_truetype.composite: \
+                 target_height * target_stride bigger than target";
+  let check c = if c < 0 || c > 255 then
+      invalid_arg "Stb_truetype.composite: color component outside of [0, 255]" in
+  check color.r; check color.g; check color.b; check color.a;
+  (* Part of the mask that lands on the target *)
+  let tx0 = max x 0 and ty0 = max y 0 in
+  let tx1 = min (x + box.x1 - box.x0) target_width
+  and ty1 = min (y + box.y1 - box.y0) target_height in
+  if tx0 < tx1 && ty0 < ty1 then
+    composite gamma buffer
+      ~offset:((box.y0 + ty0 - y) * width + box.x0 + tx0 - x)
+      ~stride:width
+      ~gw:(tx1 - tx0) ~gh:(ty1 - ty0)
+      target
+      ~target_offset:(ty0 * target_stride + 4 * tx0)
+      ~target_stride
+      format color
+
+external composite_spans: gamma option -> int array -> buffer -> target_width:int -> target_height:int -> target_stride:int -> x:int -> y:int -> pixel_format -> color -> unit
+  = "ml_stbtt_CompositeSpans_bc" "ml_stbtt_CompositeSpans"
+
+let composite_spans ?gamma spans ~target ~target_width ~target_height ~target_stride format ~x ~y color =
+  if Array.length spans.spans mod 4 <> 0 then
+    invalid_arg "Stb_truetype.composite_spans: malformed spans";
+  if target_width < 0 || target_height < 0 || target_stride < 4 * target_width then
+    invalid_arg "Stb_truetype.composite_spans: invalid target dimensions";
+  if target_height > 0 &&
+     (target_height - 1) * target_stride + 4 * target_width > Bigarray.Array1.dim target then
+    invalid_arg "Stb_truetype.composite_spans: \
+                 target_height * target_stride bigger than target";
+  let check c = if c < 0 || c > 255 then
+      invalid_arg "Stb_truetype.composite_spans: color component outside of [0, 255]" in
+  check color.r; check color.g; check color.b; check color.a;
+  composite_spans gamma spans.spans target
+    ~target_width ~target_height ~target_stride ~x ~y format color
+
+(* Terminal grids *)
+
+type grid
+
+external grid : t -> scale:float -> grid = "ml_stbtt_grid"
+external grid_cell_width : grid -> int = "ml_stbtt_grid_cell_width" [@@noalloc]
+external grid_cell_height : grid -> int = "ml_stbtt_grid_cell_height" [@@noalloc]
+
+type cells = (int32, int32_elt, c_layout) Array1.t
+
+let cells ~columns ~rows =
+  let cells = Array1.create int32 c_layout (3 * columns * rows) in
+  Array1.fill cells (-1l);
+  cells
+
+type grid_format =
+  | Gray
+  | Color of pixel_format
+
+external render_grid: grid -> columns:int -> rows:int -> cells -> previous:cells -> buffer -> target_stride:int -> grid_format -> int
+  = "ml_stbtt_RenderGrid_bc" "ml_stbtt_RenderGrid"
+
+let render_grid grid ~columns ~rows cells ~previous ~target ~target_stride format =
+  let bpp = match format with Gray -> 1 | Color _ -> 4 in
+  let width = columns * grid_cell_width grid
+  and height = rows * grid_cell_height grid in
+  if columns < 0 || rows < 0 then
+    invalid_arg "Stb_truetype.render_grid: invalid grid dimensions";
+  if Array1.dim cells < 3 * columns * rows ||
+     Array1.dim previous < 3 * columns * rows then
+    invalid_arg "Stb_truetype.render_grid: \
+                 3 * columns * rows bigger than cells";
+  if target_stride < bpp * width then
+    invalid_arg "Stb_truetype.render_grid: target_stride too small";
+  if height > 0 && width > 0 &&
+     (height - 1) * target_stride + bpp * width > Array1.dim target then
+    invalid_arg "Stb_truetype.render_grid: \
+                 grid bigger than target";
+  render_grid grid ~columns ~rows cells ~previous target ~target_stride format
+
+(* Bitmap caches *)
+
+type bitmap_cache
+
+type bitmap_cache_stats = {
+  hits : int;
+  misses : int;
+  evictions : int;
+  entries : int;
+  bytes : int;
+}
+
+external bitmap_cache : phases_x:int -> phases_y:int -> budget:int -> bitmap_cache
+  = "ml_stbtt_bitmap_cache"
+
+let bitmap_cache ?(phases_x=4) ?(phases_y=1) ~budget () =
+  if phases_x < 1 || phases_y < 1 then
+    invalid_arg "Stb_truetype.bitmap_cache: phases must be positive";
+  if budget < 0 then
+    invalid_arg "Stb_truetype.bitmap_cache: negative budget";
+  bitmap_cache ~phases_x ~phases_y ~budget
+
+external bitmap_cache_clear : bitmap_cache -> unit = "ml_stbtt_bitmap_cache_clear"
+external bitmap_cache_stats : bitmap_cache -> bitmap_cache_stats = "ml_stbtt_bitmap_cache_stats"
+
+external bitmap_cache_get: bitmap_cache -> t -> glyph -> scale_x:float -> scale_y:float -> blur:float -> x:float -> y:float -> glyph_bitmap * int * int
+  = "ml_stbtt_bitmap_cache_get_bc" "ml_stbtt_bitmap_cache_get"
+
+let bitmap_cache_get ?(blur=0.0) cache t glyph ~scale_x ~scale_y ~x ~y =
+  bitmap_cache_get cache t glyph ~scale_x ~scale_y ~blur ~x ~y
+
+external bitmap_cache_render_run: bitmap_cache -> t -> scale_x:float -> scale_y:float -> blur:float -> buffer -> offset:int -> gw:int -> gh:int -> stride:int -> run_glyph array -> unit
+  = "ml_stbtt_bitmap_cache_render_run_bc" "ml_stbtt_bitmap_cache_render_run"
+
+let bitmap_cache_render_run ?(blur=0.0) cache t ~scale_x ~scale_y buffer ~width ~height box run =
+  let dim = Bigarray.Array1.dim buffer in
+  if width * height > dim then
+    invalid_arg "Stb_truetype.bitmap_cache_render_run: \
+                 width * height bigger than buffer";
+  if box.x0 > box.x1 || box.y0 > box.y1 then
+    Printf.ksprintf invalid_arg
+      "Stb_truetype.bitmap_cache_render_run: malformed box \
+       {x0=%d; y0=%d; x1=%d; y1=%d}"
+      box.x0 box.y0 box.x1 box.y1;
+  if box.x0 < 0 || box.y0 < 0 || box.x1 > width || box.y1 > height then
+    invalid_arg "Stb_truetype.bitmap_cache_render_run: box outside of buffer";
+  bitmap_cache_render_run cache t ~scale_x ~scale_y ~blur buffer
+    ~stride:width
+    ~offset:(box.y0 * width + box.x0)
+    ~gw:(box.x1-box.x0)
+    ~gh:(box.y1-box.y0)
+    run
+
+type shared_cache
+
+external shared_cache : phases_x:int -> phases_y:int -> budget:int -> shared_cache
+  = "ml_stbtt_shared_cache"
+
+let shared_cache ?(phases_x=4) ?(phases_y=1) ~budget () =
+  if phases_x < 1 || phases_y < 1 then
+    invalid_arg "Stb_truetype.shared_cache: phases must be positive";
+  if budget < 0 then
+    invalid_arg "Stb_truetype.shared_cache: negative budget";
+  shared_cache ~phases_x ~phases_y ~budget
+
+external shared_cache_clear : shared_cache -> unit = "ml_stbtt_shared_cache_clear"
+external shared_cache_stats : shared_cache -> bitmap_cache_stats = "ml_stbtt_shared_cache_stats"
+
+external shared_cache_get: shared_cache -> t -> glyph -> scale_x:float -> scale_y:float -> blur:float -> x:float -> y:float -> glyph_bitmap * int * int
+  = "ml_stbtt_shared_cache_get_bc" "ml_stbtt_shared_cache_get"
+
+let shared_cache_get ?(blur=0.0) cache t glyph ~scale_x ~scale_y ~x ~y =
+  shared_cache_get cache t glyph ~scale_x ~scale_y ~blur ~x ~y
+
+external shared_cache_render_run: shared_cache -> t -> scale_x:float -> scale_y:float -> blur:float -> buffer -> offset:int -> gw:int -> gh:int -> stride:int -> run_glyph array -> unit
+  = "ml_stbtt_shared_cache_render_run_bc" "ml_stbtt_shared_cache_render_run"
+
+let shared_cache_render_run ?(blur=0.0) cache t ~scale_x ~scale_y buffer ~width ~height box run =
+  let dim = Bigarray.Array1.dim buffer in
+  if width * height > dim then
+    invalid_arg "Stb_truetype.shared_cache_render_run: \
+                 width * height bigger than buffer";
+  if box.x0 > box.x1 || box.y0 > box.y1 then
+    Printf.ksprintf invalid_arg
+      "Stb_truetype.shared_cache_render_run: malformed box \
+       {x0=%d; y0=%d; x1=%d; y1=%d}"
+      box.x0 box.y0 box.x1 box.y1;
+  if box.x0 < 0 || box.y0 < 0 || box.x1 > width || box.y1 > height then
+    invalid_arg "Stb_truetype.shared_cache_render_run: box outside of buffer";
+  shared_cache_render_run cache t ~scale_x ~scale_y ~blur buffer
+    ~stride:width
+    ~offset:(box.y0 * width + box.x0)
+    ~gw:(box.x1-box.x0)
+    ~gh:(box.y1-box.y0)
+    run
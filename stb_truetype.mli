@@ -37,7 +37,9 @@ val enum: buffer -> offset list
 
 (** A font.
     It is an custom type that cannot be serialized, but it is well-behaved for
-    hashing and comparison. *)
+    hashing and comparison.
+    A font can be shared by all threads and domains: it is never mutated after
+    [init], and rendering functions use per-thread scratch memory. *)
 type t
 
 (** [init buffer offset] try to open the font in [buffer] at the specified
@@ -108,6 +110,11 @@ val glyph_advance: t -> glyph -> int
     characters. *)
 val kern_advance: t -> glyph -> glyph -> int
 
+(** [monospace_advance t] is the [advance_width] shared by all the glyphs of
+    a monospace font, as declared by the font, or [None] for proportional
+    fonts. *)
+val monospace_advance: t -> int option
+
 (** A bounding box, as a pair of points *)
 type box = {x0: int; y0: int; x1: int; y1: int}
 
@@ -127,6 +134,8 @@ val glyph_box: t -> glyph -> box
 *)
 
 (** [pack_context] is the state of the packing algorithm.
+    A context can be shared by threads and domains; packs into it run one at
+    a time.
     Incompatible with polymorphic operators. *)
 type pack_context
 
@@ -222,15 +231,100 @@ val string_of_packed_chars: packed_chars -> string
 (** Inverse to [string_of_packed_chars]. *)
 val packed_chars_of_string: string -> packed_chars
 
+(*##########################*)
+(** {1 Glyph rasterization}
+    [pack_font_ranges] above and the functions below do not hold the OCaml
+    runtime lock while rasterizing large bitmaps: other threads can run
+    during the rendering.
+    The font and target [buffer]s must not be resized or unmapped
+    concurrently. *)
+
+(** [set_render_threads n] lets the functions below render bitmaps of at
+    least 512x512 pixels in horizontal bands of 64 rows on up to [n] threads,
+    the calling one included. The edges of the glyph are built once and
+    shared by the bands. Pixels may differ slightly from a single-threaded
+    rendering, which accumulates rounding errors over the whole height.
+    The default, 1, renders on the calling thread only. [n] is clamped to
+    [1, 64]. The setting is global. *)
+val set_render_threads: int -> unit
+
+(** [make_glyph_bitmap t buffer ~width ~height ~scale_x ~scale_y box glyph]
+    renders [glyph] into [box] of a [width * height] [buffer].
+    With [~clip], only the pixels of [box] inside [clip] (in buffer
+    coordinates as well) are rendered and written; the others are left
+    untouched. Rows and columns outside of [clip] cost nothing. *)
 val make_glyph_bitmap: t -> buffer -> width:int -> height:int ->
-  scale_x:float -> scale_y:float -> box -> glyph -> unit
+  scale_x:float -> scale_y:float -> ?clip:box -> box -> glyph -> unit
 
 val make_glyph_bitmap_subpixel: t -> buffer -> width:int -> height:int ->
-  scale_x:float -> scale_y:float -> shift_x:float -> shift_y:float -> box -> glyph -> unit
+  scale_x:float -> scale_y:float -> shift_x:float -> shift_y:float ->
+  ?clip:box -> box -> glyph -> unit
+
+(** [make_glyph_bitmap_tile t buffer ~width ~height ... ~tile_x ~tile_y box
+    glyph] renders into [box] the part of the glyph bitmap whose top-left
+    corner is at [(tile_x, tile_y)], relative to the top-left corner of the
+    bitmap that [make_glyph_bitmap_subpixel] would render (see
+    [get_glyph_bitmap_box_subpixel]).
+    Tiles may extend past the glyph bitmap, which renders as 0.
+    Memory use depends on the size of the tile, not of the glyph, so giant
+    glyphs can be rendered tile by tile. *)
+val make_glyph_bitmap_tile: t -> buffer -> width:int -> height:int ->
+  scale_x:float -> scale_y:float -> shift_x:float -> shift_y:float ->
+  tile_x:int -> tile_y:int -> box -> glyph -> unit
 
 val get_glyph_bitmap_box: t -> glyph -> scale_x:float -> scale_y:float -> box
 val get_glyph_bitmap_box_subpixel: t -> glyph -> scale_x:float -> scale_y:float -> shift_x:float -> shift_y:float -> box
 
+(** An affine map [(x, y) -> (xx*x + xy*y + tx, yx*x + yy*y + ty)] from
+    glyph coordinates in font units (y up) to bitmap pixels (y down). *)
+type transform = {
+  xx: float; xy: float; tx: float;
+  yx: float; yy: float; ty: float;
+}
+
+(** The transform that [make_glyph_bitmap_subpixel] applies. *)
+val transform_of_scale: ?shift_x:float -> ?shift_y:float ->
+  scale_x:float -> scale_y:float -> unit -> transform
+
+(** Bitmap box of a glyph drawn with a transform: the bounding box of its
+    transformed glyph box, which can be a bit loose for rotations. *)
+val get_glyph_bitmap_box_transform: t -> glyph -> transform -> box
+
+(** [make_glyph_bitmap_transform t buffer ~width ~height transform box glyph]
+    renders [glyph] mapped by [transform] into [box], whose top-left corner
+    is the top-left corner of [get_glyph_bitmap_box_transform]. Rotated,
+    sheared or mirrored glyphs are rasterized from the outline directly. *)
+val make_glyph_bitmap_transform: t -> buffer -> width:int -> height:int ->
+  transform -> box -> glyph -> unit
+
+(** A glyph of a laid-out run, with its origin at [(x, y)] pixels (y down). *)
+type run_glyph = {glyph: glyph; x: float; y: float}
+
+(** Union of the bitmap boxes of the glyphs of a run. *)
+val get_run_bitmap_box: t -> run_glyph array -> scale_x:float -> scale_y:float -> box
+
+(** [make_run_bitmap t buffer ~width ~height ~scale_x ~scale_y box run]
+    renders a whole run, e.g. a line of text, into [box], whose top-left
+    corner is the top-left corner of [get_run_bitmap_box]. The outlines of
+    all the glyphs are rasterized together in a single pass: overlapping
+    glyphs merge instead of being composited, and there is no per-glyph
+    setup. *)
+val make_run_bitmap: t -> buffer -> width:int -> height:int ->
+  scale_x:float -> scale_y:float -> box -> run_glyph array -> unit
+
+(** [make_box_drawing_bitmap buffer ~width ~height box codepoint] draws the
+    block element or box drawing character [codepoint] to fill [box], taken
+    as a terminal cell, without a font, so that neighbouring cells join
+    exactly at any size. Handles the blocks U+2580..U+259F and the light and
+    heavy lines and dashes of U+2500..U+257F; returns [false] without drawing
+    anything for other codepoints, which are left to the font. *)
+val make_box_drawing_bitmap: buffer -> width:int -> height:int -> box -> codepoint -> bool
+
+(** [glyph_visible t glyph ~scale_x ~scale_y ~x ~y clip] is [false] when the
+    bitmap of [glyph], drawn with its origin at [(x, y)], lies fully outside
+    of [clip]. Layouts can use it to skip glyphs before rendering them. *)
+val glyph_visible: t -> glyph -> scale_x:float -> scale_y:float -> x:int -> y:int -> box -> bool
+
 val blur_glyph_bitmap: buffer -> width:int -> height:int -> box -> float -> unit
 
 type glyph_bitmap = {
@@ -243,3 +337,204 @@ type glyph_bitmap = {
 
 val get_glyph_bitmap: t -> glyph -> scale_x:float -> scale_y:float -> glyph_bitmap
 val get_glyph_bitmap_subpixel: t -> glyph -> scale_x:float -> scale_y:float -> shift_x:float -> shift_y:float -> glyph_bitmap
+
+(** [get_glyph_bitmap_phases t glyph ~scale_x ~scale_y shifts] is
+    [get_glyph_bitmap_subpixel] for each of the [(shift_x, shift_y)] pairs
+    of [shifts]. The outline is decoded, flattened and sorted once, and only
+    the scanline pass runs for each shift, so rendering the four phases of
+    a glyph costs much less than four separate calls. *)
+val get_glyph_bitmap_phases: t -> glyph -> scale_x:float -> scale_y:float ->
+  (float * float) array -> glyph_bitmap array
+
+(** A cache of glyph bitmaps keyed by font, glyph, scale and subpixel phase.
+    Pen positions snap to the nearest of [phases_x * phases_y] offsets
+    within a pixel, so a layout renders each glyph at most once per phase
+    instead of once per occurrence. The phases of a glyph are rendered
+    together with [get_glyph_bitmap_phases] on first use. A cache must not be used by several
+    domains at once. *)
+type glyph_cache
+
+(** [glyph_cache ?phases_x ?phases_y ()] is an empty cache; by default
+    there are 4 horizontal phases and 1 vertical one, which is enough for
+    horizontal text on a pixel-aligned baseline. *)
+val glyph_cache: ?phases_x:int -> ?phases_y:int -> unit -> glyph_cache
+
+val clear_glyph_cache: glyph_cache -> unit
+
+(** Number of bitmaps in the cache. *)
+val glyph_cache_length: glyph_cache -> int
+
+(** [cached_glyph_bitmap cache t glyph ~scale ~x ~y] is the bitmap of
+    [glyph] for a pen at [(x, y)] pixels, rendered with the nearest phase,
+    and the pixel where the top-left corner of the bitmap goes. *)
+val cached_glyph_bitmap: glyph_cache -> t -> glyph -> scale:float -> x:float -> y:float ->
+  glyph_bitmap * int * int
+
+(** A glyph bitmap as runs of equal coverage. [spans] holds four integers
+    per run, [y; x0; x1; coverage], for pixels [x0] to [x1 - 1] of row [y],
+    relative to the top-left corner of [box], the box of the bitmap (as
+    returned by [get_glyph_bitmap_box_subpixel]). Runs are ordered by row then
+    column; empty pixels are left out and glyph interiors are runs of 255.
+    This is often much smaller than the bitmap, and is what
+    [composite_spans] consumes. *)
+type glyph_spans = {
+  spans : int array;
+  box : box;
+}
+
+val get_glyph_spans: t -> glyph -> scale_x:float -> scale_y:float -> shift_x:float -> shift_y:float -> glyph_spans
+
+(*##########################*)
+(** {1 Compositing} *)
+
+(** Layouts of 32-bit target pixels, 8 bits per component. Alpha is the last
+    byte of a pixel in every format. *)
+type pixel_format =
+  | Rgba
+  | Bgra
+  | Rgba_premultiplied
+  | Bgra_premultiplied
+
+(** A color with straight alpha, components in [0, 255]. *)
+type color = {r: int; g: int; b: int; a: int}
+
+(** Tables to blend in linear light, for targets encoded with a given gamma
+    (e.g. [gamma 2.2]). Build them once and reuse them. *)
+type gamma
+val gamma: float -> gamma
+
+(** [composite buffer ~width ~height box ~target ~target_width
+    ~target_height ~target_stride format ~x ~y color] blends [color] over
+    the [target] image with the coverage in [box] of a [width * height]
+    [buffer] (a rendered glyph, run or blurred shadow) as mask.
+    The top-left corner of [box] lands on pixel [(x, y)] of the target,
+    whose rows are [target_stride] bytes apart; the parts of the mask
+    outside of the target are ignored.
+    Blending uses SIMD kernels where available. With [~gamma], colors are
+    blended in linear light, which is slower but keeps thin dark-on-light
+    and light-on-dark text equally heavy. *)
+val composite: ?gamma:gamma -> buffer -> width:int -> height:int -> box ->
+  target:buffer -> target_width:int -> target_height:int ->
+  target_stride:int -> pixel_format -> x:int -> y:int -> color -> unit
+
+(** Same as [composite] with a glyph rendered by [get_glyph_spans], whose
+    box lands at [(x, y)]. Interiors of an opaque [color] are filled without
+    blending, and only the antialiased runs are blended. *)
+val composite_spans: ?gamma:gamma -> glyph_spans ->
+  target:buffer -> target_width:int -> target_height:int ->
+  target_stride:int -> pixel_format -> x:int -> y:int -> color -> unit
+
+(** {1 Terminal grids} *)
+
+(** A font rendered in cells of a fixed size, as in a terminal, with a cache
+    of the cells drawn so far.
+    A grid can be shared by threads and domains; its renders run one at a
+    time. *)
+type grid
+
+(** [grid t ~scale] has cells [monospace_advance t] wide (the advance of
+    ['0'] for proportional fonts) and ascent to descent high, in pixels at
+    [scale]. Glyphs are clipped to their cell. Block elements and box
+    drawing characters are drawn procedurally, see
+    [make_box_drawing_bitmap], so that they join across cells. *)
+val grid: t -> scale:float -> grid
+val grid_cell_width: grid -> int
+val grid_cell_height: grid -> int
+
+(** The contents of a grid, row by row: three integers per cell, the
+    codepoint and the foreground and background colors as [0xRRGGBB]. *)
+type cells = (int32, int32_elt, c_layout) Array1.t
+
+(** [cells ~columns ~rows] is filled with [-1], which matches no cell:
+    rendering with it as [~previous] draws every cell. *)
+val cells: columns:int -> rows:int -> cells
+
+(** Target images: 8-bit coverage, colors ignored, or opaque 32-bit
+    pixels. *)
+type grid_format =
+  | Gray
+  | Color of pixel_format
+
+(** [render_grid grid ~columns ~rows cells ~previous ~target ~target_stride
+    format] draws the cells that differ from [previous] into [target], with
+    the top-left cell at the origin and rows [target_stride] bytes apart,
+    and copies them to [previous]. It returns the number of cells drawn.
+    Each codepoint is rendered once and cached by the grid, so a frame
+    costs a comparison per cell plus the pixels of the changed cells.
+    A cell that cannot be rendered for lack of memory is drawn blank and not
+    copied to [previous], so that the next frame draws it again. *)
+val render_grid: grid -> columns:int -> rows:int -> cells -> previous:cells ->
+  target:buffer -> target_stride:int -> grid_format -> int
+
+(** {1 Bitmap caches} *)
+
+(** A cache of glyph bitmaps with a memory budget, keyed by font, glyph,
+    scale, subpixel phase and blur radius. When the budget is reached, the
+    least recently used bitmaps are evicted and their memory is reused for
+    new ones. Unlike [glyph_cache], the bitmaps live outside of the OCaml
+    heap and a cache can be shared by several domains and threads. *)
+type bitmap_cache
+
+type bitmap_cache_stats = {
+  hits : int;
+  misses : int;
+  evictions : int;
+  entries : int;  (** bitmaps in the cache *)
+  bytes : int;    (** memory held by the cache, at most its budget *)
+}
+
+(** [bitmap_cache ?phases_x ?phases_y ~budget ()] is an empty cache holding
+    at most [budget] bytes. Pen positions snap to [phases_x * phases_y]
+    offsets within a pixel, 4 horizontal ones and 1 vertical one by
+    default, as with [glyph_cache]. *)
+val bitmap_cache: ?phases_x:int -> ?phases_y:int -> budget:int -> unit -> bitmap_cache
+
+(** Drop all the bitmaps and free their memory; the statistics are kept. *)
+val bitmap_cache_clear: bitmap_cache -> unit
+
+val bitmap_cache_stats: bitmap_cache -> bitmap_cache_stats
+
+(** [bitmap_cache_get ?blur cache t glyph ~scale_x ~scale_y ~x ~y] is the
+    bitmap of [glyph] for a pen at [(x, y)] pixels, rendered with the
+    nearest phase and blurred by [blur] pixels, and the pixel where the
+    top-left corner of the bitmap goes. Blurred bitmaps are enlarged to
+    hold the blur. The bitmap is a copy, it stays valid after eviction. *)
+val bitmap_cache_get: ?blur:float -> bitmap_cache -> t -> glyph ->
+  scale_x:float -> scale_y:float -> x:float -> y:float ->
+  glyph_bitmap * int * int
+
+(** [bitmap_cache_render_run ?blur cache t ~scale_x ~scale_y buffer ~width
+    ~height box run] is [make_run_bitmap] drawn from the cache: the glyphs
+    of [run] are looked up, the missing ones rendered, and added into [box],
+    with the same origin. The whole run is served under one lock, without
+    copying the bitmaps, and the runtime is released meanwhile. *)
+val bitmap_cache_render_run: ?blur:float -> bitmap_cache -> t ->
+  scale_x:float -> scale_y:float -> buffer -> width:int -> height:int ->
+  box -> run_glyph array -> unit
+
+(** A [bitmap_cache] for many domains at once. Lookups take no lock, so
+    domains hitting the cache do not wait for each other, and a glyph
+    missing in several domains at the same time is rendered by only one of
+    them while the others wait for it. Evicted bitmaps are freed once no
+    domain can still be reading them. Memory is bounded by the budget as
+    for [bitmap_cache], plus evicted bitmaps awaiting release; there is no
+    strict least recently used order, recently used bitmaps are kept in
+    preference to others. *)
+type shared_cache
+
+val shared_cache: ?phases_x:int -> ?phases_y:int -> budget:int -> unit -> shared_cache
+
+val shared_cache_clear: shared_cache -> unit
+
+(** The [bytes] are those of the bitmaps in the cache. *)
+val shared_cache_stats: shared_cache -> bitmap_cache_stats
+
+(** Same as [bitmap_cache_get]. *)
+val shared_cache_get: ?blur:float -> shared_cache -> t -> glyph ->
+  scale_x:float -> scale_y:float -> x:float -> y:float ->
+  glyph_bitmap * int * int
+
+(** Same as [bitmap_cache_render_run]. *)
+val shared_cache_render_run: ?blur:float -> shared_cache -> t ->
+  scale_x:float -> scale_y:float -> buffer -> width:int -> height:int ->
+  box -> run_glyph array -> unit
@@ -0,0 +1,12 @@
+/* The default rasterizer without its SIMD kernels, built on its own so that
+   test_raster can compare the two. */
+
+#define STB_TRUETYPE_IMPLEMENTATION
+#define STBTT_STATIC
+#define STBTT_NO_SIMD
+#include "stb_truetype.h"
+
+void render_scalar(const stbtt_fontinfo *info, unsigned char *output, int w, int h, int stride, float scale, float shift_x, float shift_y, int glyph)
+{
+   stbtt_MakeGlyphBitmapSubpixel(info, output, w, h, stride, scale, scale, shift_x, shift_y, glyph);
+}
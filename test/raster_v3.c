@@ -0,0 +1,17 @@
+/* The fixed-point rasterizer, built on its own so that test_raster can run
+   it next to the default one. */
+
+#define STB_TRUETYPE_IMPLEMENTATION
+#define STBTT_STATIC
+#define STBTT_RASTERIZER_VERSION 3
+#include "stb_truetype.h"
+
+void render_v3(const stbtt_fontinfo *info, unsigned char *output, int w, int h, int stride, float scale, float shift_x, float shift_y, int glyph)
+{
+   stbtt_MakeGlyphBitmapSubpixel(info, output, w, h, stride, scale, scale, shift_x, shift_y, glyph);
+}
+
+void tile_v3(const stbtt_fontinfo *info, unsigned char *output, int tile_x, int tile_y, int tile_w, int tile_h, int stride, float scale, int glyph)
+{
+   stbtt_MakeGlyphBitmapTile(info, output, tile_x, tile_y, tile_w, tile_h, stride, scale, scale, 0, 0, glyph);
+}
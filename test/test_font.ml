@@ -100,8 +100,441 @@ let main filename =
   in
   List.iteri dump_offset offsets
 
+(* Rendering checks, run by dune runtest.  Each rendering path is compared
+   with the plain render it must agree with. *)
+
+let failures = ref 0
+
+let report name count diff tolerance =
+  let ok = diff <= tolerance in
+  Printf.printf "%-32s %6d bitmaps, max diff %3d (tolerance %d) %s\n"
+    name count diff tolerance (if ok then "ok" else "FAILED");
+  if not ok then incr failures
+
+let expect name ok =
+  Printf.printf "%-32s %s\n" name (if ok then "ok" else "FAILED");
+  if not ok then incr failures
+
+let create_buffer size =
+  let buffer = Bigarray.(Array1.create int8_unsigned c_layout size) in
+  Bigarray.Array1.fill buffer 0;
+  buffer
+
+(* Largest difference between [w * h] pixels of two buffers *)
+let max_diff a ~a_offset ~a_stride b ~b_offset ~b_stride ~w ~h =
+  let m = ref 0 in
+  for y = 0 to h - 1 do
+    for x = 0 to w - 1 do
+      let d = abs (a.{a_offset + y * a_stride + x} - b.{b_offset + y * b_stride + x}) in
+      if d > !m then m := d
+    done
+  done;
+  !m
+
+(* round(x / 255), as the compositing kernels do *)
+let div255 x = ((x + 128) * 257) lsr 16
+
+let sizes = [|9.; 16.; 31.; 64.; 150.|]
+
+(* [f scale glyph] for the printable ASCII glyphs at each of [sizes] *)
+let iter_glyphs font sizes f =
+  Array.iter (fun size ->
+      let scale = Stb_truetype.scale_for_pixel_height font size in
+      for c = 33 to 126 do
+        f scale (Stb_truetype.get font c)
+      done)
+    sizes
+
+let tile_w = 13 and tile_h = 11 and margin = 4
+
+(* Clipped renders and tiles straddling the box against the full render *)
+let check_clip font =
+  let open Stb_truetype in
+  let n = ref 0 and clip_diff = ref 0 and tile_diff = ref 0 in
+  iter_glyphs font sizes (fun scale glyph ->
+      let b = get_glyph_bitmap_box_subpixel font glyph
+          ~scale_x:scale ~scale_y:scale ~shift_x:0.3 ~shift_y:0.6 in
+      let w = b.x1 - b.x0 and h = b.y1 - b.y0 in
+      (* the glyph at (margin, margin), with room for tiles past its box *)
+      let width = w + 2 * margin + tile_w and height = h + 2 * margin + tile_h in
+      let box = {x0 = margin; y0 = margin; x1 = margin + w; y1 = margin + h} in
+      let full = create_buffer (width * height) in
+      make_glyph_bitmap_subpixel font full ~width ~height
+        ~scale_x:scale ~scale_y:scale ~shift_x:0.3 ~shift_y:0.6 box glyph;
+      (* pixels outside of the clip keep their value *)
+      let clip = {x0 = margin + w / 3; y0 = 0; x1 = width; y1 = margin + h / 2} in
+      let clipped = create_buffer (width * height) in
+      Bigarray.Array1.fill clipped 7;
+      make_glyph_bitmap_subpixel font clipped ~width ~height
+        ~scale_x:scale ~scale_y:scale ~shift_x:0.3 ~shift_y:0.6 ~clip box glyph;
+      for y = 0 to height - 1 do
+        for x = 0 to width - 1 do
+          let inside =
+            x >= max clip.x0 box.x0 && x < min clip.x1 box.x1 &&
+            y >= max clip.y0 box.y0 && y < min clip.y1 box.y1 in
+          let expected = if inside then full.{y * width + x} else 7 in
+          clip_diff := max !clip_diff (abs (clipped.{y * width + x} - expected))
+        done
+      done;
+      let tile = create_buffer (tile_w * tile_h) in
+      let tile_box = {x0 = 0; y0 = 0; x1 = tile_w; y1 = tile_h} in
+      let tile_y = ref (-margin) in
+      while !tile_y < h + margin do
+        let tile_x = ref (-margin) in
+        while !tile_x < w + margin do
+          make_glyph_bitmap_tile font tile ~width:tile_w ~height:tile_h
+            ~scale_x:scale ~scale_y:scale ~shift_x:0.3 ~shift_y:0.6
+            ~tile_x:!tile_x ~tile_y:!tile_y tile_box glyph;
+          tile_diff := max !tile_diff
+              (max_diff full ~a_offset:((margin + !tile_y) * width + margin + !tile_x)
+                 ~a_stride:width tile ~b_offset:0 ~b_stride:tile_w ~w:tile_w ~h:tile_h);
+          tile_x := !tile_x + tile_w
+        done;
+        tile_y := !tile_y + tile_h
+      done;
+      incr n);
+  report "clip vs full render" !n !clip_diff 1;
+  report "tiles vs full render" !n !tile_diff 1
+
+(* The transform of a scale and shift against the subpixel render *)
+let check_transform font =
+  let open Stb_truetype in
+  let n = ref 0 and diff = ref 0 and boxes = ref 0 in
+  iter_glyphs font sizes (fun scale glyph ->
+      let b = get_glyph_bitmap_box_subpixel font glyph
+          ~scale_x:scale ~scale_y:scale ~shift_x:0.3 ~shift_y:0.6 in
+      let t = transform_of_scale ~shift_x:0.3 ~shift_y:0.6
+          ~scale_x:scale ~scale_y:scale () in
+      if get_glyph_bitmap_box_transform font glyph t <> b then incr boxes;
+      let w = b.x1 - b.x0 and h = b.y1 - b.y0 in
+      let box = {x0 = 0; y0 = 0; x1 = w; y1 = h} in
+      let subpixel = create_buffer (w * h) and transformed = create_buffer (w * h) in
+      make_glyph_bitmap_subpixel font subpixel ~width:w ~height:h
+        ~scale_x:scale ~scale_y:scale ~shift_x:0.3 ~shift_y:0.6 box glyph;
+      make_glyph_bitmap_transform font transformed ~width:w ~height:h t box glyph;
+      diff := max !diff (max_diff subpixel ~a_offset:0 ~a_stride:w
+                           transformed ~b_offset:0 ~b_stride:w ~w ~h);
+      incr n);
+  report "identity transform vs subpixel" !n !diff 0;
+  expect "identity transform box" (!boxes = 0)
+
+(* Huge glyphs rendered in bands by several threads against a single sweep *)
+let check_threads font =
+  let open Stb_truetype in
+  let n = ref 0 and diff = ref 0 in
+  iter_glyphs font [|600.; 1000.|] (fun scale glyph ->
+      let b = get_glyph_bitmap_box_subpixel font glyph
+          ~scale_x:scale ~scale_y:scale ~shift_x:0.3 ~shift_y:0.6 in
+      let w = b.x1 - b.x0 and h = b.y1 - b.y0 in
+      let box = {x0 = 0; y0 = 0; x1 = w; y1 = h} in
+      let render threads =
+        let buffer = create_buffer (w * h) in
+        set_render_threads threads;
+        make_glyph_bitmap_subpixel font buffer ~width:w ~height:h
+          ~scale_x:scale ~scale_y:scale ~shift_x:0.3 ~shift_y:0.6 box glyph;
+        buffer
+      in
+      let single = render 1 in
+      let banded = render 4 in
+      diff := max !diff (max_diff single ~a_offset:0 ~a_stride:w
+                           banded ~b_offset:0 ~b_stride:w ~w ~h);
+      incr n);
+  set_render_threads 1;
+  report "threaded bands vs single sweep" !n !diff 0
+
+(* A line of text rendered as a run against its glyphs added one by one.
+   The glyphs are spaced so that they do not overlap; over very long rows
+   the run drifts by a few levels, so the sizes stop at 64 *)
+let check_run font =
+  let open Stb_truetype in
+  let text = "Sphinx of black quartz, judge my vow" in
+  let n = ref 0 and diff = ref 0 in
+  Array.iter (fun size ->
+      let scale = scale_for_pixel_height font size in
+      let pen = ref 0.0 in
+      let run = Array.init (String.length text) (fun i ->
+          let glyph = get font (Char.code text.[i]) in
+          let g = {glyph; x = !pen; y = 0.5} in
+          pen := !pen +. float (glyph_advance font glyph) *. scale +. 1.25;
+          g) in
+      let b = get_run_bitmap_box font run ~scale_x:scale ~scale_y:scale in
+      let width = b.x1 - b.x0 and height = b.y1 - b.y0 in
+      let whole = create_buffer (width * height) and sum = create_buffer (width * height) in
+      make_run_bitmap font whole ~width ~height ~scale_x:scale ~scale_y:scale
+        {x0 = 0; y0 = 0; x1 = width; y1 = height} run;
+      Array.iter (fun {glyph; x; y} ->
+          let g = get_glyph_bitmap_box_subpixel font glyph
+              ~scale_x:scale ~scale_y:scale ~shift_x:x ~shift_y:y in
+          let w = g.x1 - g.x0 and h = g.y1 - g.y0 in
+          let pixels = create_buffer (w * h) in
+          make_glyph_bitmap_subpixel font pixels ~width:w ~height:h
+            ~scale_x:scale ~scale_y:scale ~shift_x:x ~shift_y:y
+            {x0 = 0; y0 = 0; x1 = w; y1 = h} glyph;
+          for j = 0 to h - 1 do
+            for i = 0 to w - 1 do
+              let o = (g.y0 - b.y0 + j) * width + g.x0 - b.x0 + i in
+              sum.{o} <- min 255 (sum.{o} + pixels.{j * w + i})
+            done
+          done;
+          incr n)
+        run;
+      diff := max !diff (max_diff whole ~a_offset:0 ~a_stride:width
+                           sum ~b_offset:0 ~b_stride:width ~w:width ~h:height))
+    [|9.; 16.; 31.; 64.|];
+  report "run vs single glyphs" !n !diff 1
+
+(* Glyphs composited onto each pixel format against the blending formulas,
+   over a transparent target, and their spans against them *)
+let check_composite font =
+  let open Stb_truetype in
+  let scale = scale_for_pixel_height font 31. in
+  let color = {r = 255; g = 96; b = 0; a = 200} in
+  let n = ref 0 and diff = ref 0 and spans_diff = ref 0 in
+  List.iter (fun c ->
+      let glyph = get font (Char.code c) in
+      let b = get_glyph_bitmap_box_subpixel font glyph
+          ~scale_x:scale ~scale_y:scale ~shift_x:0.0 ~shift_y:0.0 in
+      let w = b.x1 - b.x0 and h = b.y1 - b.y0 in
+      let box = {x0 = 0; y0 = 0; x1 = w; y1 = h} in
+      let mask = create_buffer (w * h) in
+      make_glyph_bitmap_subpixel font mask ~width:w ~height:h
+        ~scale_x:scale ~scale_y:scale ~shift_x:0.0 ~shift_y:0.0 box glyph;
+      let spans = get_glyph_spans font glyph
+          ~scale_x:scale ~scale_y:scale ~shift_x:0.0 ~shift_y:0.0 in
+      (* the mask hangs off the left and bottom edges of the target *)
+      let target_width = w + 3 and target_height = h and x = -2 and y = 3 in
+      let target_stride = 4 * target_width + 8 in
+      List.iter (fun format ->
+          let target = create_buffer (target_stride * target_height)
+          and target' = create_buffer (target_stride * target_height) in
+          composite mask ~width:w ~height:h box ~target ~target_width ~target_height
+            ~target_stride format ~x ~y color;
+          composite_spans spans ~target:target' ~target_width ~target_height
+            ~target_stride format ~x ~y color;
+          let premultiplied = format = Rgba_premultiplied || format = Bgra_premultiplied
+          and channels = match format with
+            | Bgra | Bgra_premultiplied -> [|color.b; color.g; color.r|]
+            | Rgba | Rgba_premultiplied -> [|color.r; color.g; color.b|] in
+          for ty = 0 to target_height - 1 do
+            for tx = 0 to target_width - 1 do
+              let mx = tx - x and my = ty - y in
+              let coverage =
+                if mx >= 0 && mx < w && my >= 0 && my < h then mask.{my * w + mx} else 0 in
+              let sa = div255 (coverage * color.a) in
+              for k = 0 to 3 do
+                let expected =
+                  if sa = 0 then 0
+                  else if k = 3 then sa
+                  else if premultiplied then div255 (channels.(k) * sa)
+                  else channels.(k) in
+                let o = ty * target_stride + 4 * tx + k in
+                diff := max !diff (abs (target.{o} - expected));
+                spans_diff := max !spans_diff (abs (target'.{o} - target.{o}))
+              done
+            done
+          done;
+          incr n)
+        [Rgba; Bgra; Rgba_premultiplied; Bgra_premultiplied])
+    ['g'; 'W'; '@'; '|'];
+  report "composite vs blending" !n !diff 1;
+  report "composite spans vs bitmap" !n !spans_diff 1
+
+(* A grid against its glyphs placed in their cells, redrawn only where the
+   cells change, and in color *)
+let check_grid font =
+  let open Stb_truetype in
+  let scale = scale_for_pixel_height font 16. in
+  let grid = grid font ~scale in
+  let cw = grid_cell_width grid and ch = grid_cell_height grid in
+  let baseline = int_of_float (float (vmetrics font).ascent *. scale +. 0.5) in
+  let codepoint_row s = Array.init (String.length s) (fun i -> Char.code s.[i]) in
+  let codepoints = [|
+    codepoint_row "Grid 0g";
+    [|0x2502; 0x2500; 0x253C; 0x2588; 0x2580; Char.code 'W'; Char.code ' '|];
+    codepoint_row "@{|}~_j";
+  |] in
+  let columns = 7 and rows = 3 in
+  let fg = 0xff8000 and bg = 0x000040 in
+  let cells = cells ~columns ~rows in
+  let set_cell r c cp =
+    let i = 3 * (r * columns + c) in
+    cells.{i} <- Int32.of_int cp;
+    cells.{i + 1} <- Int32.of_int fg;
+    cells.{i + 2} <- Int32.of_int bg in
+  Array.iteri (fun r row -> Array.iteri (set_cell r) row) codepoints;
+  (* the coverage of a cell: a box drawing, or the glyph on the baseline *)
+  let cell_mask cp =
+    let mask = create_buffer (cw * ch) in
+    if not (make_box_drawing_bitmap mask ~width:cw ~height:ch
+              {x0 = 0; y0 = 0; x1 = cw; y1 = ch} cp) then begin
+      let bm = get_glyph_bitmap font (get font cp) ~scale_x:scale ~scale_y:scale in
+      for y = 0 to bm.h - 1 do
+        for x = 0 to bm.w - 1 do
+          let cx = x + bm.xoff and cy = y + bm.yoff + baseline in
+          if cx >= 0 && cx < cw && cy >= 0 && cy < ch then
+            mask.{cy * cw + cx} <- bm.buf.{y * bm.w + x}
+        done
+      done
+    end;
+    mask in
+  let stride = columns * cw + 5 in
+  let target = create_buffer (stride * rows * ch) in
+  let cell_diff target r c =
+    max_diff target ~a_offset:(r * ch * stride + c * cw) ~a_stride:stride
+      (cell_mask (Int32.to_int cells.{3 * (r * columns + c)}))
+      ~b_offset:0 ~b_stride:cw ~w:cw ~h:ch in
+  let all_cells_diff target =
+    let d = ref 0 in
+    for r = 0 to rows - 1 do
+      for c = 0 to columns - 1 do
+        d := max !d (cell_diff target r c)
+      done
+    done;
+    !d in
+  let previous = Stb_truetype.cells ~columns ~rows in
+  let drawn = render_grid grid ~columns ~rows cells ~previous ~target
+      ~target_stride:stride Gray in
+  expect "grid draws every cell" (drawn = columns * rows);
+  report "grid vs glyph bitmaps" drawn (all_cells_diff target) 0;
+  expect "grid redraws nothing"
+    (render_grid grid ~columns ~rows cells ~previous ~target
+       ~target_stride:stride Gray = 0);
+  let before = create_buffer (Bigarray.Array1.dim target) in
+  Bigarray.Array1.blit target before;
+  set_cell 1 5 (Char.code 'Q');
+  let drawn = render_grid grid ~columns ~rows cells ~previous ~target
+      ~target_stride:stride Gray in
+  expect "grid redraws a changed cell" (drawn = 1);
+  let others = ref 0 in
+  for r = 0 to rows - 1 do
+    for c = 0 to columns - 1 do
+      if (r, c) <> (1, 5) then
+        others := max !others
+            (max_diff target ~a_offset:(r * ch * stride + c * cw) ~a_stride:stride
+               before ~b_offset:(r * ch * stride + c * cw) ~b_stride:stride ~w:cw ~h:ch)
+    done
+  done;
+  report "grid changed cell" 1 (cell_diff target 1 5) 0;
+  report "grid unchanged cells" (columns * rows - 1) !others 0;
+  (* opaque pixels mixing the colors by coverage, blue first *)
+  let color_stride = 4 * columns * cw in
+  let color_target = create_buffer (color_stride * rows * ch) in
+  let drawn = render_grid grid ~columns ~rows cells
+      ~previous:(Stb_truetype.cells ~columns ~rows) ~target:color_target
+      ~target_stride:color_stride (Color Bgra) in
+  let mix shift coverage =
+    div255 (((fg lsr shift) land 255) * coverage + ((bg lsr shift) land 255) * (255 - coverage)) in
+  let color_diff = ref 0 in
+  for y = 0 to rows * ch - 1 do
+    for x = 0 to columns * cw - 1 do
+      let coverage = target.{y * stride + x} and o = y * color_stride + 4 * x in
+      List.iteri (fun k expected ->
+          color_diff := max !color_diff (abs (color_target.{o + k} - expected)))
+        [mix 0 coverage; mix 8 coverage; mix 16 coverage; 255]
+    done
+  done;
+  report "grid colors vs coverage" drawn !color_diff 0
+
+(* Bitmaps from the caches against direct renders at the same phase, with
+   and without blur, with a budget that holds them all and with one that
+   forces evictions *)
+let check_caches font =
+  let open Stb_truetype in
+  let scale = scale_for_pixel_height font 31. in
+  (* with 4 horizontal phases, x = 10.25 is phase 1 of pixel 10 *)
+  let expected glyph blur =
+    let b = get_glyph_bitmap_box_subpixel font glyph
+        ~scale_x:scale ~scale_y:scale ~shift_x:0.25 ~shift_y:0.0 in
+    let pad = if blur > 0.0 && b.x1 > b.x0 && b.y1 > b.y0
+      then int_of_float (ceil blur) + 1 else 0 in
+    let w = b.x1 - b.x0 + 2 * pad and h = b.y1 - b.y0 + 2 * pad in
+    let buf = create_buffer (w * h) in
+    make_glyph_bitmap_subpixel font buf ~width:w ~height:h
+      ~scale_x:scale ~scale_y:scale ~shift_x:0.25 ~shift_y:0.0
+      {x0 = pad; y0 = pad; x1 = w - pad; y1 = h - pad} glyph;
+    if pad > 0 then
+      blur_glyph_bitmap buf ~width:w ~height:h {x0 = 0; y0 = 0; x1 = w; y1 = h} blur;
+    {buf; w; h; xoff = b.x0 - pad; yoff = b.y0 - pad} in
+  let same (bitmap, px, py) e =
+    bitmap.w = e.w && bitmap.h = e.h && px = 10 + e.xoff && py = 20 + e.yoff &&
+    max_diff bitmap.buf ~a_offset:0 ~a_stride:bitmap.w
+      e.buf ~b_offset:0 ~b_stride:e.w ~w:e.w ~h:e.h = 0 in
+  (* every glyph twice, with and without blur: 188 bitmaps, looked up twice *)
+  let lookups get_bitmap =
+    let bad = ref 0 in
+    for _pass = 1 to 2 do
+      List.iter (fun blur ->
+          for c = 33 to 126 do
+            let glyph = get font c in
+            if not (same (get_bitmap blur glyph) (expected glyph blur)) then incr bad
+          done)
+        [0.0; 1.5]
+    done;
+    !bad in
+  let budget = 1 lsl 20 and small = 4096 in
+  let cache = bitmap_cache ~budget () in
+  let bad = lookups (fun blur glyph ->
+      bitmap_cache_get ~blur cache font glyph ~scale_x:scale ~scale_y:scale ~x:10.25 ~y:20.0) in
+  let s = bitmap_cache_stats cache in
+  expect "bitmap cache vs renders" (bad = 0);
+  expect "bitmap cache stats"
+    (s.misses = 188 && s.hits = 188 && s.evictions = 0 &&
+     s.entries = 188 && s.bytes <= budget);
+  let cache = bitmap_cache ~budget:small () in
+  let bad = lookups (fun blur glyph ->
+      bitmap_cache_get ~blur cache font glyph ~scale_x:scale ~scale_y:scale ~x:10.25 ~y:20.0) in
+  let s = bitmap_cache_stats cache in
+  expect "bitmap cache evicting vs renders" (bad = 0);
+  expect "bitmap cache within budget" (s.evictions > 0 && s.bytes <= small);
+  (* lookups in a full set evict, so some second lookups may miss *)
+  let cache = shared_cache ~budget () in
+  let bad = lookups (fun blur glyph ->
+      shared_cache_get ~blur cache font glyph ~scale_x:scale ~scale_y:scale ~x:10.25 ~y:20.0) in
+  let s = shared_cache_stats cache in
+  expect "shared cache vs renders" (bad = 0);
+  expect "shared cache stats"
+    (s.misses >= 188 && s.hits > 0 && s.hits + s.misses = 376 && s.bytes <= budget);
+  let cache = shared_cache ~budget:small () in
+  let bad = lookups (fun blur glyph ->
+      shared_cache_get ~blur cache font glyph ~scale_x:scale ~scale_y:scale ~x:10.25 ~y:20.0) in
+  let s = shared_cache_stats cache in
+  expect "shared cache evicting vs renders" (bad = 0);
+  expect "shared cache within budget" (s.evictions > 0 && s.bytes <= small)
+
+let check filename =
+  let buffer = map_filename filename in
+  match Stb_truetype.enum buffer with
+  | [] -> Printf.printf "%s: no font found\n" filename; exit 1
+  | offset :: _ ->
+    match Stb_truetype.init buffer offset with
+    | None -> Printf.printf "%s: could not load font\n" filename; exit 1
+    | Some font ->
+      check_clip font;
+      check_transform font;
+      check_threads font;
+      check_run font;
+      check_composite font;
+      check_grid font;
+      check_caches font;
+      if !failures > 0 then exit 1
+
+(* Without a font, the checks use $STBTT_TEST_FONT, then DejaVu Sans, and
+   are skipped when it cannot be read *)
+let default_font = "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
+
 let () =
-  if Array.length Sys.argv > 1 then
-    main Sys.argv.(1)
-  else
-    Printf.eprintf "Usage: %s <path-to-font.ttf>\n" Sys.argv.(0)
+  match Sys.argv with
+  | [|_; filename|] ->
+    main filename;
+    check filename
+  | [|_|] ->
+    let filename = match Sys.getenv_opt "STBTT_TEST_FONT" with
+      | Some filename -> filename
+      | None -> default_font
+    in
+    if Sys.file_exists filename then
+      check filename
+    else
+      Printf.printf "%s: cannot read font, skipping rendering checks\n" filename
+  | _ ->
+    Printf.eprintf "Usage: %s [path-to-font.ttf]\n" Sys.argv.(0)
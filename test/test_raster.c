@@ -0,0 +1,385 @@
+/* Rasterizer consistency checks, run by dune runtest.
+
+   Renders the printable ASCII glyphs of a font at a range of sizes through
+   the different paths of stb_truetype.h and compares them with the plain
+   single-glyph render they must agree with.
+
+   usage: test_raster [font.ttf]
+   The font defaults to $STBTT_TEST_FONT, then to DejaVu Sans; the checks are
+   skipped when it cannot be read. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Allocations larger than fail_above fail, to exercise fallbacks */
+static size_t fail_above = (size_t) -1, largest_alloc;
+static int failed_allocs;
+static void *test_malloc(size_t size)
+{
+   if (size > fail_above) {
+      ++failed_allocs;
+      return NULL;
+   }
+   if (size > largest_alloc) largest_alloc = size;
+   return malloc(size);
+}
+
+#define STB_TRUETYPE_IMPLEMENTATION
+#define STBTT_STATIC
+#define STBTT_malloc(x,u) ((void)(u),test_malloc(x))
+#define STBTT_free(x,u)   ((void)(u),free(x))
+#include "stb_truetype.h"
+
+#define DEFAULT_FONT "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
+
+void render_scalar(const stbtt_fontinfo *info, unsigned char *output, int w, int h, int stride, float scale, float shift_x, float shift_y, int glyph);
+void render_v3(const stbtt_fontinfo *info, unsigned char *output, int w, int h, int stride, float scale, float shift_x, float shift_y, int glyph);
+void tile_v3(const stbtt_fontinfo *info, unsigned char *output, int tile_x, int tile_y, int tile_w, int tile_h, int stride, float scale, int glyph);
+void render_v1(const stbtt_fontinfo *info, unsigned char *output, int w, int h, int stride, float scale, float shift_x, float shift_y, int glyph);
+void tile_v1(const stbtt_fontinfo *info, unsigned char *output, int tile_x, int tile_y, int tile_w, int tile_h, int stride, float scale, int glyph);
+
+typedef void render_func(const stbtt_fontinfo *info, unsigned char *output, int w, int h, int stride, float scale, float shift_x, float shift_y, int glyph);
+typedef void tile_func(const stbtt_fontinfo *info, unsigned char *output, int tile_x, int tile_y, int tile_w, int tile_h, int stride, float scale, int glyph);
+
+static const float sizes[] = { 9, 16, 31, 64, 150 };
+#define NUM_SIZES ((int) (sizeof(sizes)/sizeof(sizes[0])))
+
+static stbtt_fontinfo info;
+static int failures;
+
+static unsigned char *load_file(const char *filename)
+{
+   FILE *f = fopen(filename, "rb");
+   unsigned char *data;
+   long size;
+   if (!f) return NULL;
+   fseek(f, 0, SEEK_END);
+   size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   data = malloc(size);
+   if (fread(data, 1, size, f) != (size_t) size) {
+      free(data);
+      data = NULL;
+   }
+   fclose(f);
+   return data;
+}
+
+/* Largest difference between two w x h bitmaps */
+static int max_diff(const unsigned char *a, int a_stride, const unsigned char *b, int b_stride, int w, int h)
+{
+   int x, y, d, m = 0;
+   for (y=0; y < h; ++y)
+      for (x=0; x < w; ++x) {
+         d = a[y*a_stride+x] - b[y*b_stride+x];
+         if (d < 0) d = -d;
+         if (d > m) m = d;
+      }
+   return m;
+}
+
+static void report(const char *name, int bitmaps, int diff, int tolerance)
+{
+   int ok = diff <= tolerance;
+   printf("%-32s %6d bitmaps, max diff %3d (tolerance %d) %s\n",
+          name, bitmaps, diff, tolerance, ok ? "ok" : "FAILED");
+   if (!ok) ++failures;
+}
+
+/* The reference: one glyph, on its own, with the default rasterizer */
+static unsigned char *render(float scale, float shift_x, float shift_y, int glyph, int *w, int *h)
+{
+   int x0, y0, x1, y1;
+   unsigned char *pixels;
+   stbtt_GetGlyphBitmapBoxSubpixel(&info, glyph, scale, scale, shift_x, shift_y, &x0,&y0,&x1,&y1);
+   *w = x1 - x0;
+   *h = y1 - y0;
+   pixels = calloc(*w * *h + 1, 1);
+   stbtt_MakeGlyphBitmapSubpixel(&info, pixels, *w, *h, *w, scale, scale, shift_x, shift_y, glyph);
+   return pixels;
+}
+
+/* The SIMD accumulation kernels must match the scalar loop bit for bit */
+static void check_simd(void)
+{
+   int s, c, n = 0, diff = 0;
+   for (s=0; s < NUM_SIZES; ++s) {
+      float scale = stbtt_ScaleForPixelHeight(&info, sizes[s]);
+      for (c=33; c < 127; ++c) {
+         int glyph = stbtt_FindGlyphIndex(&info, c), w, h, d;
+         unsigned char *ref = render(scale, 0.3f, 0, glyph, &w, &h);
+         unsigned char *out = calloc(w * h + 1, 1);
+         render_scalar(&info, out, w, h, w, scale, 0.3f, 0, glyph);
+         d = max_diff(ref, w, out, w, w, h);
+         if (d > diff) diff = d;
+         ++n;
+         free(out);
+         free(ref);
+      }
+   }
+   report("simd accumulate vs scalar", n, diff, 0);
+}
+
+/* The active edge table against the fixed-point rasterizer, which has
+   none: small glyphs keep the table on the stack, large ones allocate it */
+static void check_active_table(void)
+{
+   int s, c, n = 0, diff = 0;
+   for (s=0; s < NUM_SIZES; ++s) {
+      float scale = stbtt_ScaleForPixelHeight(&info, sizes[s]);
+      for (c=33; c < 127; ++c) {
+         int glyph = stbtt_FindGlyphIndex(&info, c), w, h, d;
+         unsigned char *ref = render(scale, 0, 0.6f, glyph, &w, &h);
+         unsigned char *out = calloc(w * h + 1, 1);
+         render_v3(&info, out, w, h, w, scale, 0, 0.6f, glyph);
+         d = max_diff(ref, w, out, w, w, h);
+         if (d > diff) diff = d;
+         ++n;
+         free(out);
+         free(ref);
+      }
+   }
+   report("active table vs fixed point", n, diff, 1);
+}
+
+/* Glyphs drawn side by side in lanes against one by one, and the fallback
+   when the lanes cannot be allocated */
+static void check_batch(void)
+{
+   stbtt_batch_glyph glyphs[94];
+   size_t single_alloc;
+   int s, c, i, n = 0, diff = 0, fallback_diff = 0, fallback_failed = 0;
+   for (s=0; s < NUM_SIZES && sizes[s] <= STBTT_BATCH_MAX_SIZE; ++s) {
+      float scale = stbtt_ScaleForPixelHeight(&info, sizes[s]);
+      int w = 0, h = 0, x0, y0, x1, y1;
+      unsigned char *ref, *out;
+      for (c=33; c < 127; ++c) {
+         stbtt_batch_glyph *g = &glyphs[c-33];
+         g->glyph = stbtt_FindGlyphIndex(&info, c);
+         stbtt_GetGlyphBitmapBox(&info, g->glyph, scale, scale, &x0,&y0,&x1,&y1);
+         g->output = (unsigned char *) (size_t) w;  // offset until the buffers exist
+         g->w = x1 - x0;
+         g->h = y1 - y0;
+         w += g->w;
+         if (g->h > h) h = g->h;
+      }
+      ref = calloc(w * h + 1, 1);
+      out = calloc(w * h + 1, 1);
+
+      largest_alloc = 0;
+      for (i=0; i < 94; ++i)
+         stbtt_MakeGlyphBitmap(&info, ref + (size_t) glyphs[i].output, glyphs[i].w, glyphs[i].h, w, scale, scale, glyphs[i].glyph);
+      single_alloc = largest_alloc;
+      for (i=0; i < 94; ++i)
+         glyphs[i].output = out + (size_t) glyphs[i].output;
+      stbtt_MakeGlyphBitmapBatch(&info, glyphs, 94, w, scale, scale);
+      i = max_diff(ref, w, out, w, w, h);
+      if (i > diff) diff = i;
+
+      // nothing a single glyph needs fails, the lanes do
+      memset(out, 0, w * h);
+      fail_above = single_alloc;
+      failed_allocs = 0;
+      stbtt_MakeGlyphBitmapBatch(&info, glyphs, 94, w, scale, scale);
+      fail_above = (size_t) -1;
+      if (failed_allocs) ++fallback_failed;
+      i = max_diff(ref, w, out, w, w, h);
+      if (i > fallback_diff) fallback_diff = i;
+
+      n += 94;
+      free(out);
+      free(ref);
+   }
+   report("batch lanes vs single", n, diff, 1);
+   report("batch without lanes vs single", n, fallback_diff, 0);
+   if (fallback_failed == 0) {
+      printf("batch without lanes: no lane allocation failed\n");
+      ++failures;
+   }
+}
+
+static void render_v2(const stbtt_fontinfo *info, unsigned char *output, int w, int h, int stride, float scale, float shift_x, float shift_y, int glyph)
+{
+   stbtt_MakeGlyphBitmapSubpixel(info, output, w, h, stride, scale, scale, shift_x, shift_y, glyph);
+}
+
+static void tile_v2(const stbtt_fontinfo *info, unsigned char *output, int tile_x, int tile_y, int tile_w, int tile_h, int stride, float scale, int glyph)
+{
+   stbtt_MakeGlyphBitmapTile(info, output, tile_x, tile_y, tile_w, tile_h, stride, scale, scale, 0, 0, glyph);
+}
+
+#define TILE_W 13
+#define TILE_H 11
+#define MARGIN 5
+
+/* A glyph assembled from tiles that straddle its box against the full
+   render, with one rasterizer; outside of the box, tiles must be blank */
+static void check_tiles(const char *name, render_func *render_full, tile_func *render_tile)
+{
+   unsigned char tile[TILE_W * TILE_H];
+   int s, c, n = 0, diff = 0;
+   for (s=0; s < NUM_SIZES; ++s) {
+      float scale = stbtt_ScaleForPixelHeight(&info, sizes[s]);
+      for (c=33; c < 127; ++c) {
+         int glyph = stbtt_FindGlyphIndex(&info, c), x0, y0, x1, y1, w, h, cw, ch, tx, ty, y, d;
+         unsigned char *ref, *out;
+         stbtt_GetGlyphBitmapBox(&info, glyph, scale, scale, &x0,&y0,&x1,&y1);
+         w = x1 - x0;
+         h = y1 - y0;
+         cw = w + 2*MARGIN + TILE_W;
+         ch = h + 2*MARGIN + TILE_H;
+         ref = calloc(cw * ch, 1);
+         out = calloc(cw * ch, 1);
+         render_full(&info, ref + MARGIN*cw + MARGIN, w, h, cw, scale, 0, 0, glyph);
+         for (ty=-MARGIN; ty < h + MARGIN; ty += TILE_H)
+            for (tx=-MARGIN; tx < w + MARGIN; tx += TILE_W) {
+               render_tile(&info, tile, tx, ty, TILE_W, TILE_H, TILE_W, scale, glyph);
+               for (y=0; y < TILE_H; ++y)
+                  memcpy(out + (ty + MARGIN + y)*cw + tx + MARGIN, tile + y*TILE_W, TILE_W);
+            }
+         d = max_diff(ref, cw, out, cw, cw, ch);
+         if (d > diff) diff = d;
+         ++n;
+         free(out);
+         free(ref);
+      }
+   }
+   report(name, n, diff, 1);
+}
+
+/* Tiles deep inside glyphs too big to render whole, where most edges lie far
+   outside of the tile: the fixed-point rasterizer against the default one.
+   The tiles are centered on points of the outline */
+static void check_far_tiles(void)
+{
+   static const char *chars = "@gWO";
+   unsigned char a[TILE_W * TILE_H], b[TILE_W * TILE_H];
+   float scale = stbtt_ScaleForPixelHeight(&info, 100000);
+   int n = 0, diff = 0, i, d;
+   const char *c;
+   for (c=chars; *c; ++c) {
+      int glyph = stbtt_FindGlyphIndex(&info, *c), x0, y0, x1, y1, num_verts;
+      stbtt_vertex *vertices;
+      stbtt_GetGlyphBitmapBox(&info, glyph, scale, scale, &x0,&y0,&x1,&y1);
+      num_verts = stbtt_GetGlyphShape(&info, glyph, &vertices);
+      for (i=0; i < num_verts; i += 3) {
+         int tx = (int) (vertices[i].x * scale) - x0 - TILE_W/2;
+         int ty = (int) (-vertices[i].y * scale) - y0 - TILE_H/2;
+         tile_v2(&info, a, tx, ty, TILE_W, TILE_H, TILE_W, scale, glyph);
+         tile_v3(&info, b, tx, ty, TILE_W, TILE_H, TILE_W, scale, glyph);
+         d = max_diff(a, TILE_W, b, TILE_W, TILE_W, TILE_H);
+         if (d > diff) diff = d;
+         ++n;
+      }
+      stbtt_FreeShape(&info, vertices);
+   }
+   report("far tiles, v3 vs v2", n, diff, 1);
+}
+
+/* Spans painted back into a bitmap against the bitmap: the default
+   rasterizer emits them from its sweep, the others from a bitmap. They must
+   lie inside the box, in order, without overlapping or empty runs */
+static void check_spans(void)
+{
+   int s, c, i, n = 0, diff = 0, bad = 0;
+   for (s=0; s < NUM_SIZES; ++s) {
+      float scale = stbtt_ScaleForPixelHeight(&info, sizes[s]);
+      for (c=33; c < 127; ++c) {
+         int glyph = stbtt_FindGlyphIndex(&info, c), w, h, sw, sh, xoff, yoff, num, d;
+         unsigned char *ref = render(scale, 0.3f, 0.6f, glyph, &w, &h);
+         unsigned char *out = calloc(w * h + 1, 1);
+         stbtt_span *spans = stbtt_GetGlyphSpans(&info, scale, scale, 0.3f, 0.6f, glyph, &num, &sw, &sh, &xoff, &yoff);
+         if (sw != w || sh != h)
+            ++bad;
+         else
+            for (i=0; i < num; ++i) {
+               stbtt_span *p = &spans[i];
+               if (p->y < 0 || p->y >= h || p->x0 < 0 || p->x0 >= p->x1 || p->x1 > w || p->coverage == 0
+                   || (i > 0 && (p->y < p[-1].y || (p->y == p[-1].y && p->x0 < p[-1].x1)))) {
+                  ++bad;
+                  break;
+               }
+               memset(out + p->y*w + p->x0, p->coverage, p->x1 - p->x0);
+            }
+         d = max_diff(ref, w, out, w, w, h);
+         if (d > diff) diff = d;
+         ++n;
+         stbtt_FreeSpans(spans, NULL);
+         free(out);
+         free(ref);
+      }
+   }
+   report("spans vs bitmap", n, diff, 0);
+   if (bad) {
+      printf("spans vs bitmap: %d glyphs with misplaced spans\n", bad);
+      ++failures;
+   }
+}
+
+/* The subpixel phases of a glyph, rasterized from one set of edges,
+   against a render at each shift */
+static void check_phases(void)
+{
+   static const float shifts[4][2] = { {0,0}, {0.25f,0}, {0.5f,0.5f}, {0.75f,0.25f} };
+   stbtt_glyph_phase phases[4];
+   unsigned char *ref[4];
+   int s, c, i, n = 0, diff = 0;
+   for (s=0; s < NUM_SIZES; ++s) {
+      float scale = stbtt_ScaleForPixelHeight(&info, sizes[s]);
+      for (c=33; c < 127; ++c) {
+         int glyph = stbtt_FindGlyphIndex(&info, c), stride = 0, h = 0, d;
+         unsigned char *out;
+         for (i=0; i < 4; ++i) {
+            phases[i].shift_x = shifts[i][0];
+            phases[i].shift_y = shifts[i][1];
+            ref[i] = render(scale, shifts[i][0], shifts[i][1], glyph, &phases[i].w, &phases[i].h);
+            phases[i].output = (unsigned char *) (size_t) stride;  // offset until the buffer exists
+            stride += phases[i].w;
+            if (phases[i].h > h) h = phases[i].h;
+         }
+         out = calloc(stride * h + 1, 1);
+         for (i=0; i < 4; ++i)
+            phases[i].output = out + (size_t) phases[i].output;
+         stbtt_MakeGlyphBitmapPhases(&info, phases, 4, stride, scale, scale, glyph);
+         for (i=0; i < 4; ++i) {
+            d = max_diff(ref[i], phases[i].w, phases[i].output, stride, phases[i].w, phases[i].h);
+            if (d > diff) diff = d;
+            ++n;
+            free(ref[i]);
+         }
+         free(out);
+      }
+   }
+   report("phases vs subpixel", n, diff, 1);
+}
+
+int main(int argc, char **argv)
+{
+   const char *filename = argc > 1 ? argv[1] : getenv("STBTT_TEST_FONT");
+   unsigned char *data;
+
+   if (filename == NULL) filename = DEFAULT_FONT;
+   data = load_file(filename);
+   if (!data) {
+      printf("%s: cannot read font, skipping rasterizer checks\n", filename);
+      return 0;
+   }
+   if (!stbtt_InitFont(&info, data, stbtt_GetFontOffsetForIndex(data, 0))) {
+      fprintf(stderr, "%s: cannot load font\n", filename);
+      return 1;
+   }
+
+   check_simd();
+   check_active_table();
+   check_batch();
+   check_tiles("tiles vs full render", render_v2, tile_v2);
+   check_tiles("tiles vs full render, v1", render_v1, tile_v1);
+   check_tiles("tiles vs full render, v3", render_v3, tile_v3);
+   check_far_tiles();
+   check_spans();
+   check_phases();
+
+   free(data);
+   return failures ? 1 : 0;
+}